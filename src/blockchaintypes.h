@@ -107,6 +107,9 @@ struct Transaction {
     // Size of the transaction in bytes
     uint64_t byteSize;
 
+    // Size of the transaction in bytes without the witness data
+    uint64_t strippedSize;
+
     // Version bit for the transaction
     uint32_t version;
 
@@ -155,6 +158,16 @@ struct Block {
 };
 
 
+// Describes an output that was indexed earlier, kept so spends of it can be
+// resolved to a value and addresses without going back to the database
+struct PrevOutput {
+    // The value of the output in Satoshis
+    uint64_t value;
+
+    // The script identifiers (see SCRIPT_ID_*) of the addresses the output pays to
+    vector<string> scriptIds;
+};
+
 struct PotentialDoubleSpend {
     Transaction tx;
     Block block;
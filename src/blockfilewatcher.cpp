@@ -18,6 +18,8 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "blockfilewatcher.h"
+#include "logger.h"
+#include "metrics.h"
 #include "scriptsolver.h"
 #include "blockchaintypes.h"
 #include <iostream>
@@ -37,10 +39,10 @@ using namespace std;
 using json = nlohmann::json;
 
 // Constructor
-VtcBlockIndexer::BlockFileWatcher::BlockFileWatcher(string blocksDir, const shared_ptr<leveldb::DB> db, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor) {
-    this->db = db;
+VtcBlockIndexer::BlockFileWatcher::BlockFileWatcher(string blocksDir, const shared_ptr<VtcBlockIndexer::Database> database, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::ChainState> chainState) {
+    this->database = database;
     this->mempoolMonitor = mempoolMonitor;
-    blockIndexer.reset(new VtcBlockIndexer::BlockIndexer(this->db, this->mempoolMonitor));
+    blockIndexer.reset(new VtcBlockIndexer::BlockIndexer(this->database, this->mempoolMonitor, subscriptions, chainState));
     blockReader.reset(new VtcBlockIndexer::BlockReader(blocksDir));
     this->blocksDir = blocksDir;
     this->maxLastModified.tv_sec = 0;
@@ -70,7 +72,7 @@ void VtcBlockIndexer::BlockFileWatcher::startWatcher() {
                     if(result.st_mtim.tv_sec > this->maxLastModified.tv_sec) {
                         this->maxLastModified = result.st_mtim;
                         if(!shouldUpdate)
-                            cout << "Change(s) detected, starting index update." << endl;
+                            VTC_LOG(LOG_LEVEL_INFO, "Change(s) detected, starting index update.");
                         shouldUpdate = true;
                     }
                 }
@@ -198,9 +200,15 @@ string VtcBlockIndexer::BlockFileWatcher::processNextBlock(string prevBlockHash)
         } 
     
         if(!blockIndexer->hasIndexedBlock(bestBlock.blockHash, this->blockHeight)) {
+            chrono::steady_clock::time_point readStart = chrono::steady_clock::now();
             VtcBlockIndexer::Block fullBlock = blockReader->readBlock(bestBlock.fileName, bestBlock.filePosition, this->blockHeight, false);
+            Metrics::addElapsed(METRIC_INDEX_READ_NANOSECONDS, readStart);
            
-            blockIndexer->indexBlock(fullBlock);
+            if(!blockIndexer->indexBlock(fullBlock)) {
+                // Stop here, the next update continues from this block
+                VTC_LOG(LOG_LEVEL_ERROR, "Indexing stopped at height " << this->blockHeight);
+                return "";
+            }
         }
         return bestBlock.blockHash;
 
@@ -218,11 +226,11 @@ void VtcBlockIndexer::BlockFileWatcher::updateIndex() {
    
     this->blockHeight = 0;
     this->totalBlocks = 0;
-    cout << "Scanning blocks..." << endl;
+    VTC_LOG(LOG_LEVEL_INFO, "Scanning blocks...");
 
     scanBlockFiles(blocksDir);
     
-    cout << "Found " << this->totalBlocks << " blocks. Constructing longest chain..." << endl;
+    VTC_LOG(LOG_LEVEL_INFO, "Found " << this->totalBlocks << " blocks. Constructing longest chain...");
 
     // The blockchain starts with the genesis block that has a zero hash as Previous Block Hash
     string nextBlock = "0000000000000000000000000000000000000000000000000000000000000000";
@@ -234,16 +242,19 @@ void VtcBlockIndexer::BlockFileWatcher::updateIndex() {
         double seconds = difftime(time(NULL), start);
         if(seconds >= nextUpdate) { 
             nextUpdate += 10;
-            cout << "Construction is at height " << this->blockHeight << endl;
+            VTC_LOG(LOG_LEVEL_INFO, "Construction is at height " << this->blockHeight);
         }
         this->blockHeight++;
         nextBlock = processedBlock;
         processedBlock = processNextBlock(nextBlock);
     }
 
-    cout << "Done. Processed " << this->blockHeight << " blocks. Have a nice day." << endl;
+    VTC_LOG(LOG_LEVEL_INFO, "Done. Processed " << this->blockHeight << " blocks. Have a nice day.");
 
     this->blocks.clear();
+
+    // All available blocks are indexed, let the database switch to serving
+    this->database->reachedTip();
 }
 
 vector<VtcBlockIndexer::ScannedBlock> VtcBlockIndexer::BlockFileWatcher::indexBlocksByHeight(int height, vector<VtcBlockIndexer::ScannedBlock> matchingBlocks, VtcBlockIndexer::ScannedBlock blockOnMainChain) {
@@ -505,16 +516,17 @@ json VtcBlockIndexer::BlockFileWatcher::txToJson(VtcBlockIndexer::Transaction tx
     jtx["vin"] = vins;
     
     json vouts = json::array();
-    for (VtcBlockIndexer::TransactionOutput txo : tx.outputs) {
+    for (const VtcBlockIndexer::TransactionOutput& txo : tx.outputs) {
         json vout;
 
         json scriptPubKey;
         vout["to"] = json::array();
-        vector<string> addresses = scriptSolver->getAddressesFromScript(txo.script);
-        for(string address : addresses) {
+        VtcBlockIndexer::ScriptClassification classification = scriptSolver->classifyScript(txo.script);
+        vector<string> addresses = scriptSolver->getAddressesFromScript(txo.script, classification);
+        for(const string& address : addresses) {
             vout["to"].push_back(address);
         }
-        vout["type"] = scriptSolver->getScriptTypeName(txo.script);
+        vout["type"] = scriptSolver->getScriptTypeName(classification);
         vout["valueSat"] = txo.value;
         
         vouts.push_back(vout);
@@ -27,6 +27,7 @@
 #include <unordered_map>
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
+#include "database.h"
 #include "blockchaintypes.h"
 #include "mempoolmonitor.h"
 #include "blockindexer.h"
@@ -47,7 +48,7 @@ class BlockFileWatcher {
 public:
     /** Constructs a BlockIndexer instance using the given block data directory
      */
-    BlockFileWatcher(string blocksDir, const shared_ptr<leveldb::DB> db, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor);
+    BlockFileWatcher(string blocksDir, const shared_ptr<VtcBlockIndexer::Database> database, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::ChainState> chainState);
 
     /** Starts watching the blocksdir for changes and will execute an incremental
      * indexing when files have changed */
@@ -96,7 +97,7 @@ private:
      */     
     string processNextBlock(string prevBlockHash);
     string blocksDir;
-    shared_ptr<leveldb::DB> db;
+    shared_ptr<VtcBlockIndexer::Database> database;
     shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor;
     unique_ptr<VtcBlockIndexer::BlockReader> blockReader;
     unique_ptr<VtcBlockIndexer::BlockIndexer> blockIndexer;
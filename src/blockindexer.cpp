@@ -18,8 +18,11 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "blockindexer.h"
+#include "logger.h"
+#include "metrics.h"
 #include "scriptsolver.h"
 #include "blockchaintypes.h"
+#include "parallel.h"
 #include <iostream>
 #include <sstream>
 
@@ -27,6 +30,10 @@
 #include <memory>
 #include <iomanip>
 #include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <array>
+#include <algorithm>
 
 
 using namespace std;
@@ -34,18 +41,160 @@ using namespace std;
 // This map keeps the nextTxoIndex in memory for speed - no database fetching on every TX
 unordered_map<string, int> nextTxoIndex;
 
+// Maximum number of indexed outputs kept in memory to resolve spends from
+const size_t maxPrevOutputs = 1000000;
+
+// Blocks are only split over threads when each thread gets at least this much work
+const size_t minOutputsPerChunk = 256;
+const size_t minTransactionsPerChunk = 64;
+
+namespace {
+    // The entry indexes and spent outputs of a transaction, determined before
+    // its keys are built
+    struct TransactionIndexPlan {
+        // Per output, per script identifier: the index of the script's txo entry,
+        // of the block's txo entry and of the output's address entry
+        vector<vector<array<int, 3>>> outputEntryIndexes;
+
+        // Per input: the output it spends and the index of the block's txospent entry
+        vector<VtcBlockIndexer::PrevOutput> prevOutputs;
+        vector<int> spentEntryIndexes;
+
+        uint64_t valueIn;
+        bool coinbase;
+
+        // False when a spent output could not be resolved, the value in and fee
+        // are unknown then
+        bool valueInKnown;
+    };
+
+    // Keys and values to write, per store (indexed by DatabaseStore)
+    typedef array<vector<pair<string, string>>, VtcBlockIndexer::STORE_COUNT> StoreRecords;
+
+    // Appends the number left padded with zeroes, like setw(width) << setfill('0')
+    void appendPadded(string& out, uint64_t value, size_t width) {
+        char digits[20];
+        size_t length = 0;
+        do {
+            digits[length++] = '0' + (value % 10);
+            value /= 10;
+        } while(value > 0);
+        if(length < width) {
+            out.append(width - length, '0');
+        }
+        while(length > 0) {
+            out += digits[--length];
+        }
+    }
 
+    string padded(uint64_t value, size_t width) {
+        string result;
+        appendPadded(result, value, width);
+        return result;
+    }
 
-VtcBlockIndexer::BlockIndexer::BlockIndexer(const shared_ptr<leveldb::DB> db, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor) {
-    this->db = db;
+    // Builds the keys and values for the transaction in the order they are written to the batches
+    void buildTransactionRecords(const VtcBlockIndexer::Block& block, size_t txIndex, const TransactionIndexPlan& plan,
+                                 const vector<vector<string>>& outputScriptIds,
+                                 const vector<VtcBlockIndexer::ScriptClassification>& outputClassifications,
+                                 size_t firstOutput, StoreRecords& records) {
+        vector<pair<string, string>>& txRecords = records[VtcBlockIndexer::STORE_TXS];
+        vector<pair<string, string>>& addressRecords = records[VtcBlockIndexer::STORE_ADDRESSES];
+        vector<pair<string, string>>& spentRecords = records[VtcBlockIndexer::STORE_SPENT];
+        const VtcBlockIndexer::Transaction& tx = block.transactions[txIndex];
+        string heightPadded = padded(block.height, 8);
+
+        txRecords.emplace_back("block-" + block.blockHash + "-tx-" + padded(txIndex, 8), tx.txHash);
+        txRecords.emplace_back("tx-filePosition-" + tx.txHash, block.fileName + padded(tx.filePosition, 12));
+        txRecords.emplace_back("tx-" + tx.txHash + "-block", block.blockHash);
+
+        uint64_t valueOut = 0;
+        for(size_t i = 0; i < tx.outputs.size(); i++) {
+            const VtcBlockIndexer::TransactionOutput& out = tx.outputs[i];
+            const vector<string>& scriptIds = outputScriptIds[firstOutput + i];
+            const VtcBlockIndexer::ScriptClassification& classification = outputClassifications[firstOutput + i];
+            valueOut += out.value;
+
+            string outpoint = tx.txHash;
+            appendPadded(outpoint, out.index, 8);
+
+            if(scriptIds.size() > 1 && classification.type == SCRIPT_TYPE_MULTISIG) {
+                txRecords.emplace_back("multisigtx-" + tx.txHash + "-" + padded(out.index, 8), std::to_string(classification.requiredSignatures));
+            }
+
+            string txoValue = outpoint + heightPadded + std::to_string(out.value);
+            for(size_t j = 0; j < scriptIds.size(); j++) {
+                const array<int, 3>& entryIndexes = plan.outputEntryIndexes[i][j];
+                string txoKey = scriptIds[j] + "-txo-" + padded(entryIndexes[0], 8);
+                addressRecords.emplace_back(txoKey, txoValue);
+                addressRecords.emplace_back(block.blockHash + "-txo-" + padded(entryIndexes[1], 8), txoKey);
+                addressRecords.emplace_back(outpoint + "-address-" + padded(entryIndexes[2], 8), scriptIds[j]);
+            }
+            addressRecords.emplace_back(outpoint + "-value", std::to_string(out.value));
+        }
+
+        for(size_t i = 0; i < tx.inputs.size(); i++) {
+            const VtcBlockIndexer::TransactionInput& txi = tx.inputs[i];
+            if(txi.coinbase) continue;
+
+            string txSpentKey = "txo-" + txi.txHash + "-" + padded(txi.txoIndex, 8) + "-spent";
+            const VtcBlockIndexer::PrevOutput& prevOutput = plan.prevOutputs[i];
+            string spendingTx = block.blockHash + tx.txHash;
+            appendPadded(spendingTx, txi.index, 8);
+            appendPadded(spendingTx, prevOutput.value, 20);
+            for(const string& scriptId : prevOutput.scriptIds) {
+                spendingTx += scriptId;
+            }
+            spentRecords.emplace_back(txSpentKey, spendingTx);
+            spentRecords.emplace_back(block.blockHash + "-txospent-" + padded(plan.spentEntryIndexes[i], 8), txSpentKey);
+        }
+
+        if(plan.valueInKnown) {
+            txRecords.emplace_back("tx-" + tx.txHash + "-valuein", std::to_string(plan.valueIn));
+            txRecords.emplace_back("tx-" + tx.txHash + "-fee", std::to_string((plan.coinbase || plan.valueIn < valueOut) ? 0 : plan.valueIn - valueOut));
+        }
+    }
+}
+
+
+
+VtcBlockIndexer::BlockIndexer::BlockIndexer(const shared_ptr<VtcBlockIndexer::Database> database, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::ChainState> chainState) {
+    this->database = database;
     this->mempoolMonitor = mempoolMonitor;
+    this->subscriptions = subscriptions;
+    this->chainState = chainState;
     this->scriptSolver = make_unique<VtcBlockIndexer::ScriptSolver>();
+    pendingBlockLeft = !recoverPendingBlock();
 }
 
+bool VtcBlockIndexer::BlockIndexer::recoverPendingBlock() {
+    shared_ptr<leveldb::DB> chainDb = this->database->get(STORE_CHAIN);
+
+    string pendingBlock;
+    Metrics::add(METRIC_DB_GETS);
+    leveldb::Status s = chainDb->Get(leveldb::ReadOptions(), "pendingblock", &pendingBlock);
+    if(!s.ok()) return s.IsNotFound();
+
+    // The value is the 8 digit height followed by the block hash, and the hash of
+    // the block it replaced in case of a reorg. The block's chain entries were never
+    // written, so it will be indexed again. Remove whatever made it into the other
+    // stores so its TXOs aren't listed twice.
+    string blockHash = pendingBlock.substr(8, 64);
+    VTC_LOG(LOG_LEVEL_WARNING, "Removing partially indexed block " << blockHash);
+    if(!clearBlockTxos(blockHash)) return false;
+    if(pendingBlock.size() > 72) {
+        string disconnectedBlockHash = pendingBlock.substr(72);
+        VTC_LOG(LOG_LEVEL_WARNING, "Removing disconnected block " << disconnectedBlockHash);
+        if(!clearBlockTxos(disconnectedBlockHash)) return false;
+    }
+    return chainDb->Delete(leveldb::WriteOptions(), "pendingblock").ok();
+}
 
-int VtcBlockIndexer::BlockIndexer::getNextTxoIndex(string prefix) {
+int VtcBlockIndexer::BlockIndexer::getNextTxoIndex(DatabaseStore store, string prefix) {
     if(nextTxoIndex.find(prefix) == nextTxoIndex.end()) {
-        leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+        shared_ptr<leveldb::DB> db = this->database->get(store);
+        Metrics::add(METRIC_DB_ITERATORS);
+        leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
         nextTxoIndex[prefix] = 1;
         string start(prefix + "-00000001");
         string limit(prefix + "-99999999");
@@ -64,42 +213,143 @@ int VtcBlockIndexer::BlockIndexer::getNextTxoIndex(string prefix) {
     return nextTxoIndex[prefix];
 }
 
+void VtcBlockIndexer::BlockIndexer::cachePrevOutput(const string& outpoint, const VtcBlockIndexer::PrevOutput& prevOutput) {
+    prevOutputs[outpoint] = prevOutput;
+    prevOutputsOrder.push_back(outpoint);
+    while(prevOutputsOrder.size() > maxPrevOutputs) {
+        prevOutputs.erase(prevOutputsOrder.front());
+        prevOutputsOrder.pop_front();
+    }
+}
+
+bool VtcBlockIndexer::BlockIndexer::getPrevOutput(const string& txHash, uint32_t txoIndex, VtcBlockIndexer::PrevOutput& prevOutput) {
+    stringstream outpoint;
+    outpoint << txHash << setw(8) << setfill('0') << txoIndex;
+
+    auto cached = prevOutputs.find(outpoint.str());
+    if(cached != prevOutputs.end()) {
+        // An output can only be spent once, so it is no longer needed in memory
+        prevOutput = cached->second;
+        prevOutputs.erase(cached);
+        return true;
+    }
+
+    shared_ptr<leveldb::DB> db = this->database->get(STORE_ADDRESSES);
+    prevOutput.value = 0;
+    prevOutput.scriptIds = {};
+
+    string valueString;
+    Metrics::add(METRIC_DB_GETS);
+    leveldb::Status s = db->Get(leveldb::ReadOptions(), outpoint.str() + "-value", &valueString);
+    if(!s.ok()) {
+        VTC_LOG(LOG_LEVEL_WARNING, "Could not resolve spent output " << txHash << ":" << txoIndex);
+        return false;
+    }
+    prevOutput.value = stoull(valueString);
+
+    string start(outpoint.str() + "-address-00000001");
+    string limit(outpoint.str() + "-address-99999999");
+    Metrics::add(METRIC_DB_ITERATORS);
+    leveldb::Iterator* it = db->NewIterator(leveldb::ReadOptions());
+    for (it->Seek(start);
+            it->Valid() && it->key().ToString() < limit;
+            it->Next()) {
+        prevOutput.scriptIds.push_back(it->value().ToString());
+    }
+    assert(it->status().ok());  // Check for any errors found during the scan
+    delete it;
+
+    return true;
+}
+
 bool VtcBlockIndexer::BlockIndexer::clearBlockTxos(string blockHash) {
-    leveldb::WriteBatch batch;
+    shared_ptr<leveldb::DB> addressDb = this->database->get(STORE_ADDRESSES);
+    shared_ptr<leveldb::DB> spentDb = this->database->get(STORE_SPENT);
+    shared_ptr<leveldb::DB> txDb = this->database->get(STORE_TXS);
+    leveldb::WriteBatch addressBatch;
+    leveldb::WriteBatch spentBatch;
+    leveldb::WriteBatch txBatch;
     
     string start(blockHash + "-txo-00000001");
     string limit(blockHash + "-txo-99999999");
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    Metrics::add(METRIC_DB_ITERATORS, 3);
+    leveldb::Iterator* it = addressDb->NewIterator(leveldb::ReadOptions());
     for (it->Seek(start);
             it->Valid() && it->key().ToString() < limit;
             it->Next()) {
-        batch.Delete(it->value().ToString());           
+        addressBatch.Delete(it->value().ToString());           
+        addressBatch.Delete(it->key());
     }
     assert(it->status().ok());  // Check for any errors found during the scan
     delete it;
 
     string spentStart(blockHash + "-txospent-00000001");
     string spentLimit(blockHash + "-txospent-99999999");
-    it = this->db->NewIterator(leveldb::ReadOptions());
+    it = spentDb->NewIterator(leveldb::ReadOptions());
     for (it->Seek(spentStart);
             it->Valid() && it->key().ToString() < spentLimit;
             it->Next()) {
-        batch.Delete(it->value().ToString());           
+        spentBatch.Delete(it->value().ToString());           
+        spentBatch.Delete(it->key());
+    }
+    assert(it->status().ok());  // Check for any errors found during the scan
+    delete it;
+
+    // Only drop the transaction's own entries while they still point to this
+    // block. A transaction that was confirmed again in the other chain keeps them.
+    string txStart("block-" + blockHash + "-tx-00000000");
+    string txLimit("block-" + blockHash + "-tx-99999999");
+    it = txDb->NewIterator(leveldb::ReadOptions());
+    for (it->Seek(txStart);
+            it->Valid() && it->key().ToString() < txLimit;
+            it->Next()) {
+        string txHash = it->value().ToString();
+        txBatch.Delete(it->key());
+
+        string txBlockHash;
+        Metrics::add(METRIC_DB_GETS);
+        leveldb::Status s = txDb->Get(leveldb::ReadOptions(), "tx-" + txHash + "-block", &txBlockHash);
+        if(s.ok() && txBlockHash != blockHash) continue;
+        txBatch.Delete("tx-" + txHash + "-block");
+        txBatch.Delete("tx-filePosition-" + txHash);
+        txBatch.Delete("tx-" + txHash + "-valuein");
+        txBatch.Delete("tx-" + txHash + "-fee");
+
+        string multisigPrefix("multisigtx-" + txHash + "-");
+        Metrics::add(METRIC_DB_ITERATORS);
+        leveldb::Iterator* multisigIt = txDb->NewIterator(leveldb::ReadOptions());
+        for (multisigIt->Seek(multisigPrefix);
+                multisigIt->Valid() && multisigIt->key().starts_with(multisigPrefix);
+                multisigIt->Next()) {
+            txBatch.Delete(multisigIt->key());
+        }
+        assert(multisigIt->status().ok());  // Check for any errors found during the scan
+        delete multisigIt;
     }
     assert(it->status().ok());  // Check for any errors found during the scan
     delete it;
 
-    leveldb::Status s = this->db->Write(leveldb::WriteOptions(), &batch);
+    // The entry counts changed, so the next indexes are counted again from the store
+    nextTxoIndex.clear();
+
+    Metrics::add(METRIC_DB_WRITES, 3);
+    leveldb::Status s = spentDb->Write(leveldb::WriteOptions(), &spentBatch);
+    if(!s.ok()) return false;
+    s = addressDb->Write(leveldb::WriteOptions(), &addressBatch);
+    if(!s.ok()) return false;
+    s = txDb->Write(leveldb::WriteOptions(), &txBatch);
     return s.ok();
 }
 
 bool VtcBlockIndexer::BlockIndexer::hasIndexedBlock(string blockHash, int blockHeight)
 {
+    shared_ptr<leveldb::DB> db = this->database->get(STORE_CHAIN);
     stringstream ss;
     ss << "block-" << setw(8) << setfill('0') << blockHeight;
 
     string existingBlockHash;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), ss.str(), &existingBlockHash);
+    Metrics::add(METRIC_DB_GETS);
+    leveldb::Status s = db->Get(leveldb::ReadOptions(), ss.str(), &existingBlockHash);
     if(s.ok() && existingBlockHash == blockHash) {
         return true;
     }
@@ -108,37 +358,71 @@ bool VtcBlockIndexer::BlockIndexer::hasIndexedBlock(string blockHash, int blockH
 }
 
 bool VtcBlockIndexer::BlockIndexer::indexBlock(Block block) {
-    //cout << "Indexing block " << block.blockHash << " (Height " << block.height << ")" << endl;
+    shared_ptr<leveldb::DB> chainDb = this->database->get(STORE_CHAIN);
+    VTC_LOG(LOG_LEVEL_DEBUG, "Indexing block " << block.blockHash << " (Height " << block.height << ")");
+
+    if(pendingBlockLeft) {
+        if(!recoverPendingBlock()) return false;
+        pendingBlockLeft = false;
+    }
     
     
     stringstream ss;
     ss << "block-" << setw(8) << setfill('0') << block.height;
     
     string existingBlockHash;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), ss.str(), &existingBlockHash);
+    Metrics::add(METRIC_DB_GETS);
+    leveldb::Status s = chainDb->Get(leveldb::ReadOptions(), ss.str(), &existingBlockHash);
 
+    string disconnectedBlockHash;
     if(s.ok() && existingBlockHash == block.blockHash) {
         // Block found in database and matches. This block is indexed already, so skip.
         return true;
     } else if (s.ok()) {
-        // There was a different block at this height. Ditch the TXOs from the old block.
-        clearBlockTxos(existingBlockHash);
+        disconnectedBlockHash = existingBlockHash;
     }
 
     stringstream blockHeight;
     blockHeight << setw(8) << setfill('0') << block.height;
 
-    string highestBlock;
-    s = this->db->Get(leveldb::ReadOptions(), "highestblock", &highestBlock);
+    // Mark the block as pending before anything else is written. If the indexer
+    // stops or a write fails halfway, the next start removes the partial entries.
+    // A replaced block leaves the chain in the same write, so no chain snapshot
+    // shows it once its TXOs are being removed.
+    leveldb::WriteBatch pendingBatch;
+    pendingBatch.Put("pendingblock", blockHeight.str() + block.blockHash + disconnectedBlockHash);
+    if(!disconnectedBlockHash.empty()) {
+        pendingBatch.Delete(ss.str());
+        pendingBatch.Delete("block-hash-" + disconnectedBlockHash);
+    }
+    Metrics::add(METRIC_DB_WRITES);
+    s = chainDb->Write(leveldb::WriteOptions(), &pendingBatch);
     if(!s.ok()) {
-        this->db->Put(leveldb::WriteOptions(), "highestblock", blockHeight.str());
-    } else {
-        if(stoull(highestBlock) < block.height) {
-            this->db->Put(leveldb::WriteOptions(), "highestblock", blockHeight.str());
+        VTC_LOG(LOG_LEVEL_ERROR, "Could not mark block " << block.blockHash << " as pending: " << s.ToString());
+        return false;
+    }
+
+    if(!disconnectedBlockHash.empty()) {
+        // There was a different block at this height. Ditch the TXOs from the old block.
+        if(!clearBlockTxos(disconnectedBlockHash)) {
+            VTC_LOG(LOG_LEVEL_ERROR, "Could not remove disconnected block " << disconnectedBlockHash);
+            pendingBlockLeft = true;
+            return false;
         }
     }
-    
+
+    // The chain store is written last, so a block only shows up as indexed
+    // once its entries are in all other stores
     leveldb::WriteBatch batch;
+
+    string highestBlock;
+    Metrics::add(METRIC_DB_GETS);
+    s = chainDb->Get(leveldb::ReadOptions(), "highestblock", &highestBlock);
+    bool isTip = !s.ok() || stoull(highestBlock) <= block.height;
+    if(!s.ok() || stoull(highestBlock) < block.height) {
+        batch.Put("highestblock", blockHeight.str());
+    }
+
     batch.Put(ss.str(), block.blockHash);
 
     
@@ -174,82 +458,163 @@ bool VtcBlockIndexer::BlockIndexer::indexBlock(Block block) {
     ssBlockTxCountHeightKey << "block-txcount-"  << setw(8) << setfill('0') << block.height;
     batch.Put(ssBlockTxCountHeightKey.str(), std::to_string(block.transactions.size()));
 
-    int txIndex = -1;
-    // TODO: Verify block integrity
-    for(VtcBlockIndexer::Transaction tx : block.transactions) {
-        txIndex++;
-        stringstream blockTxKey;
-        blockTxKey << "block-" << block.blockHash << "-tx-" << setw(8) << setfill('0') << txIndex;
-        batch.Put(blockTxKey.str(), tx.txHash);
-
-        stringstream ssTxFilePositionKey;
-        ssTxFilePositionKey << "tx-filePosition-" << tx.txHash;
-        stringstream ssTxFilePositionValue;
-        ssTxFilePositionValue << block.fileName << setw(12) << setfill('0') << tx.filePosition;
-    
-        batch.Put(ssTxFilePositionKey.str(), ssTxFilePositionValue.str());
-
-        stringstream txBlockKey;
-        txBlockKey << "tx-" << tx.txHash << "-block";
-        batch.Put(txBlockKey.str(), block.blockHash);
-
-        for(VtcBlockIndexer::TransactionOutput out : tx.outputs) {
-            vector<string> addresses = this->scriptSolver->getAddressesFromScript(out.script);
-            if(addresses.size() > 1) {
-                if(scriptSolver->isMultiSig(out.script)) {
-                    stringstream txoMultiSigKey;
-                    txoMultiSigKey << "multisigtx-" << tx.txHash << "-" << setw(8) << setfill('0') << out.index;
-                    batch.Put(txoMultiSigKey.str(), std::to_string(scriptSolver->requiredSignatures(out.script)));
-                }
+    chrono::steady_clock::time_point stageStart = chrono::steady_clock::now();
+
+    // Flatten the outputs of the block, so the work on them can be split evenly
+    vector<const vector<unsigned char>*> outputScripts;
+    vector<size_t> firstOutputOfTx;
+    for(const VtcBlockIndexer::Transaction& tx : block.transactions) {
+        firstOutputOfTx.push_back(outputScripts.size());
+        for(const VtcBlockIndexer::TransactionOutput& out : tx.outputs) {
+            outputScripts.push_back(&out.script);
+        }
+    }
+
+    // Solve the output scripts in parallel chunks. Each chunk hashes the
+    // public keys in its scripts in a single batch.
+    vector<vector<string>> outputScriptIds(outputScripts.size());
+    vector<VtcBlockIndexer::ScriptClassification> outputClassifications(outputScripts.size());
+    runInChunks(outputScripts.size(), minOutputsPerChunk, [&](size_t begin, size_t end) {
+        vector<const vector<unsigned char>*> chunkScripts(outputScripts.begin() + begin, outputScripts.begin() + end);
+        vector<VtcBlockIndexer::ScriptClassification> chunkClassifications;
+        vector<vector<string>> chunkScriptIds = this->scriptSolver->getScriptIdsFromScripts(chunkScripts, &chunkClassifications);
+        for(size_t i = begin; i < end; i++) {
+            outputScriptIds[i] = std::move(chunkScriptIds[i - begin]);
+            outputClassifications[i] = chunkClassifications[i - begin];
+        }
+    });
+
+    Metrics::addElapsed(METRIC_INDEX_SOLVE_NANOSECONDS, stageStart);
+
+    // Assign the entry indexes and resolve the spent outputs. These depend on
+    // state shared between transactions, so this runs in block order.
+    vector<TransactionIndexPlan> plans(block.transactions.size());
+    for(size_t txIndex = 0; txIndex < block.transactions.size(); txIndex++) {
+        const VtcBlockIndexer::Transaction& tx = block.transactions[txIndex];
+        TransactionIndexPlan& plan = plans[txIndex];
+        plan.valueIn = 0;
+        plan.coinbase = false;
+        plan.valueInKnown = true;
+
+        for(size_t i = 0; i < tx.outputs.size(); i++) {
+            const VtcBlockIndexer::TransactionOutput& out = tx.outputs[i];
+            const vector<string>& scriptIds = outputScriptIds[firstOutputOfTx[txIndex] + i];
+            string outpoint = tx.txHash;
+            appendPadded(outpoint, out.index, 8);
+
+            plan.outputEntryIndexes.push_back({});
+            for(const string& scriptId : scriptIds) {
+                plan.outputEntryIndexes.back().push_back({{
+                    getNextTxoIndex(STORE_ADDRESSES, scriptId + "-txo"),
+                    getNextTxoIndex(STORE_ADDRESSES, block.blockHash + "-txo"),
+                    getNextTxoIndex(STORE_ADDRESSES, outpoint + "-address")
+                }});
             }
-        
-            for(string address : addresses) {
-                int nextIndex = getNextTxoIndex(address + "-txo");
-                stringstream txoKey;
-                txoKey << address << "-txo-" << setw(8) << setfill('0') << nextIndex;
-                stringstream txoValue;
-                txoValue << tx.txHash << setw(8) << setfill('0') << out.index << setw(8) << setfill('0') << block.height << out.value;
-                batch.Put(txoKey.str(), txoValue.str());
-
-                nextIndex = getNextTxoIndex(block.blockHash + "-txo");
-                stringstream blockTxoKey;
-                blockTxoKey << block.blockHash << "-txo-" << setw(8) << setfill('0') << nextIndex;
-                batch.Put(blockTxoKey.str(), txoKey.str());
-
-
-                stringstream txoAddressKey;
-                txoAddressKey << tx.txHash << setw(8) << setfill('0') << out.index << "-address";
-                nextIndex = getNextTxoIndex(txoAddressKey.str());
-                txoAddressKey << "-" << setw(8) << setfill('0') << nextIndex;
-                batch.Put(txoAddressKey.str(), address);
+
+            VtcBlockIndexer::PrevOutput prevOutput;
+            prevOutput.value = out.value;
+            prevOutput.scriptIds = scriptIds;
+            cachePrevOutput(outpoint, prevOutput);
+        }
+
+        for(const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+            if(txi.coinbase) {
+                plan.coinbase = true;
+                plan.prevOutputs.push_back(VtcBlockIndexer::PrevOutput());
+                plan.spentEntryIndexes.push_back(0);
+            } else {
+                // Store the value and script identifiers of the spent output with the spend, so
+                // rendering the input never needs to look up the previous output
+                plan.prevOutputs.push_back(VtcBlockIndexer::PrevOutput());
+                if(!getPrevOutput(txi.txHash, txi.txoIndex, plan.prevOutputs.back())) {
+                    plan.valueInKnown = false;
+                }
+                plan.valueIn += plan.prevOutputs.back().value;
+                plan.spentEntryIndexes.push_back(getNextTxoIndex(STORE_SPENT, block.blockHash + "-txospent"));
             }
-            stringstream txoValueKey;
-            txoValueKey << tx.txHash << setw(8) << setfill('0') << out.index << "-value";
-            batch.Put(txoValueKey.str(), std::to_string(out.value));
         }
+    }
+
+    Metrics::addElapsed(METRIC_INDEX_RESOLVE_NANOSECONDS, stageStart);
+
+    // Build the keys and values of each transaction in parallel, then add them
+    // to the batches in block order so they match indexing them one by one.
+    vector<StoreRecords> txRecords(block.transactions.size());
+    runInChunks(block.transactions.size(), minTransactionsPerChunk, [&](size_t begin, size_t end) {
+        for(size_t txIndex = begin; txIndex < end; txIndex++) {
+            buildTransactionRecords(block, txIndex, plans[txIndex], outputScriptIds, outputClassifications, firstOutputOfTx[txIndex], txRecords[txIndex]);
+        }
+    });
 
-        for(VtcBlockIndexer::TransactionInput txi : tx.inputs) {
-            if(!txi.coinbase)
-            {
-                stringstream txSpentKey;
-                txSpentKey << "txo-" << txi.txHash << "-" << setw(8) << setfill('0') << txi.txoIndex << "-spent";
-                
-                stringstream spendingTx;
-                spendingTx << block.blockHash << tx.txHash << setw(8) << setfill('0') << txi.index;
-                
-                batch.Put(txSpentKey.str(), spendingTx.str());
-
-                int nextIndex = getNextTxoIndex(block.blockHash + "-txospent");
-                stringstream blockTxoSpentKey;
-                blockTxoSpentKey << block.blockHash << "-txospent-" << setw(8) << setfill('0') << nextIndex;
-                batch.Put(blockTxoSpentKey.str(), txSpentKey.str());
+    // TODO: Verify block integrity
+    leveldb::WriteBatch storeBatches[STORE_COUNT];
+    size_t recordCount = 0;
+    for(size_t txIndex = 0; txIndex < block.transactions.size(); txIndex++) {
+        for(int store = 0; store < STORE_COUNT; store++) {
+            for(const pair<string, string>& record : txRecords[txIndex][store]) {
+                storeBatches[store].Put(record.first, record.second);
             }
+            recordCount += txRecords[txIndex][store].size();
         }
+    }
+    Metrics::addElapsed(METRIC_INDEX_BUILD_NANOSECONDS, stageStart);
+
+    // On a failed write the pending marker stays, so the entries are removed
+    // before the next block is indexed
+    for(DatabaseStore store : {STORE_SPENT, STORE_ADDRESSES, STORE_TXS}) {
+        Metrics::add(METRIC_DB_WRITES);
+        s = this->database->get(store)->Write(leveldb::WriteOptions(), &storeBatches[store]);
+        if(!s.ok()) {
+            VTC_LOG(LOG_LEVEL_ERROR, "Could not write block " << block.blockHash << ": " << s.ToString());
+            pendingBlockLeft = true;
+            return false;
+        }
+    }
+    batch.Delete("pendingblock");
+    Metrics::add(METRIC_DB_WRITES);
+    s = chainDb->Write(leveldb::WriteOptions(), &batch);
+    if(!s.ok()) {
+        VTC_LOG(LOG_LEVEL_ERROR, "Could not write block " << block.blockHash << ": " << s.ToString());
+        pendingBlockLeft = true;
+        return false;
+    }
+
+    Metrics::add(METRIC_DB_WRITTEN_RECORDS, recordCount);
+    Metrics::addElapsed(METRIC_INDEX_WRITE_NANOSECONDS, stageStart);
+    Metrics::add(METRIC_BLOCKS_INDEXED);
+    Metrics::add(METRIC_TRANSACTIONS_INDEXED, block.transactions.size());
+
+    if(isTip) {
+        this->chainState->setTip(block.height, block.blockHash);
+    }
+
+    for(const VtcBlockIndexer::Transaction& tx : block.transactions) {
         this->mempoolMonitor->transactionIndexed(tx.txHash);
     }
 
-    
-    this->db->Write(leveldb::WriteOptions(), &batch);
+    // Push the block, and the transactions if anyone follows addresses or outpoints
+    if(!disconnectedBlockHash.empty()) {
+        this->subscriptions->notifyBlockDisconnected(disconnectedBlockHash, block.height);
+    }
+    this->subscriptions->notifyBlockConnected(block.blockHash, block.height);
+    if(this->subscriptions->hasSubscriptions(TOPIC_ADDRESS) || this->subscriptions->hasSubscriptions(TOPIC_OUTPOINT)) {
+        for(size_t txIndex = 0; txIndex < block.transactions.size(); txIndex++) {
+            const VtcBlockIndexer::Transaction& tx = block.transactions[txIndex];
+            unordered_set<string> scriptIds;
+            vector<string> spends;
+            for(size_t i = 0; i < tx.outputs.size(); i++) {
+                const vector<string>& outputIds = outputScriptIds[firstOutputOfTx[txIndex] + i];
+                scriptIds.insert(outputIds.begin(), outputIds.end());
+            }
+            for(size_t i = 0; i < tx.inputs.size(); i++) {
+                if(tx.inputs[i].coinbase) continue;
+                const vector<string>& spentIds = plans[txIndex].prevOutputs[i].scriptIds;
+                scriptIds.insert(spentIds.begin(), spentIds.end());
+                spends.push_back(tx.inputs[i].txHash + padded(tx.inputs[i].txoIndex, 8));
+            }
+            this->subscriptions->notifyTransaction(tx.txHash, scriptIds, spends, block.height);
+        }
+    }
 
  
 
@@ -24,11 +24,16 @@
 
 #include <iostream>
 #include <fstream>
+#include <deque>
+#include <unordered_map>
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
+#include "database.h"
 #include "blockchaintypes.h"
 #include "scriptsolver.h"
 #include "mempoolmonitor.h"
+#include "subscriptions.h"
+#include "chainstate.h"
 
 using namespace std;
 
@@ -45,7 +50,7 @@ class BlockIndexer {
 public:
     /** Constructs a BlockIndexer instance using the given block data directory
      */
-    BlockIndexer(const shared_ptr<leveldb::DB> db, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor);
+    BlockIndexer(const shared_ptr<VtcBlockIndexer::Database> database, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::ChainState> chainState);
 
     /** Indexes the contents of the block
      */
@@ -58,19 +63,44 @@ public:
     bool hasIndexedBlock(string blockHash, int blockHeight);
 
 private:
-    /** Removes TXOs and spends from a particular blockhash 
-     * in case of a reorg */
+    /** Removes the entries of a block that was being written when the indexer
+     * stopped or a write failed. Returns false when they could not be removed */
+    bool recoverPendingBlock();
 
+    /** Removes TXOs, spends and transaction entries from a particular blockhash 
+     * in case of a reorg */
     bool clearBlockTxos(string blockHash);
-    /** Returns the next index to use for storing the TXO
+    /** Returns the next index to use for storing the TXO. The store is
+     * the one the keys with the prefix live in
+     */
+    int getNextTxoIndex(DatabaseStore store, string prefix);
+
+    /** Remembers the value and script identifiers of an output that is being indexed
+     * so a later spend of it can be resolved from memory
      */
-    int getNextTxoIndex(string prefix);
+    void cachePrevOutput(const string& outpoint, const PrevOutput& prevOutput);
 
-    shared_ptr<leveldb::DB> db;
+    /** Resolves the value and script identifiers of the output being spent. Uses the
+     * in-memory cache and falls back to the database for older outputs. Returns false
+     * (with a value of 0 and no script identifiers) when the output isn't indexed
+     */
+    bool getPrevOutput(const string& txHash, uint32_t txoIndex, PrevOutput& prevOutput);
+
+    shared_ptr<VtcBlockIndexer::Database> database;
     shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor;
+    shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions;
+    shared_ptr<VtcBlockIndexer::ChainState> chainState;
 
     // Reference to the scriptsolver class
     unique_ptr<VtcBlockIndexer::ScriptSolver> scriptSolver;
+
+    // Recently indexed outputs by outpoint (txhash + 8 digit index), and their
+    // insertion order so the oldest ones can be evicted
+    unordered_map<string, VtcBlockIndexer::PrevOutput> prevOutputs;
+    deque<string> prevOutputsOrder;
+
+    // Set when a failed write left a pending block behind that still has to be removed
+    bool pendingBlockLeft;
 };
 
 }
@@ -18,6 +18,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "blockreader.h"
+#include "logger.h"
 #include "filereader.h"
 #include "blockchaintypes.h"
 #include "utility.h"
@@ -48,6 +49,28 @@ std::vector<unsigned char> VtcBlockIndexer::BlockReader::readRawBlockHeader(stri
 }
     
 
+std::vector<unsigned char> VtcBlockIndexer::BlockReader::readRawTransaction(string fileName, uint64_t filePosition) {
+    stringstream ss;
+    ss << blocksDir << "/" << fileName;
+    ifstream blockFile(ss.str(), ios_base::in | ios_base::binary);
+    if(!blockFile.is_open()) {
+        return {};
+    }
+
+    // Parse the transaction once to find out where it ends
+    blockFile.seekg(filePosition, ios_base::beg);
+    VtcBlockIndexer::Transaction transaction = readTransaction(blockFile);
+    if(!blockFile.good() || transaction.byteSize == 0) {
+        return {};
+    }
+
+    vector<unsigned char> rawTransaction(transaction.byteSize);
+    blockFile.seekg(filePosition, ios_base::beg);
+    blockFile.read(reinterpret_cast<char *>(&rawTransaction[0]), transaction.byteSize);
+    blockFile.close();
+    return rawTransaction;
+}
+
 VtcBlockIndexer::Block VtcBlockIndexer::BlockReader::readBlock(string fileName, uint64_t filePosition, uint64_t blockHeight, bool headerOnly) {
     VtcBlockIndexer::Block fullBlock;
 
@@ -60,7 +83,7 @@ VtcBlockIndexer::Block VtcBlockIndexer::BlockReader::readBlock(string fileName,
     ifstream blockFile(ss.str(), ios_base::in | ios_base::binary);
     
     if(!blockFile.is_open()) {
-        cerr << "Block file [" << ss.str() << "] could not be opened" << endl;
+        VTC_LOG(LOG_LEVEL_ERROR, "Block file [" << ss.str() << "] could not be opened");
         exit(0);
     }
 
@@ -181,6 +204,7 @@ VtcBlockIndexer::Transaction VtcBlockIndexer::BlockReader::readTransaction(istre
     transaction.txHash = VtcBlockIndexer::Utility::hashToReverseHex(VtcBlockIndexer::Utility::sha256(VtcBlockIndexer::Utility::sha256(txHashBytes)));
 
     transaction.byteSize = endPosTx-startPosTx;
+    transaction.strippedSize = txHashBytes.size();
         
     if(segwit) {
         blockFile.seekg(startPosTx, ios_base::beg);
@@ -53,6 +53,12 @@ public:
     /** Reads a transaction from an open file stream
      */
     std::vector<unsigned char> readRawBlockHeader(std::string fileName, uint64_t filePosition);        
+
+    /** Reads the serialized bytes of the transaction starting at the given
+     * position inside the block file. Returns an empty vector if the file
+     * cannot be read.
+     */
+    std::vector<unsigned char> readRawTransaction(std::string fileName, uint64_t filePosition);
     
 private:
 
@@ -0,0 +1,160 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "chainstate.h"
+#include "logger.h"
+#include "utility.h"
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+
+// Seconds over which the indexing rate is averaged
+const double rateWindow = 60;
+
+VtcBlockIndexer::ChainState::ChainState(const shared_ptr<VtcBlockIndexer::Database> database) {
+    tipSequence = 0;
+    tipHeight = -1;
+    for(atomic<uint64_t>& word : tipHash) {
+        word = 0;
+    }
+    nodeHeight = -1;
+    nodeReachable = true;
+    blocksPerSecond = 0;
+
+    shared_ptr<leveldb::DB> chainDb = database->get(STORE_CHAIN);
+    string highestBlock;
+    if(chainDb->Get(leveldb::ReadOptions(), "highestblock", &highestBlock).ok()) {
+        string hash;
+        chainDb->Get(leveldb::ReadOptions(), "block-" + highestBlock, &hash);
+        setTip(stoll(highestBlock), hash);
+    }
+}
+
+void VtcBlockIndexer::ChainState::setTip(int64_t height, const string& hash) {
+    vector<unsigned char> hashBytes = Utility::hexToBytes(hash);
+    hashBytes.resize(32);
+    uint64_t words[4];
+    for(int i = 0; i < 4; i++) {
+        words[i] = 0;
+        for(int j = 0; j < 8; j++) {
+            words[i] = (words[i] << 8) | hashBytes[i * 8 + j];
+        }
+    }
+
+    // Only the indexer writes, the odd sequence tells readers a write is in progress
+    uint64_t sequence = tipSequence.load(memory_order_relaxed);
+    tipSequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    tipHeight.store(height, memory_order_relaxed);
+    for(int i = 0; i < 4; i++) {
+        tipHash[i].store(words[i], memory_order_relaxed);
+    }
+    tipSequence.store(sequence + 2, memory_order_release);
+}
+
+bool VtcBlockIndexer::ChainState::tryReadTip(int64_t& height, string& hash) {
+    uint64_t sequence = tipSequence.load(memory_order_acquire);
+    if(sequence & 1) return false;
+
+    height = tipHeight.load(memory_order_relaxed);
+    uint64_t words[4];
+    for(int i = 0; i < 4; i++) {
+        words[i] = tipHash[i].load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    if(tipSequence.load(memory_order_relaxed) != sequence) return false;
+
+    if(height < 0) {
+        hash.clear();
+        return true;
+    }
+    vector<unsigned char> hashBytes(32);
+    for(int i = 0; i < 4; i++) {
+        for(int j = 0; j < 8; j++) {
+            hashBytes[i * 8 + j] = (words[i] >> (56 - j * 8)) & 0xFF;
+        }
+    }
+    hash = Utility::hashToHex(hashBytes);
+    return true;
+}
+
+int64_t VtcBlockIndexer::ChainState::getHeight() {
+    return tipHeight.load(memory_order_acquire);
+}
+
+VtcBlockIndexer::ChainTip VtcBlockIndexer::ChainState::getTip() {
+    ChainTip tip;
+    while(!tryReadTip(tip.height, tip.hash)) {
+        std::this_thread::yield();
+    }
+    tip.nodeHeight = nodeHeight.load();
+    tip.blocksPerSecond = blocksPerSecond.load();
+    tip.etaSeconds = -1;
+    if(tip.nodeHeight >= 0 && tip.height >= tip.nodeHeight) {
+        tip.etaSeconds = 0;
+    } else if(tip.nodeHeight >= 0 && tip.blocksPerSecond > 0) {
+        tip.etaSeconds = (int64_t)((tip.nodeHeight - tip.height) / tip.blocksPerSecond);
+    }
+    return tip;
+}
+
+int64_t VtcBlockIndexer::ChainState::getNodeHeight() {
+    return nodeHeight.load();
+}
+
+bool VtcBlockIndexer::ChainState::isNodeReachable() {
+    return nodeReachable.load();
+}
+
+void VtcBlockIndexer::ChainState::startPoller(const shared_ptr<VtcBlockIndexer::RpcPool> rpc, chrono::seconds interval) {
+    int64_t lastHeight = getHeight();
+    chrono::steady_clock::time_point lastTime = chrono::steady_clock::now();
+    while(true) {
+        try {
+            const Json::Value blockCount = rpc->call("getblockcount", Json::Value()).get();
+            if(!blockCount.isNumeric()) {
+                throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, blockCount.toStyledString());
+            }
+            nodeHeight = blockCount.asInt64();
+            nodeReachable = true;
+        } catch(const jsonrpc::JsonRpcException& e) {
+            if(nodeReachable.exchange(false)) {
+                VTC_LOG(LOG_LEVEL_WARNING, "Could not read the node's height: " << e.what());
+            }
+        }
+
+        std::this_thread::sleep_for(interval);
+
+        // Exponential moving average of the blocks indexed per second
+        int64_t height = getHeight();
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        double seconds = chrono::duration<double>(now - lastTime).count();
+        if(seconds > 0) {
+            double rate = std::max<int64_t>(0, height - lastHeight) / seconds;
+            double weight = 1 - std::exp(-seconds / rateWindow);
+            blocksPerSecond = blocksPerSecond.load() + weight * (rate - blocksPerSecond.load());
+        }
+        lastHeight = height;
+        lastTime = now;
+    }
+}
@@ -0,0 +1,116 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHAINSTATE_H_INCLUDED
+#define CHAINSTATE_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "database.h"
+#include "rpcpool.h"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * A copy of the chain state at one moment
+ */
+struct ChainTip {
+    // Height and hash of the highest indexed block, -1 and empty when the index is empty
+    int64_t height;
+    string hash;
+
+    // Height of the node's best block, -1 until the node has been reached
+    int64_t nodeHeight;
+
+    // Blocks indexed per second, averaged over the last minutes
+    double blocksPerSecond;
+
+    // Estimated seconds until the index reaches the node's height, -1 when unknown
+    int64_t etaSeconds;
+};
+
+/**
+ * The ChainState class keeps the indexed tip and the node's height in memory.
+ * The indexer updates the tip after writing a block and a background poller
+ * asks the node for its height, so requests never have to.
+ *
+ * There is one writer per field group: the indexer for the tip and the poller
+ * for the node height and rate. Readers don't take locks. The tip is published
+ * with a sequence counter and readers retry the rare read that overlapped a write.
+ */
+
+class ChainState {
+public:
+    /** Constructs the state from the tip stored in the database
+     */
+    ChainState(const shared_ptr<VtcBlockIndexer::Database> database);
+
+    /** Called by the indexer once the block is written, when it is at or above
+     * the current tip
+     */
+    void setTip(int64_t height, const string& hash);
+
+    /** Returns the height of the highest indexed block, -1 when the index is empty
+     */
+    int64_t getHeight();
+
+    /** Returns the tip, node height, rate and estimate in one consistent copy
+     * (the tip fields are consistent with each other)
+     */
+    ChainTip getTip();
+
+    /** Returns the node's height, -1 until the node has been reached
+     */
+    int64_t getNodeHeight();
+
+    /** Returns false when the last attempt to read the node's height failed
+     */
+    bool isNodeReachable();
+
+    /** Polls the node for its height through the RPC pool every interval and
+     * updates the indexing rate. Runs until the process exits
+     */
+    void startPoller(const shared_ptr<VtcBlockIndexer::RpcPool> rpc, chrono::seconds interval);
+
+private:
+    /** Reads the tip height and the hash into the arguments. Returns false if a
+     * write overlapped the read
+     */
+    bool tryReadTip(int64_t& height, string& hash);
+
+    // The tip: the sequence is odd while it's being written. The hash is kept as
+    // its 32 raw bytes
+    atomic<uint64_t> tipSequence;
+    atomic<int64_t> tipHeight;
+    atomic<uint64_t> tipHash[4];
+
+    atomic<int64_t> nodeHeight;
+    atomic<bool> nodeReachable;
+    atomic<double> blocksPerSecond;
+};
+
+}
+
+#endif // CHAINSTATE_H_INCLUDED
@@ -0,0 +1,291 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hash160.h"
+
+#include "common.h"
+
+#include <string.h>
+
+namespace
+{
+namespace ripemd160x32
+{
+// One 32-bit word of every lane. The vector extension compiles to SSE2 / NEON
+// instructions, and to plain loops on targets without them.
+typedef uint32_t Lanes __attribute__((vector_size(4 * RIPEMD160_BATCH_LANES)));
+
+Lanes inline Broadcast(uint32_t x)
+{
+    Lanes result;
+    for (size_t lane = 0; lane < RIPEMD160_BATCH_LANES; lane++) {
+        result[lane] = x;
+    }
+    return result;
+}
+
+Lanes inline f1(Lanes x, Lanes y, Lanes z) { return x ^ y ^ z; }
+Lanes inline f2(Lanes x, Lanes y, Lanes z) { return (x & y) | (~x & z); }
+Lanes inline f3(Lanes x, Lanes y, Lanes z) { return (x | ~y) ^ z; }
+Lanes inline f4(Lanes x, Lanes y, Lanes z) { return (x & z) | (y & ~z); }
+Lanes inline f5(Lanes x, Lanes y, Lanes z) { return x ^ (y | ~z); }
+
+Lanes inline rol(Lanes x, int i) { return (x << i) | (x >> (32 - i)); }
+
+void inline Round(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes f, Lanes x, uint32_t k, int r)
+{
+    a = rol(a + f + x + Broadcast(k), r) + e;
+    c = rol(c, 10);
+}
+
+void inline R11(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f1(b, c, d), x, 0, r); }
+void inline R21(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f2(b, c, d), x, 0x5A827999ul, r); }
+void inline R31(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f3(b, c, d), x, 0x6ED9EBA1ul, r); }
+void inline R41(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f4(b, c, d), x, 0x8F1BBCDCul, r); }
+void inline R51(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f5(b, c, d), x, 0xA953FD4Eul, r); }
+
+void inline R12(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f5(b, c, d), x, 0x50A28BE6ul, r); }
+void inline R22(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f4(b, c, d), x, 0x5C4DD124ul, r); }
+void inline R32(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f3(b, c, d), x, 0x6D703EF3ul, r); }
+void inline R42(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f2(b, c, d), x, 0x7A6D76E9ul, r); }
+void inline R52(Lanes& a, Lanes b, Lanes& c, Lanes d, Lanes e, Lanes x, int r) { Round(a, b, c, d, e, f1(b, c, d), x, 0, r); }
+
+/** Reads word i of each lane's message. Lanes past count are left zero. */
+Lanes inline ReadWord(const unsigned char* in, size_t count, int i)
+{
+    uint32_t words[RIPEMD160_BATCH_LANES] = {0};
+    for (size_t lane = 0; lane < count; lane++) {
+        words[lane] = ReadLE32(in + lane * 32 + i * 4);
+    }
+    Lanes result;
+    memcpy(&result, words, sizeof(result));
+    return result;
+}
+
+/** Hashes up to RIPEMD160_BATCH_LANES messages of 32 bytes. */
+void Transform(const unsigned char* in, size_t count, unsigned char* out)
+{
+    Lanes a1 = Broadcast(0x67452301ul), b1 = Broadcast(0xEFCDAB89ul), c1 = Broadcast(0x98BADCFEul), d1 = Broadcast(0x10325476ul), e1 = Broadcast(0xC3D2E1F0ul);
+    Lanes a2 = a1, b2 = b1, c2 = c1, d2 = d1, e2 = e1;
+    const Lanes s0 = a1, s1 = b1, s2 = c1, s3 = d1, s4 = e1;
+
+    Lanes w0 = ReadWord(in, count, 0), w1 = ReadWord(in, count, 1), w2 = ReadWord(in, count, 2), w3 = ReadWord(in, count, 3);
+    Lanes w4 = ReadWord(in, count, 4), w5 = ReadWord(in, count, 5), w6 = ReadWord(in, count, 6), w7 = ReadWord(in, count, 7);
+
+    // Padding: a single 0x80 byte after the message, zeroes, and the message
+    // length in bits (256) in the last eight bytes
+    const Lanes zero = Broadcast(0);
+    Lanes w8 = Broadcast(0x80ul), w9 = zero, w10 = zero, w11 = zero;
+    Lanes w12 = zero, w13 = zero, w14 = Broadcast(256ul), w15 = zero;
+
+    R11(a1, b1, c1, d1, e1, w0, 11);
+    R12(a2, b2, c2, d2, e2, w5, 8);
+    R11(e1, a1, b1, c1, d1, w1, 14);
+    R12(e2, a2, b2, c2, d2, w14, 9);
+    R11(d1, e1, a1, b1, c1, w2, 15);
+    R12(d2, e2, a2, b2, c2, w7, 9);
+    R11(c1, d1, e1, a1, b1, w3, 12);
+    R12(c2, d2, e2, a2, b2, w0, 11);
+    R11(b1, c1, d1, e1, a1, w4, 5);
+    R12(b2, c2, d2, e2, a2, w9, 13);
+    R11(a1, b1, c1, d1, e1, w5, 8);
+    R12(a2, b2, c2, d2, e2, w2, 15);
+    R11(e1, a1, b1, c1, d1, w6, 7);
+    R12(e2, a2, b2, c2, d2, w11, 15);
+    R11(d1, e1, a1, b1, c1, w7, 9);
+    R12(d2, e2, a2, b2, c2, w4, 5);
+    R11(c1, d1, e1, a1, b1, w8, 11);
+    R12(c2, d2, e2, a2, b2, w13, 7);
+    R11(b1, c1, d1, e1, a1, w9, 13);
+    R12(b2, c2, d2, e2, a2, w6, 7);
+    R11(a1, b1, c1, d1, e1, w10, 14);
+    R12(a2, b2, c2, d2, e2, w15, 8);
+    R11(e1, a1, b1, c1, d1, w11, 15);
+    R12(e2, a2, b2, c2, d2, w8, 11);
+    R11(d1, e1, a1, b1, c1, w12, 6);
+    R12(d2, e2, a2, b2, c2, w1, 14);
+    R11(c1, d1, e1, a1, b1, w13, 7);
+    R12(c2, d2, e2, a2, b2, w10, 14);
+    R11(b1, c1, d1, e1, a1, w14, 9);
+    R12(b2, c2, d2, e2, a2, w3, 12);
+    R11(a1, b1, c1, d1, e1, w15, 8);
+    R12(a2, b2, c2, d2, e2, w12, 6);
+
+    R21(e1, a1, b1, c1, d1, w7, 7);
+    R22(e2, a2, b2, c2, d2, w6, 9);
+    R21(d1, e1, a1, b1, c1, w4, 6);
+    R22(d2, e2, a2, b2, c2, w11, 13);
+    R21(c1, d1, e1, a1, b1, w13, 8);
+    R22(c2, d2, e2, a2, b2, w3, 15);
+    R21(b1, c1, d1, e1, a1, w1, 13);
+    R22(b2, c2, d2, e2, a2, w7, 7);
+    R21(a1, b1, c1, d1, e1, w10, 11);
+    R22(a2, b2, c2, d2, e2, w0, 12);
+    R21(e1, a1, b1, c1, d1, w6, 9);
+    R22(e2, a2, b2, c2, d2, w13, 8);
+    R21(d1, e1, a1, b1, c1, w15, 7);
+    R22(d2, e2, a2, b2, c2, w5, 9);
+    R21(c1, d1, e1, a1, b1, w3, 15);
+    R22(c2, d2, e2, a2, b2, w10, 11);
+    R21(b1, c1, d1, e1, a1, w12, 7);
+    R22(b2, c2, d2, e2, a2, w14, 7);
+    R21(a1, b1, c1, d1, e1, w0, 12);
+    R22(a2, b2, c2, d2, e2, w15, 7);
+    R21(e1, a1, b1, c1, d1, w9, 15);
+    R22(e2, a2, b2, c2, d2, w8, 12);
+    R21(d1, e1, a1, b1, c1, w5, 9);
+    R22(d2, e2, a2, b2, c2, w12, 7);
+    R21(c1, d1, e1, a1, b1, w2, 11);
+    R22(c2, d2, e2, a2, b2, w4, 6);
+    R21(b1, c1, d1, e1, a1, w14, 7);
+    R22(b2, c2, d2, e2, a2, w9, 15);
+    R21(a1, b1, c1, d1, e1, w11, 13);
+    R22(a2, b2, c2, d2, e2, w1, 13);
+    R21(e1, a1, b1, c1, d1, w8, 12);
+    R22(e2, a2, b2, c2, d2, w2, 11);
+
+    R31(d1, e1, a1, b1, c1, w3, 11);
+    R32(d2, e2, a2, b2, c2, w15, 9);
+    R31(c1, d1, e1, a1, b1, w10, 13);
+    R32(c2, d2, e2, a2, b2, w5, 7);
+    R31(b1, c1, d1, e1, a1, w14, 6);
+    R32(b2, c2, d2, e2, a2, w1, 15);
+    R31(a1, b1, c1, d1, e1, w4, 7);
+    R32(a2, b2, c2, d2, e2, w3, 11);
+    R31(e1, a1, b1, c1, d1, w9, 14);
+    R32(e2, a2, b2, c2, d2, w7, 8);
+    R31(d1, e1, a1, b1, c1, w15, 9);
+    R32(d2, e2, a2, b2, c2, w14, 6);
+    R31(c1, d1, e1, a1, b1, w8, 13);
+    R32(c2, d2, e2, a2, b2, w6, 6);
+    R31(b1, c1, d1, e1, a1, w1, 15);
+    R32(b2, c2, d2, e2, a2, w9, 14);
+    R31(a1, b1, c1, d1, e1, w2, 14);
+    R32(a2, b2, c2, d2, e2, w11, 12);
+    R31(e1, a1, b1, c1, d1, w7, 8);
+    R32(e2, a2, b2, c2, d2, w8, 13);
+    R31(d1, e1, a1, b1, c1, w0, 13);
+    R32(d2, e2, a2, b2, c2, w12, 5);
+    R31(c1, d1, e1, a1, b1, w6, 6);
+    R32(c2, d2, e2, a2, b2, w2, 14);
+    R31(b1, c1, d1, e1, a1, w13, 5);
+    R32(b2, c2, d2, e2, a2, w10, 13);
+    R31(a1, b1, c1, d1, e1, w11, 12);
+    R32(a2, b2, c2, d2, e2, w0, 13);
+    R31(e1, a1, b1, c1, d1, w5, 7);
+    R32(e2, a2, b2, c2, d2, w4, 7);
+    R31(d1, e1, a1, b1, c1, w12, 5);
+    R32(d2, e2, a2, b2, c2, w13, 5);
+
+    R41(c1, d1, e1, a1, b1, w1, 11);
+    R42(c2, d2, e2, a2, b2, w8, 15);
+    R41(b1, c1, d1, e1, a1, w9, 12);
+    R42(b2, c2, d2, e2, a2, w6, 5);
+    R41(a1, b1, c1, d1, e1, w11, 14);
+    R42(a2, b2, c2, d2, e2, w4, 8);
+    R41(e1, a1, b1, c1, d1, w10, 15);
+    R42(e2, a2, b2, c2, d2, w1, 11);
+    R41(d1, e1, a1, b1, c1, w0, 14);
+    R42(d2, e2, a2, b2, c2, w3, 14);
+    R41(c1, d1, e1, a1, b1, w8, 15);
+    R42(c2, d2, e2, a2, b2, w11, 14);
+    R41(b1, c1, d1, e1, a1, w12, 9);
+    R42(b2, c2, d2, e2, a2, w15, 6);
+    R41(a1, b1, c1, d1, e1, w4, 8);
+    R42(a2, b2, c2, d2, e2, w0, 14);
+    R41(e1, a1, b1, c1, d1, w13, 9);
+    R42(e2, a2, b2, c2, d2, w5, 6);
+    R41(d1, e1, a1, b1, c1, w3, 14);
+    R42(d2, e2, a2, b2, c2, w12, 9);
+    R41(c1, d1, e1, a1, b1, w7, 5);
+    R42(c2, d2, e2, a2, b2, w2, 12);
+    R41(b1, c1, d1, e1, a1, w15, 6);
+    R42(b2, c2, d2, e2, a2, w13, 9);
+    R41(a1, b1, c1, d1, e1, w14, 8);
+    R42(a2, b2, c2, d2, e2, w9, 12);
+    R41(e1, a1, b1, c1, d1, w5, 6);
+    R42(e2, a2, b2, c2, d2, w7, 5);
+    R41(d1, e1, a1, b1, c1, w6, 5);
+    R42(d2, e2, a2, b2, c2, w10, 15);
+    R41(c1, d1, e1, a1, b1, w2, 12);
+    R42(c2, d2, e2, a2, b2, w14, 8);
+
+    R51(b1, c1, d1, e1, a1, w4, 9);
+    R52(b2, c2, d2, e2, a2, w12, 8);
+    R51(a1, b1, c1, d1, e1, w0, 15);
+    R52(a2, b2, c2, d2, e2, w15, 5);
+    R51(e1, a1, b1, c1, d1, w5, 5);
+    R52(e2, a2, b2, c2, d2, w10, 12);
+    R51(d1, e1, a1, b1, c1, w9, 11);
+    R52(d2, e2, a2, b2, c2, w4, 9);
+    R51(c1, d1, e1, a1, b1, w7, 6);
+    R52(c2, d2, e2, a2, b2, w1, 12);
+    R51(b1, c1, d1, e1, a1, w12, 8);
+    R52(b2, c2, d2, e2, a2, w5, 5);
+    R51(a1, b1, c1, d1, e1, w2, 13);
+    R52(a2, b2, c2, d2, e2, w8, 14);
+    R51(e1, a1, b1, c1, d1, w10, 12);
+    R52(e2, a2, b2, c2, d2, w7, 6);
+    R51(d1, e1, a1, b1, c1, w14, 5);
+    R52(d2, e2, a2, b2, c2, w6, 8);
+    R51(c1, d1, e1, a1, b1, w1, 12);
+    R52(c2, d2, e2, a2, b2, w2, 13);
+    R51(b1, c1, d1, e1, a1, w3, 13);
+    R52(b2, c2, d2, e2, a2, w13, 6);
+    R51(a1, b1, c1, d1, e1, w8, 14);
+    R52(a2, b2, c2, d2, e2, w14, 5);
+    R51(e1, a1, b1, c1, d1, w11, 11);
+    R52(e2, a2, b2, c2, d2, w0, 15);
+    R51(d1, e1, a1, b1, c1, w6, 8);
+    R52(d2, e2, a2, b2, c2, w3, 13);
+    R51(c1, d1, e1, a1, b1, w15, 5);
+    R52(c2, d2, e2, a2, b2, w9, 11);
+    R51(b1, c1, d1, e1, a1, w13, 6);
+    R52(b2, c2, d2, e2, a2, w11, 11);
+
+    Lanes h0 = s1 + c1 + d2;
+    Lanes h1 = s2 + d1 + e2;
+    Lanes h2 = s3 + e1 + a2;
+    Lanes h3 = s4 + a1 + b2;
+    Lanes h4 = s0 + b1 + c2;
+
+    for (size_t lane = 0; lane < count; lane++) {
+        WriteLE32(out + lane * 20, h0[lane]);
+        WriteLE32(out + lane * 20 + 4, h1[lane]);
+        WriteLE32(out + lane * 20 + 8, h2[lane]);
+        WriteLE32(out + lane * 20 + 12, h3[lane]);
+        WriteLE32(out + lane * 20 + 16, h4[lane]);
+    }
+}
+
+} // namespace ripemd160x32
+
+} // namespace
+
+void RIPEMD160x32Batch(const unsigned char* in, size_t count, unsigned char* out)
+{
+    while (count > 0) {
+        size_t lanes = count < RIPEMD160_BATCH_LANES ? count : RIPEMD160_BATCH_LANES;
+        ripemd160x32::Transform(in, lanes, out);
+        in += lanes * 32;
+        out += lanes * 20;
+        count -= lanes;
+    }
+}
@@ -0,0 +1,37 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HASH160_H_INCLUDED
+#define HASH160_H_INCLUDED
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Number of messages RIPEMD160x32Batch hashes side by side */
+static const size_t RIPEMD160_BATCH_LANES = 4;
+
+/** Calculates RIPEMD-160 over count messages of exactly 32 bytes (the output
+ * of SHA-256), stored back to back in in. Writes 20 bytes per message to out.
+ * A 32 byte message always fits in a single block with fixed padding, so the
+ * messages are processed RIPEMD160_BATCH_LANES at a time in vector lanes.
+ */
+void RIPEMD160x32Batch(const unsigned char* in, size_t count, unsigned char* out);
+
+#endif // HASH160_H_INCLUDED
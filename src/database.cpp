@@ -0,0 +1,250 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "database.h"
+#include "logger.h"
+#include <iostream>
+#include <thread>
+#include <cassert>
+#include <cstdlib>
+#include <errno.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+    const size_t MB = 1024 * 1024;
+
+    const VtcBlockIndexer::DatabaseProfile profiles[] = {
+        // Large memtables and table files so the bulk writes of the initial sync
+        // cause as little compaction as possible. Reads during sync are mostly
+        // for recent data, so the block caches stay small. The address and spent
+        // stores take the bulk of the writes.
+        {"sync", {
+            {4 * MB, 16 * MB},      // chain
+            {8 * MB, 64 * MB},      // txs
+            {12 * MB, 128 * MB},    // addresses
+            {8 * MB, 64 * MB},      // spent
+        }, 64 * MB, 10},
+        // Large block caches and small table files, so lookups touch few
+        // blocks and compactions stay short. Address history and spent state
+        // are read on every balance query and get most of the cache.
+        {"serve", {
+            {32 * MB, 4 * MB},      // chain
+            {96 * MB, 4 * MB},      // txs
+            {224 * MB, 8 * MB},     // addresses
+            {160 * MB, 8 * MB},     // spent
+        }, 2 * MB, 10},
+    };
+
+    const char* storeNames[] = {"chain", "txs", "addresses", "spent"};
+
+    // Stored under "indexformat" in the chain store. Raise it whenever the
+    // layout of the stores changes in a way older indexes can't be read with.
+    // Format 2 keys the address index by script identifier.
+    const string indexFormat = "2";
+
+    void refuseIndex(const string& reason, const string& indexDir) {
+        VTC_LOG(LOG_LEVEL_ERROR, reason << ". Delete the contents of " << indexDir << " and of the --chainDir, --txsDir, --addressesDir and --spentDir directories if set, and start the indexer again to rebuild the index");
+        exit(1);
+    }
+}
+
+VtcBlockIndexer::Database::Database(string indexDir, string profileName, const vector<string>& storeDirs) {
+    this->autoSwitch = (profileName == "auto");
+    this->readers = 0;
+    this->reopening = false;
+
+    for(int i = 0; i < STORE_COUNT; i++) {
+        if(i < (int)storeDirs.size() && !storeDirs[i].empty()) {
+            this->storeDirs[i] = storeDirs[i];
+        } else {
+            this->storeDirs[i] = indexDir + "/" + storeNames[i];
+        }
+    }
+
+    // Before the index was split into stores it was a single LevelDB instance in
+    // the root of the index directory. Opening the stores next to it would start
+    // a full reindex and leave the old one taking up the disk
+    struct stat oldIndex;
+    if(stat((indexDir + "/CURRENT").c_str(), &oldIndex) == 0) {
+        refuseIndex("Found an index in " + indexDir + " from an older version of the indexer", indexDir);
+    }
+
+    // LevelDB creates the directory of a store, but not its parent
+    if(mkdir(indexDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        VTC_LOG(LOG_LEVEL_ERROR, "Could not create index directory " << indexDir);
+    }
+
+    open(getProfile(autoSwitch ? "sync" : profileName));
+    checkFormat(indexDir);
+
+    // An auto profile database that reached the tip before starts with the serve profile
+    string reachedTip;
+    if(autoSwitch && dbs[STORE_CHAIN]->Get(leveldb::ReadOptions(), "reachedtip", &reachedTip).ok()) {
+        autoSwitch = false;
+        close();
+        open(getProfile("serve"));
+    }
+}
+
+void VtcBlockIndexer::Database::checkFormat(string indexDir) {
+    string format;
+    leveldb::Status s = dbs[STORE_CHAIN]->Get(leveldb::ReadOptions(), "indexformat", &format);
+    if(s.ok()) {
+        if(format != indexFormat) {
+            refuseIndex("The index in " + indexDir + " has format " + format + ", this version of the indexer needs format " + indexFormat, indexDir);
+        }
+        return;
+    }
+
+    // Stores without a format that already hold blocks were written before the
+    // address index was keyed by script identifier
+    string highestBlock;
+    if(dbs[STORE_CHAIN]->Get(leveldb::ReadOptions(), "highestblock", &highestBlock).ok()) {
+        refuseIndex("The index in " + indexDir + " was built by an older version of the indexer", indexDir);
+    }
+
+    s = dbs[STORE_CHAIN]->Put(leveldb::WriteOptions(), "indexformat", indexFormat);
+    if(!s.ok()) {
+        VTC_LOG(LOG_LEVEL_WARNING, "Could not record the index format: " << s.ToString());
+    }
+}
+
+shared_ptr<leveldb::DB> VtcBlockIndexer::Database::get(DatabaseStore store) {
+    return dbs[store];
+}
+
+void VtcBlockIndexer::Database::beginRead() {
+    unique_lock<mutex> lock(readersMutex);
+    readersChanged.wait(lock, [this]() { return !reopening; });
+    readers++;
+}
+
+void VtcBlockIndexer::Database::endRead() {
+    {
+        lock_guard<mutex> lock(readersMutex);
+        readers--;
+    }
+    readersChanged.notify_all();
+}
+
+string VtcBlockIndexer::Database::getProfileName() {
+    return profile.name;
+}
+
+string VtcBlockIndexer::Database::getStoreName(DatabaseStore store) {
+    return storeNames[store];
+}
+
+bool VtcBlockIndexer::Database::isValidProfileName(string profileName) {
+    if(profileName == "auto") return true;
+    for(const DatabaseProfile& profile : profiles) {
+        if(profile.name == profileName) return true;
+    }
+    return false;
+}
+
+const VtcBlockIndexer::DatabaseProfile& VtcBlockIndexer::Database::getProfile(string profileName) {
+    for(const DatabaseProfile& profile : profiles) {
+        if(profile.name == profileName) return profile;
+    }
+    assert(false);
+    return profiles[0];
+}
+
+void VtcBlockIndexer::Database::reachedTip() {
+    if(!autoSwitch) return;
+    autoSwitch = false;
+
+    leveldb::Status s = dbs[STORE_CHAIN]->Put(leveldb::WriteOptions(), "reachedtip", "1");
+    if(!s.ok()) {
+        VTC_LOG(LOG_LEVEL_WARNING, "Could not record that the index reached the tip: " << s.ToString());
+    }
+
+    // LevelDB locks a store while it is open, so the sync instances have to be gone
+    // before the serve ones can be opened. ReadContexts are bounded by the request
+    // timeout, new ones wait until the stores are open again. The indexer is the
+    // only other user, and it is the caller.
+    VTC_LOG(LOG_LEVEL_INFO, "Index reached the tip, switching the database to the serve profile");
+    {
+        unique_lock<mutex> lock(readersMutex);
+        reopening = true;
+        readersChanged.wait(lock, [this]() { return readers == 0; });
+    }
+    close();
+    open(getProfile("serve"));
+    {
+        lock_guard<mutex> lock(readersMutex);
+        reopening = false;
+    }
+    readersChanged.notify_all();
+
+    // The sync profile left the stores in a few large files. Compact them in the
+    // background so lookups have fewer levels to check. The thread's references
+    // keep the databases, and with them their caches, alive until it is done.
+    vector<shared_ptr<leveldb::DB>> compactDbs(dbs, dbs + STORE_COUNT);
+    std::thread([compactDbs]() {
+        VTC_LOG(LOG_LEVEL_INFO, "Compacting database...");
+        for(const shared_ptr<leveldb::DB>& compactDb : compactDbs) {
+            compactDb->CompactRange(NULL, NULL);
+        }
+        VTC_LOG(LOG_LEVEL_INFO, "Database compaction done");
+    }).detach();
+}
+
+void VtcBlockIndexer::Database::close() {
+    for(int i = 0; i < STORE_COUNT; i++) {
+        dbs[i].reset();
+    }
+}
+
+void VtcBlockIndexer::Database::open(const DatabaseProfile& newProfile) {
+    profile = newProfile;
+    shared_ptr<const leveldb::FilterPolicy> filterPolicy(leveldb::NewBloomFilterPolicy(profile.bloomFilterBits));
+
+    for(int i = 0; i < STORE_COUNT; i++) {
+        shared_ptr<leveldb::Cache> blockCache(leveldb::NewLRUCache(profile.stores[i].blockCacheSize));
+
+        leveldb::Options options;
+        options.create_if_missing = true;
+        options.block_cache = blockCache.get();
+        options.filter_policy = filterPolicy.get();
+        options.write_buffer_size = profile.stores[i].writeBufferSize;
+        options.max_file_size = profile.maxFileSize;
+
+        leveldb::DB* rawDb;
+        leveldb::Status status = leveldb::DB::Open(options, storeDirs[i], &rawDb);
+        if(!status.ok()) {
+            VTC_LOG(LOG_LEVEL_ERROR, "Could not open the " << storeNames[i] << " store in " << storeDirs[i] << ": " << status.ToString());
+            // The assert below aborts without running the atexit handlers, so
+            // write the message out first
+            Logger::stop();
+        }
+        assert(status.ok());
+
+        // The deleter holds the cache and the filter policy, so they are deleted
+        // after the database by whoever releases it last
+        dbs[i].reset(rawDb, [blockCache, filterPolicy](leveldb::DB* db) {
+            delete db;
+        });
+    }
+    VTC_LOG(LOG_LEVEL_INFO, "Opened database with the " << profile.name << " profile");
+}
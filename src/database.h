@@ -0,0 +1,167 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DATABASE_H_INCLUDED
+#define DATABASE_H_INCLUDED
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "leveldb/db.h"
+#include "leveldb/cache.h"
+#include "leveldb/filter_policy.h"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * The index is split over several LevelDB instances so keyspaces with very
+ * different access patterns don't compete for the same cache and compactions:
+ *
+ * chain:     block-*, highestblock, pendingblock, reachedtip and indexformat
+ * txs:       tx-*, multisigtx-* and the per-block tx listings (block-<hash>-tx-*)
+ * addresses: <scriptId>-txo-*, <txid><vout>-address-*, <txid><vout>-value
+ *            and the per-block txo listings (<blockhash>-txo-*)
+ * spent:     txo-<txid>-<vout>-spent and the per-block spend listings
+ *            (<blockhash>-txospent-*)
+ */
+enum DatabaseStore {
+    STORE_CHAIN = 0,
+    STORE_TXS,
+    STORE_ADDRESSES,
+    STORE_SPENT,
+    STORE_COUNT
+};
+
+/**
+ * Storage settings of a single store within a profile
+ */
+struct DatabaseStoreOptions {
+    // Size of the LRU cache for uncompressed blocks
+    size_t blockCacheSize;
+
+    // Size of the memtable before it is written to a level-0 file. Larger
+    // memtables mean fewer, larger level-0 files and less compaction work
+    size_t writeBufferSize;
+};
+
+/**
+ * Storage settings for one phase of the indexer's life. The sync profile
+ * favours bulk writes during the initial sync, the serve profile favours
+ * read latency once the index has caught up.
+ */
+struct DatabaseProfile {
+    string name;
+
+    // Cache and memtable budget per store (indexed by DatabaseStore)
+    DatabaseStoreOptions stores[STORE_COUNT];
+
+    // Size at which LevelDB starts a new table file
+    size_t maxFileSize;
+
+    // Bits per key of the bloom filter
+    int bloomFilterBits;
+};
+
+/**
+ * The Database class owns the LevelDB instances of the stores. It opens them with a
+ * storage profile when it is constructed. An auto profile database reopens them with
+ * the serve profile once the index reaches the tip, after the ReadContexts using the
+ * sync instances have gone.
+ */
+
+class Database {
+public:
+    /** Opens the stores. Each store lives in <indexDir>/<store name>, unless storeDirs
+     * (indexed by DatabaseStore) holds a non-empty directory for it. profileName is "sync",
+     * "serve" or "auto". Auto uses the sync profile until the index has caught up with the
+     * tip once, and the serve profile from then on (also after a restart). Exits when the index
+     * directory holds an index from an older version, which has to be rebuilt.
+     */
+    Database(string indexDir, string profileName, const vector<string>& storeDirs);
+
+    /** Returns the database of the given store. Only the indexer thread may call this
+     * directly, other threads go through a ReadContext
+     */
+    shared_ptr<leveldb::DB> get(DatabaseStore store);
+
+    /** Called by a ReadContext before it uses the stores. Waits while they are being
+     * reopened
+     */
+    void beginRead();
+
+    /** Called by a ReadContext when it no longer holds any of the stores */
+    void endRead();
+
+    /** Called by the indexer when it has processed all available blocks. In auto
+     * mode this (once) records that the serve profile is to be used from now on,
+     * waits for the running ReadContexts to finish while holding off new ones,
+     * reopens the stores with the serve profile and compacts them in the background.
+     */
+    void reachedTip();
+
+    /** Returns the name of the profile the database is currently opened with */
+    string getProfileName();
+
+    /** Returns true if the profile name is known (or "auto") */
+    static bool isValidProfileName(string profileName);
+
+    /** Returns the name of the store, which is also its default directory name */
+    static string getStoreName(DatabaseStore store);
+
+private:
+    /** Opens the stores with the given profile. Expects no store to be open */
+    void open(const DatabaseProfile& profile);
+
+    /** Closes the stores */
+    void close();
+
+    /** Records the index format in new stores, and exits if the stores hold an
+     * index in another format
+     */
+    void checkFormat(string indexDir);
+
+    static const DatabaseProfile& getProfile(string profileName);
+
+    // Set while an auto profile database hasn't reached the tip yet. Only the
+    // indexer thread uses it
+    bool autoSwitch;
+    DatabaseProfile profile;
+
+    string storeDirs[STORE_COUNT];
+
+    // Only replaced while no ReadContext is running. Each database keeps its block
+    // cache and the filter policy alive until it is deleted, LevelDB doesn't own them
+    shared_ptr<leveldb::DB> dbs[STORE_COUNT];
+
+    // Running ReadContexts, and whether new ones have to wait for the stores to be
+    // reopened. Guarded by readersMutex
+    mutex readersMutex;
+    condition_variable readersChanged;
+    int readers;
+    bool reopening;
+};
+
+}
+
+#endif // DATABASE_H_INCLUDED
@@ -18,6 +18,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "httpserver.h"
+#include "logger.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
@@ -26,22 +27,138 @@
 #include <vector>
 #include <memory>
 #include <cstdlib>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <limits>
 #include <restbed>
 #include "json.hpp"
 #include "utility.h"
+#include "byte_array_buffer.h"
+#include "parallel.h"
+#include "jsonwriter.h"
+#include <openssl/sha.h>
+#include <openssl/evp.h>
 using namespace std;
 using namespace restbed;
 using json = nlohmann::json;
 
+// Batch requests are only split over threads when each thread gets at least this many addresses
+const size_t minAddressesPerChunk = 8;
 
-VtcBlockIndexer::HttpServer::HttpServer(shared_ptr<leveldb::DB> db, shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, string blocksDir) {
-    this->db = db;
+
+VtcBlockIndexer::HttpServer::HttpServer(shared_ptr<VtcBlockIndexer::Database> database, shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, shared_ptr<VtcBlockIndexer::ChainState> chainState, shared_ptr<VtcBlockIndexer::RpcPool> rpc, string blocksDir, const HttpServerOptions& options) {
+    this->database = database;
+    this->subscriptions = subscriptions;
+    this->chainState = chainState;
+    this->rpc = rpc;
     this->blocksDir = blocksDir;
+    this->options = options;
+    responseCache.reset(new VtcBlockIndexer::ResponseCache(options.responseCacheSize));
+    merkleTreeCache.reset(new VtcBlockIndexer::MerkleTreeCache(options.merkleCacheSize));
+    if(this->options.workers == 0) {
+        this->options.workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if(this->options.expensiveConcurrency == 0) {
+        this->options.expensiveConcurrency = std::max(1u, this->options.workers / 4);
+    }
     this->mempoolMonitor = mempoolMonitor;
     blockReader.reset(new VtcBlockIndexer::BlockReader(blocksDir));
     scriptSolver = std::make_unique<VtcBlockIndexer::ScriptSolver>();
-    httpClient.reset(new jsonrpc::HttpClient("http://" + std::string(std::getenv("COIND_RPCUSER")) + ":" + std::string(std::getenv("COIND_RPCPASSWORD")) + "@" + std::string(std::getenv("COIND_HOST")) + ":" + std::string(std::getenv("COIND_RPCPORT"))));
-    vertcoind.reset(new VertcoinClient(*httpClient));
+}
+
+bool VtcBlockIndexer::HttpServer::keepAlive(const shared_ptr<Session> session) {
+    const auto request = session->get_request();
+    string connection = request->get_header("Connection", "");
+    std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+
+    // HTTP/1.1 connections are persistent unless the client says otherwise,
+    // HTTP/1.0 clients have to ask for it
+    bool clientKeepsAlive = (request->get_version() >= 1.1 ? connection != "close" : connection == "keep-alive");
+    
+    lock_guard<mutex> lock(persistentSessionsMutex);
+    if(!clientKeepsAlive) {
+        persistentSessions.erase(session.get());
+        return false;
+    }
+    auto persistentSession = persistentSessions.find(session.get());
+    if(persistentSession != persistentSessions.end()) {
+        // Refresh it, the address may have been reused by a new session
+        persistentSession->second = session;
+        return true;
+    }
+
+    if(persistentSessions.size() >= options.maxConnections) {
+        // Forget connections that were closed by the client or the idle timeout
+        for(auto it = persistentSessions.begin(); it != persistentSessions.end();) {
+            shared_ptr<Session> persistentSession = it->second.lock();
+            if(!persistentSession || persistentSession->is_closed()) {
+                it = persistentSessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if(persistentSessions.size() >= options.maxConnections) {
+            return false;
+        }
+    }
+    persistentSessions[session.get()] = session;
+    return true;
+}
+
+void VtcBlockIndexer::HttpServer::respond(const shared_ptr<Session> session, const int status, const string& body, const string& contentType, const multimap<string, string>& extraHeaders) {
+    multimap<string, string> headers = extraHeaders;
+    headers.insert({ "Content-Type", contentType });
+    headers.insert({ "Content-Length", std::to_string(body.size()) });
+
+    if(keepAlive(session)) {
+        // Yielding without a callback hands the connection back to the service,
+        // which reads and routes the next (possibly already pipelined) request
+        headers.insert({ "Connection", "keep-alive" });
+        session->yield(status, body, headers);
+    } else {
+        headers.insert({ "Connection", "close" });
+        session->close(status, body, headers);
+    }
+}
+
+void VtcBlockIndexer::HttpServer::respondJson(const shared_ptr<Session> session, const int status, const json& body, const multimap<string, string>& extraHeaders) {
+    const auto request = session->get_request();
+    VtcBlockIndexer::ResponseEncoding encoding = ResponseEncoder::fromAcceptHeader(request->get_header("Accept", ""));
+    bool rawHashes = (request->get_query_parameter("rawHashes", "0") == "1");
+
+    multimap<string, string> headers = extraHeaders;
+    headers.insert({ "Vary", "Accept" });
+    respond(session, status, ResponseEncoder::encode(body, encoding, rawHashes), ResponseEncoder::contentType(encoding), headers);
+}
+
+VtcBlockIndexer::JsonWriter VtcBlockIndexer::HttpServer::createWriter(const shared_ptr<Session> session, string& body, json& tree) {
+    const auto request = session->get_request();
+    if(ResponseEncoder::fromAcceptHeader(request->get_header("Accept", "")) != ENCODING_JSON) {
+        return JsonWriter(tree);
+    }
+    return JsonWriter(body);
+}
+
+void VtcBlockIndexer::HttpServer::respondWritten(const shared_ptr<Session> session, const int status, VtcBlockIndexer::JsonWriter& writer, const multimap<string, string>& extraHeaders) {
+    if(writer.getTree() != NULL) {
+        respondJson(session, status, *writer.getTree(), extraHeaders);
+        return;
+    }
+    respondWritten(session, status, *writer.getText(), extraHeaders);
+}
+
+void VtcBlockIndexer::HttpServer::respondWritten(const shared_ptr<Session> session, const int status, const string& body, const multimap<string, string>& extraHeaders) {
+    const auto request = session->get_request();
+    if(ResponseEncoder::fromAcceptHeader(request->get_header("Accept", "")) != ENCODING_JSON) {
+        respondJson(session, status, json::parse(body), extraHeaders);
+        return;
+    }
+    multimap<string, string> headers = extraHeaders;
+    headers.insert({ "Vary", "Accept" });
+    respond(session, status, body, "application/json", headers);
 }
 
 void VtcBlockIndexer::HttpServer::mempoolTransactionIds(const shared_ptr<Session> session) {
@@ -52,46 +169,186 @@ void VtcBlockIndexer::HttpServer::mempoolTransactionIds(const shared_ptr<Session
     for (string txid : txIds) {
         j.push_back(txid);
     }
-    string body = j.dump();
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respondJson(session, OK, j);
+}
+
+
+bool VtcBlockIndexer::HttpServer::readIndexedTransaction(VtcBlockIndexer::ReadContext& reads, const string& txid, VtcBlockIndexer::Transaction& tx, vector<unsigned char>& rawTx) {
+    // The position is stored as <filename(12)><position(12)>
+    string filePosition;
+    leveldb::Status s = reads.get(STORE_TXS, "tx-filePosition-" + txid, &filePosition);
+    if(!s.ok() || filePosition.size() < 24) {
+        return false;
+    }
+
+    rawTx = this->blockReader->readRawTransaction(filePosition.substr(0,12), stoll(filePosition.substr(12,12)));
+    if(rawTx.size() == 0) {
+        return false;
+    }
+
+    byte_array_buffer streambuf(&rawTx[0], rawTx.size());
+    std::istream stream(&streambuf);
+    tx = this->blockReader->readTransaction(stream);
+    return tx.txHash == txid;
+}
+
+void VtcBlockIndexer::HttpServer::getRawTransactionHexes(VtcBlockIndexer::ReadContext& reads, const vector<string>& txids, vector<string>& hexes, vector<string>& errors) {
+    hexes.assign(txids.size(), "");
+    errors.assign(txids.size(), "");
+
+    vector<size_t> missing;
+    vector<string> missingTxids;
+    for(size_t i = 0; i < txids.size(); i++) {
+        VtcBlockIndexer::Transaction tx;
+        vector<unsigned char> rawTx;
+        if(readIndexedTransaction(reads, txids[i], tx, rawTx)) {
+            hexes[i] = Utility::hashToHex(rawTx);
+        } else {
+            missing.push_back(i);
+            missingTxids.push_back(txids[i]);
+        }
+    }
+    if(missing.empty()) return;
+
+    vector<future<Json::Value>> results = rpc->getRawTransactions(missingTxids);
+    for(size_t i = 0; i < missing.size(); i++) {
+        try {
+            const Json::Value rawTxHex = results[i].get();
+            if(!rawTxHex.isString()) {
+                throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, rawTxHex.toStyledString());
+            }
+            hexes[missing[i]] = rawTxHex.asString();
+        } catch(const jsonrpc::JsonRpcException& e) {
+            errors[missing[i]] = e.what();
+        }
+    }
 }
 
+json VtcBlockIndexer::HttpServer::transactionToJson(VtcBlockIndexer::ReadContext& reads, const VtcBlockIndexer::Transaction& tx, const vector<unsigned char>& rawTx) {
+    json jtx;
+    jtx["txid"] = tx.txHash;
+    jtx["hash"] = tx.txWitHash;
+    jtx["version"] = tx.version;
+    jtx["size"] = tx.byteSize;
+    uint64_t weight = tx.strippedSize * 3 + tx.byteSize;
+    jtx["vsize"] = (weight + 3) / 4;
+    jtx["weight"] = weight;
+    jtx["locktime"] = tx.lockTime;
+
+    json vins = json::array();
+    for (const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+        json vin;
+        if(txi.coinbase) {
+            vin["coinbase"] = Utility::hashToHex(txi.script);
+        } else {
+            vin["txid"] = txi.txHash;
+            vin["vout"] = txi.txoIndex;
+            json scriptSig;
+            scriptSig["asm"] = scriptSolver->getScriptAsm(txi.script, true);
+            scriptSig["hex"] = Utility::hashToHex(txi.script);
+            vin["scriptSig"] = scriptSig;
+        }
+        if(txi.witnessData.size() > 0) {
+            json witness = json::array();
+            for (const vector<unsigned char>& witnessItem : txi.witnessData) {
+                witness.push_back(Utility::hashToHex(witnessItem));
+            }
+            vin["txinwitness"] = witness;
+        }
+        vin["sequence"] = txi.sequence;
+        vins.push_back(vin);
+    }
+    jtx["vin"] = vins;
+
+    json vouts = json::array();
+    for (const VtcBlockIndexer::TransactionOutput& txo : tx.outputs) {
+        json vout;
+        vout["value"] = (double)txo.value / 100000000.0;
+        vout["n"] = txo.index;
+        json scriptPubKey;
+        scriptPubKey["asm"] = scriptSolver->getScriptAsm(txo.script, false);
+        scriptPubKey["hex"] = Utility::hashToHex(txo.script);
+        VtcBlockIndexer::ScriptClassification classification = scriptSolver->classifyScript(txo.script);
+        vector<string> addresses = scriptSolver->getAddressesFromScript(txo.script, classification);
+        if(addresses.size() > 0) {
+            scriptPubKey["reqSigs"] = (classification.type == SCRIPT_TYPE_MULTISIG ? classification.requiredSignatures - 0x50 : 1);
+            scriptPubKey["addresses"] = addresses;
+        }
+        scriptPubKey["type"] = scriptSolver->getNodeScriptTypeName(classification);
+        vout["scriptPubKey"] = scriptPubKey;
+        vouts.push_back(vout);
+    }
+    jtx["vout"] = vouts;
+    jtx["hex"] = Utility::hashToHex(rawTx);
+
+    string blockHash;
+    leveldb::Status s = reads.get(STORE_TXS, "tx-" + tx.txHash + "-block", &blockHash);
+    if(s.ok()) {
+        string blockHeightString;
+        s = reads.get(STORE_CHAIN, "block-hash-" + blockHash, &blockHeightString);
+        if(s.ok()) {
+            jtx["blockhash"] = blockHash;
+            jtx["confirmations"] = reads.getTipHeight() - stoll(blockHeightString) + 1;
+            string blockTimeString;
+            s = reads.get(STORE_CHAIN, "block-time-" + blockHeightString, &blockTimeString);
+            if(s.ok()) {
+                jtx["time"] = stoll(blockTimeString);
+                jtx["blocktime"] = stoll(blockTimeString);
+            }
+        }
+    }
+    return jtx;
+}
 
 void VtcBlockIndexer::HttpServer::getTransaction(const shared_ptr<Session> session) {
+    VtcBlockIndexer::ReadContext reads(this->database);
     const auto request = session->get_request();
     
-    cout << "Looking up txid " << request->get_path_parameter("id") << endl;
+    VTC_LOG(LOG_LEVEL_DEBUG, "Looking up txid " << request->get_path_parameter("id"));
+
+    VtcBlockIndexer::Transaction indexedTx;
+    vector<unsigned char> rawTx;
+    if(readIndexedTransaction(reads, request->get_path_parameter("id"), indexedTx, rawTx)) {
+        respondJson(session, OK, transactionToJson(reads, indexedTx, rawTx));
+        return;
+    }
     
     try {
-        const Json::Value tx = vertcoind->getrawtransaction(request->get_path_parameter("id"), true);
-        
-        stringstream body;
-        body << tx.toStyledString();
+        // Not in the index (yet), ask the node - it could be in the mempool
+        Json::Value params;
+        params.append(request->get_path_parameter("id"));
+        params.append(true);
+        const Json::Value tx = rpc->call("getrawtransaction", params).get();
+        if(!tx.isObject()) {
+            throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, tx.toStyledString());
+        }
         
-        session->close(OK, body.str(), {{"Content-Type","application/json"},{"Content-Length",  std::to_string(body.str().size())}});
+        respondJson(session, OK, json::parse(tx.toStyledString()));
     } catch(const jsonrpc::JsonRpcException& e) {
         const std::string message(e.what());
-        cout << "Not found " << message << endl;
-        session->close(404, message, {{"Content-Type","application/json"},{"Content-Length",  std::to_string(message.size())}});
+        VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << message);
+        respond(session, 404, message, "application/json");
     }
 }
 
 void VtcBlockIndexer::HttpServer::getBlock(const shared_ptr<Session> session) {
+    VtcBlockIndexer::ReadContext reads(this->database);
     const auto request = session->get_request();
     
-    string highestBlockString;
-    this->db->Get(leveldb::ReadOptions(),"highestblock",&highestBlockString);
-
-    uint64_t highestBlock = stoll(highestBlockString);
-
     std::string blockHashString = request->get_path_parameter("hash","");
 
+    shared_ptr<const CachedResponse> cached = getCachedResponse(reads, "block-" + blockHashString);
+    if(cached) {
+        respondCached(session, reads, *cached);
+        return;
+    }
+
     string blockHeightString;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(),"block-hash-" + blockHashString,&blockHeightString);
+    leveldb::Status s = reads.get(STORE_CHAIN, "block-hash-" + blockHashString,&blockHeightString);
     if(!s.ok()) // no key found
     { 
         const std::string message("Block not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message);
         return;
     }
 
@@ -104,11 +361,11 @@ void VtcBlockIndexer::HttpServer::getBlock(const shared_ptr<Session> session) {
 
 
     std::string filePosition;
-    s = this->db->Get(leveldb::ReadOptions(), blockKey.str(), &filePosition);
+    s = reads.get(STORE_CHAIN, blockKey.str(), &filePosition);
     if(!s.ok()) // no key found
     {
         const std::string message("Block not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message);
         return;
     }
     
@@ -123,7 +380,6 @@ void VtcBlockIndexer::HttpServer::getBlock(const shared_ptr<Session> session) {
     jsonBlock["bits"] = block.bits;
     jsonBlock["nonce"] = block.nonce;
     jsonBlock["height"] = block.height;
-    jsonBlock["confirmations"] = highestBlock-block.height+1;
     jsonBlock["size"] = block.byteSize;
 
     json txs = json::array();
@@ -136,9 +392,16 @@ void VtcBlockIndexer::HttpServer::getBlock(const shared_ptr<Session> session) {
     jsonBlock["tx"] = txs;
     jsonBlock["ismainchain"] = true;
 
-    string body = jsonBlock.dump();
-    
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    // The confirmations go in front of the other fields
+    shared_ptr<CachedResponse> response = make_shared<CachedResponse>();
+    response->body = jsonBlock.dump();
+    response->slots.push_back({ 1, "", 0 });
+    response->blockHash = block.blockHash;
+    response->blockHeight = block.height;
+    cacheResponse(reads, "block-" + blockHashString, response);
+
+    jsonBlock["confirmations"] = reads.getTipHeight()-(int64_t)block.height+1;
+    respondJson(session, OK, jsonBlock);
 }
 /*
 package models
@@ -200,52 +463,111 @@ type TxsResponse struct {
 	Txs					[]Transaction			`json:"txs"`
 }*/
 
-vector<string> VtcBlockIndexer::HttpServer::getAddressesForTxo(string txHash, uint64_t idx) {
-    vector<string> returnValue = {};
-    stringstream txoAddressKey;
-    txoAddressKey << txHash << setw(8) << setfill('0') << idx << "-address-";
-    string start(txoAddressKey.str() + "00000000");
-    string limit(txoAddressKey.str() + "99999999");
-    
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
-            it->Next()) {
-        returnValue.push_back(it->value().ToString());
+VtcBlockIndexer::PrevOutput VtcBlockIndexer::HttpServer::getPrevOutputForInput(VtcBlockIndexer::ReadContext& reads, const VtcBlockIndexer::TransactionInput& txi) {
+    VtcBlockIndexer::PrevOutput prevOutput;
+    prevOutput.value = 0;
+    prevOutput.scriptIds = {};
+    if(txi.coinbase) {
+        return prevOutput;
     }
 
-    return returnValue;
+    // The spend record is <blockhash(64)><txhash(64)><vin(8)><value(20)><script ids>
+    stringstream txoKey;
+    txoKey << "txo-" << txi.txHash << "-" << setw(8) << setfill('0') << txi.txoIndex << "-spent";
+    string spentTx;
+    leveldb::Status s = reads.get(STORE_SPENT, txoKey.str(), &spentTx);
+    if(s.ok() && spentTx.size() >= 156) {
+        prevOutput.value = stoull(spentTx.substr(136, 20));
+        prevOutput.scriptIds = Utility::splitScriptIds(spentTx.substr(156));
+    }
+    return prevOutput;
 }
 
-uint64_t VtcBlockIndexer::HttpServer::getValueForTxo(string txHash, uint64_t idx) {
-    stringstream txoValueKey;
-    txoValueKey << txHash << setw(8) << setfill('0') << idx << "-value";
-    string valueString;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txoValueKey.str(), &valueString);
-    if(!s.ok()) // no key found
-    { 
-        return 0;
+shared_ptr<const VtcBlockIndexer::CachedResponse> VtcBlockIndexer::HttpServer::getCachedResponse(VtcBlockIndexer::ReadContext& reads, const string& key) {
+    shared_ptr<const CachedResponse> cached = responseCache->get(key);
+    if(!cached) {
+        return NULL;
+    }
+
+    // After a reorg a different block sits at the height, the entry is stale
+    stringstream blockKey;
+    blockKey << "block-" << setw(8) << setfill('0') << cached->blockHeight;
+    string blockHash;
+    leveldb::Status s = reads.get(STORE_CHAIN, blockKey.str(), &blockHash);
+    if(!s.ok() || blockHash != cached->blockHash) {
+        responseCache->erase(key);
+        return NULL;
     }
-    return stoll(valueString);
+    return cached;
+}
+
+void VtcBlockIndexer::HttpServer::cacheResponse(VtcBlockIndexer::ReadContext& reads, const string& key, const shared_ptr<const VtcBlockIndexer::CachedResponse> response) {
+    // Blocks close to the tip can still be reorged out
+    if(reads.getTipHeight() - (int64_t)response->blockHeight + 1 < (int64_t)options.cacheConfirmations) {
+        return;
+    }
+
+    size_t size = sizeof(CachedResponse) + response->body.size() + response->blockHash.size() + response->slots.size() * sizeof(TipFieldSlot);
+    for(const TipFieldSlot& slot : response->slots) {
+        size += slot.txHash.size();
+    }
+    responseCache->put(key, response, size);
+}
+
+void VtcBlockIndexer::HttpServer::respondCached(const shared_ptr<Session> session, VtcBlockIndexer::ReadContext& reads, const VtcBlockIndexer::CachedResponse& response) {
+    int64_t confirmations = reads.getTipHeight() - (int64_t)response.blockHeight + 1;
+    string& body = JsonWriter::threadBuffer();
+    body.reserve(response.body.size() + response.slots.size() * 32);
+
+    size_t position = 0;
+    for(const TipFieldSlot& slot : response.slots) {
+        body.append(response.body, position, slot.offset - position);
+        position = slot.offset;
+        if(slot.txHash.empty()) {
+            body.append("\"confirmations\":" + std::to_string(confirmations) + ",");
+            continue;
+        }
+
+        string spentTx;
+        stringstream txoKey;
+        txoKey << "txo-" << slot.txHash << "-" << setw(8) << setfill('0') << slot.vout << "-spent";
+        leveldb::Status s = reads.get(STORE_SPENT, txoKey.str(), &spentTx);
+        if(!s.ok()) continue;
+
+        body.append("\"spentTxId\":\"" + spentTx.substr(64, 64) + "\",");
+        body.append("\"spentIndex\":" + std::to_string(stoll(spentTx.substr(128, 8))) + ",");
+        body.append("\"spentBlock\":\"" + spentTx.substr(0, 64) + "\",");
+        std::string blockHeightString;
+        s = reads.get(STORE_CHAIN, "block-hash-" + spentTx.substr(0, 64), &blockHeightString);
+        if(s.ok()) {
+            body.append("\"spentHeight\":" + std::to_string(stoll(blockHeightString)) + ",");
+        }
+    }
+    body.append(response.body, position, string::npos);
+
+    respondWritten(session, OK, body);
 }
 
 void VtcBlockIndexer::HttpServer::getBlockTransactions(const shared_ptr<Session> session) {
+    VtcBlockIndexer::ReadContext reads(this->database);
     const auto request = session->get_request();
-    
-    string highestBlockString;
-    this->db->Get(leveldb::ReadOptions(),"highestblock",&highestBlockString);
-
-    uint64_t highestBlock = stoll(highestBlockString);
 
     std::string blockHashString = request->get_path_parameter("hash","");
     int pageNum = stoi(request->get_path_parameter("page","0"));
+    string cacheKey = "blocktxs-" + blockHashString + "-" + std::to_string(pageNum);
+
+    shared_ptr<const CachedResponse> cached = getCachedResponse(reads, cacheKey);
+    if(cached) {
+        respondCached(session, reads, *cached);
+        return;
+    }
 
     string blockHeightString;
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(),"block-hash-" + blockHashString,&blockHeightString);
+    leveldb::Status s = reads.get(STORE_CHAIN, "block-hash-" + blockHashString,&blockHeightString);
     if(!s.ok()) // no key found
     { 
         const std::string message("Block not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message);
         return;
     }
 
@@ -255,21 +577,23 @@ void VtcBlockIndexer::HttpServer::getBlockTransactions(const shared_ptr<Session>
     blockKey << "block-filePosition-" << setw(8) << setfill('0') << blockHeight;
 
     std::string filePosition;
-    s = this->db->Get(leveldb::ReadOptions(), blockKey.str(), &filePosition);
+    s = reads.get(STORE_CHAIN, blockKey.str(), &filePosition);
     if(!s.ok()) // no key found
     {
         const std::string message("Block not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message);
         return;
     }
     
     Block block = this->blockReader->readBlock(filePosition.substr(0,12),stoll(filePosition.substr(12,12)),blockHeight,false);
 
-    json response;
+    // The page is kept as text, with slots for the confirmations of each transaction
+    // and the spend of each output
+    shared_ptr<CachedResponse> response = make_shared<CachedResponse>();
+    response->blockHash = block.blockHash;
+    response->blockHeight = block.height;
     size_t leftOver = block.transactions.size() % 10;
-
-    response["pagesTotal"] = (block.transactions.size() - leftOver) / 10 + (leftOver > 0 ? 1 : 0);
-    json txs = json::array();
+    response->body = "{\"pagesTotal\":" + std::to_string((block.transactions.size() - leftOver) / 10 + (leftOver > 0 ? 1 : 0)) + ",\"txs\":[";
 
     int pageStart = 10 * pageNum;
     int maxIndex = block.transactions.size()-1;
@@ -283,12 +607,11 @@ void VtcBlockIndexer::HttpServer::getBlockTransactions(const shared_ptr<Session>
             jtx["version"] = tx.version;
             jtx["locktime"] = tx.lockTime;
             jtx["size"] = tx.byteSize;
-            jtx["confirmations"] = highestBlock-block.height+1;
             jtx["blockhash"] = block.blockHash;
             jtx["blockheight"] = block.height;
             jtx["isCoinBase"] = false;
             json vins = json::array();
-            for (VtcBlockIndexer::TransactionInput txi : tx.inputs) {
+            for (const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
                 if(txi.coinbase) jtx["isCoinBase"] = true;
 
                 json vin;
@@ -299,145 +622,282 @@ void VtcBlockIndexer::HttpServer::getBlockTransactions(const shared_ptr<Session>
                 json scriptSig;
                 scriptSig["hex"] = Utility::hashToHex(txi.script);
                 vin["scriptSig"] = scriptSig;
-                vector<string> addresses = getAddressesForTxo(txi.txHash, txi.txoIndex);
+                VtcBlockIndexer::PrevOutput prevOutput = getPrevOutputForInput(reads, txi);
                 string addressesConcatenated = "";
                 
-                for(size_t i = 0; i < addresses.size(); i++) {
-                    addressesConcatenated += (i > 0 ? " " : "") + addresses[i];
+                for(size_t i = 0; i < prevOutput.scriptIds.size(); i++) {
+                    addressesConcatenated += (i > 0 ? " " : "") + Utility::scriptIdToAddress(prevOutput.scriptIds[i]);
                 }
                 vin["addr"] = addressesConcatenated;
-                vin["valueSat"] = getValueForTxo(txi.txHash, txi.txoIndex);
+                vin["valueSat"] = prevOutput.value;
                 
                 vins.push_back(vin);
             }
             jtx["vin"] = vins;
             json vouts = json::array();
-            for (VtcBlockIndexer::TransactionOutput txo : tx.outputs) {
+            uint64_t valueOut = 0;
+            for (const VtcBlockIndexer::TransactionOutput& txo : tx.outputs) {
                 json vout;
-                
-                string spentTx;
-                stringstream txoKey;
-                txoKey << "txo-" << tx.txHash << "-" << setw(8) << setfill('0') << txo.index << "-spent";
-
-                leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txoKey.str(), &spentTx);
-                if(s.ok()) // no key found, not spent. Add balance.
-                {
-                    vout["spentTxId"] = spentTx.substr(64, 64);
-                    vout["spentIndex"] = stoll(spentTx.substr(128, 8));
-                    vout["spentBlock"] = spentTx.substr(0, 64);
-                    std::string blockHeightString;
-                    s = this->db->Get(leveldb::ReadOptions(), "block-hash-" + spentTx.substr(0, 64), &blockHeightString);
-                    if(s.ok()) 
-                    {
-                        vout["spentHeight"] = stoll(blockHeightString);
-                    }
-                }
+                valueOut += txo.value;
 
                 json scriptPubKey;
                 scriptPubKey["hex"] = Utility::hashToHex(txo.script);
                 scriptPubKey["addresses"] = json::array();
-                vector<string> addresses = getAddressesForTxo(tx.txHash, txo.index);
-                for(string address : addresses) {
+                VtcBlockIndexer::ScriptClassification classification = scriptSolver->classifyScript(txo.script);
+                vector<string> addresses = scriptSolver->getAddressesFromScript(txo.script, classification);
+                for(const string& address : addresses) {
                     scriptPubKey["addresses"].push_back(address);
                 }
-                scriptPubKey["type"] = scriptSolver->getScriptTypeName(txo.script);
+                scriptPubKey["type"] = scriptSolver->getScriptTypeName(classification);
                 vout["scriptPubKey"] = scriptPubKey;
                 vout["valueSat"] = txo.value;
                 
                 vouts.push_back(vout);
             }
             jtx["vout"] = vouts;
-            txs.push_back(jtx);
+            jtx["valueOutSat"] = valueOut;
+
+            string valueInString;
+            string feeString;
+            leveldb::Status s = reads.get(STORE_TXS, "tx-" + tx.txHash + "-valuein", &valueInString);
+            if(s.ok()) {
+                jtx["valueInSat"] = stoull(valueInString);
+            }
+            s = reads.get(STORE_TXS, "tx-" + tx.txHash + "-fee", &feeString);
+            if(s.ok()) {
+                jtx["feesSat"] = stoull(feeString);
+            }
+
+            // Every object has members, so the fields inserted at a slot are followed by one
+            string& body = response->body;
+            if(i > pageStart) body += ",";
+            body += "{";
+            response->slots.push_back({ body.size(), "", 0 });
+            json jvouts = std::move(jtx["vout"]);
+            jtx.erase("vout");
+            string txText = jtx.dump();
+            body.append(txText, 1, txText.size() - 2);
+            body += ",\"vout\":[";
+            for(size_t n = 0; n < jvouts.size(); n++) {
+                if(n > 0) body += ",";
+                body += "{";
+                response->slots.push_back({ body.size(), tx.txHash, (uint32_t)n });
+                string voutText = jvouts[n].dump();
+                body.append(voutText, 1, string::npos);
+            }
+            body += "]}";
         }
     }
-    response["txs"] = txs;
-    string body = response.dump();
-    
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    response->body += "]}";
+    cacheResponse(reads, cacheKey, response);
+    respondCached(session, reads, *response);
+}
+
+
+shared_ptr<const VtcBlockIndexer::MerkleTree> VtcBlockIndexer::HttpServer::getMerkleTree(VtcBlockIndexer::ReadContext& reads, const string& blockHash) {
+    shared_ptr<const MerkleTree> tree = merkleTreeCache->get(blockHash);
+    if(tree) {
+        return tree;
+    }
+
+    // The transaction ids are in block order under block-<hash>-tx-<index>
+    vector<string> txids;
+    string prefix = "block-" + blockHash + "-tx-";
+    VtcBlockIndexer::ReadContext::Iterator it = reads.iterator(STORE_TXS);
+    for(it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        txids.push_back(it->value().ToString());
+    }
+    if(txids.empty()) {
+        return NULL;
+    }
+
+    tree = make_shared<const MerkleTree>(txids);
+    merkleTreeCache->put(blockHash, tree, tree->getByteSize());
+    return tree;
+}
+
+bool VtcBlockIndexer::HttpServer::readBlockHeader(VtcBlockIndexer::ReadContext& reads, uint64_t height, VtcBlockIndexer::Block& block) {
+    stringstream blockKey;
+    blockKey << "block-filePosition-" << setw(8) << setfill('0') << height;
+
+    std::string filePosition;
+    if(!reads.get(STORE_CHAIN, blockKey.str(), &filePosition).ok()) {
+        return false;
+    }
+    block = this->blockReader->readBlock(filePosition.substr(0,12),stoll(filePosition.substr(12,12)),height,true);
+    return true;
+}
+
+bool VtcBlockIndexer::HttpServer::isBlockAtHeight(VtcBlockIndexer::ReadContext& reads, const string& blockHash, uint64_t height) {
+    stringstream blockKey;
+    blockKey << "block-" << setw(8) << setfill('0') << height;
+
+    std::string heightHash;
+    return reads.get(STORE_CHAIN, blockKey.str(), &heightHash).ok() && heightHash == blockHash;
 }
 
+json VtcBlockIndexer::HttpServer::blockHeaderToJson(const VtcBlockIndexer::Block& block) {
+    json jsonBlock;
+    jsonBlock["blockHash"] = block.blockHash;
+    jsonBlock["previousBlockHash"] = block.previousBlockHash;
+    jsonBlock["merkleRoot"] = block.merkleRoot;
+    jsonBlock["version"] = block.version;
+    jsonBlock["time"] = block.time;
+    jsonBlock["bits"] = block.bits;
+    jsonBlock["nonce"] = block.nonce;
+    jsonBlock["height"] = block.height;
+    return jsonBlock;
+}
 
 void VtcBlockIndexer::HttpServer::getTransactionProof(const shared_ptr<Session> session) {
+    VtcBlockIndexer::ReadContext reads(this->database);
     const auto request = session->get_request();
     
     std::string blockHash;
     std::string txId = request->get_path_parameter("id","");
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "tx-" + txId + "-block", &blockHash);
+
+    shared_ptr<const CachedResponse> cached = getCachedResponse(reads, "proof-" + txId);
+    if(cached) {
+        respondCached(session, reads, *cached);
+        return;
+    }
+
+    leveldb::Status s = reads.get(STORE_TXS, "tx-" + txId + "-block", &blockHash);
     if(!s.ok()) // no key found
     {
         const std::string message("TX not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message);
         return;
     }
 
     std::string blockHeightString;
-    s = this->db->Get(leveldb::ReadOptions(), "block-hash-" + blockHash, &blockHeightString);
+    s = reads.get(STORE_CHAIN, "block-hash-" + blockHash, &blockHeightString);
     if(!s.ok()) // no key found
     {
         const std::string message("Block not found");
-        session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+        respond(session, 404, message);
         return;
     }
     uint64_t blockHeight = stoll(blockHeightString);
+
+    // A block that was replaced in a reorg is no longer at its height
+    Block block;
+    if(!isBlockAtHeight(reads, blockHash, blockHeight) || !readBlockHeader(reads, blockHeight, block)) {
+        const std::string message("Block not found");
+        respond(session, 404, message);
+        return;
+    }
+
     json j;
     j["txHash"] = txId;
     j["blockHash"] = blockHash;
     j["blockHeight"] = blockHeight;
     json chain = json::array();
-    for(uint64_t i = blockHeight+1; --i > 0 && i > blockHeight-10;) {
-        stringstream blockKey;
-        blockKey << "block-filePosition-" << setw(8) << setfill('0') << i;
-   
-        std::string filePosition;
-        s = this->db->Get(leveldb::ReadOptions(), blockKey.str(), &filePosition);
-        if(!s.ok()) // no key found
+    chain.push_back(blockHeaderToJson(block));
+    for(uint64_t i = blockHeight; --i > 0 && i + 10 > blockHeight;) {
+        Block previousBlock;
+        if(!readBlockHeader(reads, i, previousBlock)) // no key found
         {
             const std::string message("Block not found");
-            session->close(404, message, {{"Content-Length",  std::to_string(message.size())}});
+            respond(session, 404, message);
             return;
         }
-       
-        Block block = this->blockReader->readBlock(filePosition.substr(0,12),stoll(filePosition.substr(12,12)),i,true);
+        chain.push_back(blockHeaderToJson(previousBlock));
+    }
+    j["chain"] = chain;
+
+    // The branch hashes to the merkle root of the first header in the chain
+    shared_ptr<const MerkleTree> tree = getMerkleTree(reads, blockHash);
+    int64_t position = tree ? tree->findTransaction(txId) : -1;
+    if(position < 0 || tree->getRoot() != block.merkleRoot) {
+        VTC_LOG(LOG_LEVEL_ERROR, "Merkle tree of block " << blockHash << " does not match its header");
+        respond(session, INTERNAL_SERVER_ERROR, "Merkle branch could not be built");
+        return;
+    }
+    j["position"] = position;
+    j["merkleBranch"] = tree->getBranch(position);
+
+    shared_ptr<CachedResponse> response = make_shared<CachedResponse>();
+    response->body = j.dump();
+    response->blockHash = blockHash;
+    response->blockHeight = blockHeight;
+    cacheResponse(reads, "proof-" + txId, response);
+    respondJson(session, OK, j);
+}
+
+void VtcBlockIndexer::HttpServer::getTransactionProofs(const shared_ptr<Session> session) {
+    VtcBlockIndexer::ReadContext reads(this->database);
+    const auto request = session->get_request();
+
+    std::string blockHash = request->get_path_parameter("hash","");
+    std::string blockHeightString;
+    leveldb::Status s = reads.get(STORE_CHAIN, "block-hash-" + blockHash, &blockHeightString);
+    Block block;
+    if(!s.ok() || !isBlockAtHeight(reads, blockHash, stoll(blockHeightString)) || !readBlockHeader(reads, stoll(blockHeightString), block)) // no key found or reorged out
+    {
+        const std::string message("Block not found");
+        respond(session, 404, message);
+        return;
+    }
 
-        json jsonBlock;
-        jsonBlock["blockHash"] = block.blockHash;
-        jsonBlock["previousBlockHash"] = block.previousBlockHash;
-        jsonBlock["merkleRoot"] = block.merkleRoot;
-        jsonBlock["version"] = block.version;
-        jsonBlock["time"] = block.time;
-        jsonBlock["bits"] = block.bits;
-        jsonBlock["nonce"] = block.nonce;
-        jsonBlock["height"] = block.height;
-        chain.push_back(jsonBlock);
+    shared_ptr<const MerkleTree> tree = getMerkleTree(reads, blockHash);
+    if(!tree || tree->getRoot() != block.merkleRoot) {
+        VTC_LOG(LOG_LEVEL_ERROR, "Merkle tree of block " << blockHash << " does not match its header");
+        respond(session, INTERNAL_SERVER_ERROR, "Merkle branches could not be built");
+        return;
+    }
 
+    json j;
+    j["block"] = blockHeaderToJson(block);
+    j["transactionCount"] = tree->getTransactionCount();
+    json proofs = json::array();
+    stringstream txids(request->get_query_parameter("txids", ""));
+    string txId;
+    while(getline(txids, txId, ',')) {
+        if(txId.empty()) continue;
+        if(proofs.size() >= tree->getTransactionCount()) {
+            respond(session, 400, "Too many transaction ids");
+            return;
+        }
+        json proof;
+        proof["txHash"] = txId;
+        int64_t position = tree->findTransaction(txId);
+        if(position < 0) {
+            proof["error"] = true;
+            proof["errorDescription"] = "Transaction not in block";
+        } else {
+            proof["error"] = false;
+            proof["position"] = position;
+            proof["merkleBranch"] = tree->getBranch(position);
+        }
+        proofs.push_back(proof);
     }
-    j["chain"] = chain;
-    string body = j.dump();
-    
-   session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    j["proofs"] = proofs;
+    respondJson(session, OK, j);
 }
 
 void VtcBlockIndexer::HttpServer::sync(const shared_ptr<Session> session) {
     json j;
 
-    const auto request = session->get_request( );
-
-    string highestBlockString;
-    this->db->Get(leveldb::ReadOptions(),"highestblock",&highestBlockString);
+    // Served from memory, the poller keeps the node's height up to date
+    VtcBlockIndexer::ChainTip tip = chainState->getTip();
 
     j["error"] = nullptr;
-    j["height"] = stoll(highestBlockString);
-    try {
-        const Json::Value blockCount = vertcoind->getblockcount();
-        
-        j["blockChainHeight"] = blockCount.asInt();
-    } catch(const jsonrpc::JsonRpcException& e) {
-        const std::string message(e.what());
-        j["error"] = message;
+    if(!chainState->isNodeReachable()) {
+        j["error"] = "Could not reach the node";
+    }
+    j["height"] = tip.height;
+    j["blockChainHeight"] = nullptr;
+    float progress = 0;
+    if(tip.nodeHeight > 0) {
+        j["blockChainHeight"] = tip.nodeHeight;
+        progress = (float)tip.height / (float)tip.nodeHeight * 100;
+    }
+    j["blocksPerSecond"] = tip.blocksPerSecond;
+    j["etaSeconds"] = nullptr;
+    if(tip.etaSeconds >= 0) {
+        j["etaSeconds"] = tip.etaSeconds;
     }
-
-    float progress = (float)j["height"].get<int>() / (float)j["blockChainHeight"].get<int>();
-    progress *= 100;
     j["syncPercentage"] = progress;
     if(progress >= 100) {
         j["status"] = "finished";
@@ -445,59 +905,251 @@ void VtcBlockIndexer::HttpServer::sync(const shared_ptr<Session> session) {
         j["status"] = "indexing";
     }
 
-    string body = j.dump();
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respondJson(session, OK, j);
+}
+
+void VtcBlockIndexer::HttpServer::metrics(const shared_ptr<Session> session) {
+    string body;
+    Metrics::render(body);
+
+    VtcBlockIndexer::ChainTip tip = chainState->getTip();
+    Metrics::renderHeader(body, "vtc_indexer_height", "gauge", "Height of the highest indexed block");
+    Metrics::renderSample(body, "vtc_indexer_height", "", tip.height);
+
+    // Left out until the node has been reached
+    if(tip.nodeHeight >= 0) {
+        Metrics::renderHeader(body, "vtc_indexer_node_height", "gauge", "Height of the node's best block");
+        Metrics::renderSample(body, "vtc_indexer_node_height", "", tip.nodeHeight);
+    }
+    Metrics::renderHeader(body, "vtc_indexer_blocks_per_second", "gauge", "Blocks indexed per second, averaged over the last minutes");
+    Metrics::renderSample(body, "vtc_indexer_blocks_per_second", "", tip.blocksPerSecond);
+
+    Metrics::renderHeader(body, "vtc_indexer_mempool_transactions", "gauge", "Transactions in the mempool");
+    Metrics::renderSample(body, "vtc_indexer_mempool_transactions", "", mempoolMonitor->getTransactionCount());
+    Metrics::renderHeader(body, "vtc_indexer_mempool_update_seconds", "gauge", "Time the last mempool update took to read the new transactions from the node");
+    Metrics::renderSample(body, "vtc_indexer_mempool_update_seconds", "", mempoolMonitor->getLastUpdateSeconds());
+    Metrics::renderHeader(body, "vtc_indexer_mempool_last_update_timestamp_seconds", "gauge", "Unix time of the last mempool update");
+    Metrics::renderSample(body, "vtc_indexer_mempool_last_update_timestamp_seconds", "", mempoolMonitor->getLastUpdateTime());
+
+    vector<pair<string, string>> storeStats;
+    VtcBlockIndexer::ReadContext reads(this->database);
+    Metrics::renderHeader(body, "vtc_indexer_leveldb_memory_bytes", "gauge", "Approximate memory LevelDB uses per store");
+    for(int i = 0; i < STORE_COUNT; i++) {
+        string storeName = Database::getStoreName((DatabaseStore)i);
+        string memoryUsage;
+        if(reads.getProperty((DatabaseStore)i, "leveldb.approximate-memory-usage", &memoryUsage)) {
+            Metrics::renderSample(body, "vtc_indexer_leveldb_memory_bytes", "store=\"" + storeName + "\"", stod(memoryUsage));
+        }
+        string stats;
+        if(reads.getProperty((DatabaseStore)i, "leveldb.stats", &stats)) {
+            storeStats.emplace_back(storeName, stats);
+        }
+    }
+    Metrics::renderLevelDbStats(body, storeStats);
+
+    respond(session, OK, body, "text/plain; version=0.0.4");
+}
+
+function<void(const shared_ptr<Session>)> VtcBlockIndexer::HttpServer::route(const string& endpoint, size_t maxConcurrent, const function<void(const shared_ptr<Session>)>& handler) {
+    int endpointId = Metrics::registerEndpoint(endpoint);
+    shared_ptr<VtcBlockIndexer::RequestLimiter> limiter = make_shared<VtcBlockIndexer::RequestLimiter>(endpointId, maxConcurrent, options.requestQueueSize, chrono::seconds(options.requestTimeout), [this](const shared_ptr<Session> session, const string& reason) {
+        respond(session, SERVICE_UNAVAILABLE, reason, "text/plain", { { "Retry-After", "1" } });
+    });
+    return [limiter, handler](const shared_ptr<Session> session) {
+        limiter->admit(session, handler);
+    };
+}
+
+int VtcBlockIndexer::HttpServer::failureStatus(const shared_ptr<VtcBlockIndexer::RequestState> request) {
+    return (request && request->stopped()) ? SERVICE_UNAVAILABLE : 400;
+}
+
+void VtcBlockIndexer::HttpServer::writeBlockSummary(VtcBlockIndexer::JsonWriter& writer, const string& hash, const string& height, const string& size, const string& time, const string& txCount) {
+    writer.beginObject();
+    writer.key("hash").value(hash);
+    writer.key("height").value(stoll(height));
+    writer.key("poolInfo").null();
+    writer.key("size").value(stoll(size));
+    writer.key("time").value(stoll(time));
+    writer.key("txlength").value(stoll(txCount));
+    writer.endObject();
+}
+
+void VtcBlockIndexer::HttpServer::subscribe(const shared_ptr<Session> session) {
+    const auto request = session->get_request();
+    string connection = request->get_header("Connection", "");
+    string upgrade = request->get_header("Upgrade", "");
+    std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+    std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), ::tolower);
+    if(connection.find("upgrade") == string::npos || upgrade != "websocket" || !request->has_header("Sec-WebSocket-Key")) {
+        respond(session, 400, "Expected a WebSocket upgrade");
+        return;
+    }
+
+    // Sec-WebSocket-Accept is the base64 SHA-1 of the key and the protocol GUID (RFC 6455)
+    string key = request->get_header("Sec-WebSocket-Key") + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char hash[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char*)key.data(), key.size(), hash);
+    unsigned char accept[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    EVP_EncodeBlock(accept, hash, SHA_DIGEST_LENGTH);
+
+    multimap<string, string> headers = {
+        { "Upgrade", "websocket" },
+        { "Connection", "Upgrade" },
+        { "Sec-WebSocket-Accept", string((const char*)accept) }
+    };
+
+    session->upgrade(SWITCHING_PROTOCOLS, headers, [this](const shared_ptr<WebSocket> socket) {
+        if(!socket->is_open()) return;
+
+        // Events are sent from the indexer and mempool threads, which must not
+        // keep a closed socket alive
+        weak_ptr<WebSocket> weakSocket = socket;
+        uint64_t subscriberId = subscriptions->addSubscriber([weakSocket](const string& message) {
+            shared_ptr<WebSocket> socket = weakSocket.lock();
+            if(socket && socket->is_open()) {
+                socket->send(message);
+            }
+        });
+
+        socket->set_close_handler([this, subscriberId](const shared_ptr<WebSocket> socket) {
+            subscriptions->removeSubscriber(subscriberId);
+        });
+        socket->set_error_handler([this, subscriberId](const shared_ptr<WebSocket> socket, const std::error_code error) {
+            subscriptions->removeSubscriber(subscriberId);
+            socket->close();
+        });
+        socket->set_message_handler([this, subscriberId](const shared_ptr<WebSocket> socket, const shared_ptr<WebSocketMessage> message) {
+            subscriptionMessage(socket, subscriberId, message);
+        });
+    });
+}
+
+void VtcBlockIndexer::HttpServer::subscriptionMessage(const shared_ptr<WebSocket> socket, uint64_t subscriberId, const shared_ptr<WebSocketMessage> message) {
+    switch(message->get_opcode()) {
+        case WebSocketMessage::PING_FRAME:
+            socket->send(make_shared<WebSocketMessage>(WebSocketMessage::PONG_FRAME, message->get_data()));
+            return;
+        case WebSocketMessage::CONNECTION_CLOSE_FRAME:
+            subscriptions->removeSubscriber(subscriberId);
+            socket->close();
+            return;
+        case WebSocketMessage::TEXT_FRAME:
+            break;
+        default:
+            return;
+    }
+
+    // Messages look like {"op": "subscribe", "topic": "address", "address": "V..."}
+    json reply;
+    Bytes data = message->get_data();
+    try {
+        json input = json::parse(string(data.begin(), data.end()));
+        string op = input.at("op").get<string>();
+        string topicName = input.at("topic").get<string>();
+        if(op != "subscribe" && op != "unsubscribe") {
+            throw std::invalid_argument("Unknown op, expected subscribe or unsubscribe");
+        }
+
+        VtcBlockIndexer::SubscriptionTopic topic;
+        string key;
+        reply["topic"] = topicName;
+        if(topicName == "blocks") {
+            topic = TOPIC_BLOCKS;
+        } else if(topicName == "address") {
+            topic = TOPIC_ADDRESS;
+            key = Utility::addressToScriptId(input.at("address").get<string>());
+            if(key.empty()) {
+                throw std::invalid_argument("Invalid address");
+            }
+            reply["address"] = input.at("address");
+        } else if(topicName == "outpoint") {
+            topic = TOPIC_OUTPOINT;
+            string txid = input.at("txid").get<string>();
+            long long vout = input.at("vout").get<long long>();
+            if(txid.size() != 64 || txid.find_first_not_of("0123456789abcdef") != string::npos || vout < 0 || vout > 99999999) {
+                throw std::invalid_argument("Invalid outpoint");
+            }
+            stringstream outpoint;
+            outpoint << txid << setw(8) << setfill('0') << vout;
+            key = outpoint.str();
+            reply["txid"] = txid;
+            reply["vout"] = vout;
+        } else {
+            throw std::invalid_argument("Unknown topic, expected blocks, address or outpoint");
+        }
+
+        if(op == "subscribe") {
+            if(!subscriptions->subscribe(subscriberId, topic, key)) {
+                throw std::invalid_argument("Too many subscriptions");
+            }
+            reply["event"] = "subscribed";
+        } else {
+            subscriptions->unsubscribe(subscriberId, topic, key);
+            reply["event"] = "unsubscribed";
+        }
+    } catch(const std::exception& e) {
+        reply = json();
+        reply["event"] = "error";
+        reply["error"] = e.what();
+    }
+    socket->send(reply.dump());
 }
 
 void VtcBlockIndexer::HttpServer::getBlocks(const shared_ptr<Session> session) {
-    json j = json::array();
+    VtcBlockIndexer::ReadContext reads(this->database);
+    string& body = JsonWriter::threadBuffer();
+    json tree;
+    JsonWriter writer = createWriter(session, body, tree);
+    writer.beginArray();
 
     const auto request = session->get_request( );
 
-    string highestBlockString;
-    this->db->Get(leveldb::ReadOptions(),"highestblock",&highestBlockString);
-    
-   
+    long long highestBlock = reads.getTipHeight();
+    if(highestBlock < 0) {
+        writer.endArray();
+        respondWritten(session, OK, writer);
+        return;
+    }
+
     long long limitParam = stoi(request->get_query_parameter("limit","0"));
     if(limitParam == 0 || limitParam > 100)
         limitParam = 100;
 
-    long long lowestBlock = stoll(highestBlockString)-limitParam;
+    long long lowestBlock = highestBlock-limitParam;
+    stringstream highestBlockString;
+    highestBlockString << setw(8) << setfill('0') << highestBlock;
     stringstream lowestBlockString;
     lowestBlockString << setw(8) << setfill('0') << lowestBlock;
 
-    string start("block-" + highestBlockString);
+    string start("block-" + highestBlockString.str());
     string limit("block-" + lowestBlockString.str());
     
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    VtcBlockIndexer::ReadContext::Iterator it = reads.iterator(STORE_CHAIN);
     for (it->Seek(start);
             it->Valid() && it->key().ToString() > limit;
             it->Prev()) {
-        json blockObj;
         string blockHeightString = it->key().ToString().substr(6);
-        blockObj["hash"] = it->value().ToString();
         string blockSizeString;
         string blockTxesString;
         string blockTimeString;
-        this->db->Get(leveldb::ReadOptions(),"block-size-" + blockHeightString,&blockSizeString);
-        this->db->Get(leveldb::ReadOptions(),"block-txcount-" + blockHeightString,&blockTxesString);
-        this->db->Get(leveldb::ReadOptions(),"block-time-" + blockHeightString,&blockTimeString);
-        blockObj["height"] = stoll(blockHeightString);
-        blockObj["size"] = stoll(blockSizeString);
-        blockObj["time"] = stoll(blockTimeString);
-        blockObj["txlength"] = stoll(blockTxesString);
-        blockObj["poolInfo"] = nullptr;
-        j.push_back(blockObj);
-    }
-
-    string body = j.dump();
-    
-   session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+        reads.get(STORE_CHAIN, "block-size-" + blockHeightString,&blockSizeString);
+        reads.get(STORE_CHAIN, "block-txcount-" + blockHeightString,&blockTxesString);
+        reads.get(STORE_CHAIN, "block-time-" + blockHeightString,&blockTimeString);
+        writeBlockSummary(writer, it->value().ToString(), blockHeightString, blockSizeString, blockTimeString, blockTxesString);
+    }
+    writer.endArray();
+
+    respondWritten(session, OK, writer);
 
 }
 
 void VtcBlockIndexer::HttpServer::getBlocksByDate(const shared_ptr<Session> session) {
-    json j = json::array();
+    VtcBlockIndexer::ReadContext reads(this->database);
+    string& body = JsonWriter::threadBuffer();
+    json tree;
+    JsonWriter writer = createWriter(session, body, tree);
+    writer.beginArray();
  
     const auto request = session->get_request( );
 
@@ -513,258 +1165,907 @@ void VtcBlockIndexer::HttpServer::getBlocksByDate(const shared_ptr<Session> sess
     string start(ssBlockHeightTimeStartKey.str());
     string limit(ssBlockHeightTimeEndKey.str());
     
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    VtcBlockIndexer::ReadContext::Iterator it = reads.iterator(STORE_CHAIN);
     for (it->Seek(start);
             it->Valid() && it->key().ToString() <= limit;
             it->Next()) {
-        json blockObj;
         string blockHashString = it->value().ToString();
         string blockHeightString;
-        this->db->Get(leveldb::ReadOptions(),"block-hash-" + blockHashString,&blockHeightString);
+        reads.get(STORE_CHAIN, "block-hash-" + blockHashString,&blockHeightString);
         string blockSizeString;
         string blockTxesString;
         string blockTimeString;
-        this->db->Get(leveldb::ReadOptions(),"block-size-" + blockHeightString,&blockSizeString);
-        this->db->Get(leveldb::ReadOptions(),"block-txcount-" + blockHeightString,&blockTxesString);
-        this->db->Get(leveldb::ReadOptions(),"block-time-" + blockHeightString,&blockTimeString);
-        blockObj["hash"] = it->value().ToString();
-        blockObj["height"] = stoll(blockHeightString);
-        blockObj["size"] = stoll(blockSizeString);
-        blockObj["time"] = stoll(blockTimeString);
-        blockObj["txlength"] = stoll(blockTxesString);
-        blockObj["poolInfo"] = nullptr;
-        j.push_back(blockObj);
+        reads.get(STORE_CHAIN, "block-size-" + blockHeightString,&blockSizeString);
+        reads.get(STORE_CHAIN, "block-txcount-" + blockHeightString,&blockTxesString);
+        reads.get(STORE_CHAIN, "block-time-" + blockHeightString,&blockTimeString);
+        writeBlockSummary(writer, blockHashString, blockHeightString, blockSizeString, blockTimeString, blockTxesString);
     }
+    writer.endArray();
 
-    string body = j.dump();
-     
-   session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respondWritten(session, OK, writer);
 
 }
 
-void VtcBlockIndexer::HttpServer::addressBalance( const shared_ptr< Session > session )
-{
-    long long balance = 0;
-    long long unconfirmedBalance = 0;
-    long long txCount = 0;
-    long long unconfirmedTxCount = 0;
-    int txoCount = 0;
-    const auto request = session->get_request( );
-    int details = stoi(request->get_query_parameter("details","0"));
-    
-    cout << "Checking balance for address " << request->get_path_parameter( "address" ) << endl;
+VtcBlockIndexer::AddressBalance VtcBlockIndexer::HttpServer::getAddressBalance(VtcBlockIndexer::ReadContext& reads, VtcBlockIndexer::RequestState& request, const string& scriptId) {
+    VtcBlockIndexer::AddressBalance result;
+    result.balance = 0;
+    result.unconfirmedBalance = 0;
+    result.txCount = 0;
+    result.unconfirmedTxCount = 0;
+    result.txoCount = 0;
 
-    string start(request->get_path_parameter( "address" ) + "-txo-00000001");
-    string limit(request->get_path_parameter( "address" ) + "-txo-99999999");
+    string start(scriptId + "-txo-00000001");
+    string limit(scriptId + "-txo-99999999");
     
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
+    VtcBlockIndexer::ReadContext::Iterator it = reads.iterator(STORE_ADDRESSES);
     
     for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
+            scriptId.size() > 0 && it->Valid() && it->key().ToString() < limit && !request.stopped();
             it->Next()) {
 
         string spentTx;
-        txoCount++;
-        txCount++;
         string txo = it->value().ToString();
 
-        leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "txo-" + txo.substr(0,64) + "-" + txo.substr(64,8) + "-spent", &spentTx);
+        // Skip outputs of a block that is still being indexed
+        if(stoll(txo.substr(72,8)) > reads.getTipHeight()) continue;
+
+        result.txoCount++;
+        result.txCount++;
+
+        leveldb::Status s = reads.get(STORE_SPENT, "txo-" + txo.substr(0,64) + "-" + txo.substr(64,8) + "-spent", &spentTx);
         if(!s.ok()) // no key found, not spent. Add balance.
         {
-            balance += stoll(txo.substr(80));
+            result.balance += stoll(txo.substr(80));
             // check mempool for spenders
             string spender = mempoolMonitor->outpointSpend(txo.substr(0,64), stol(txo.substr(64,8)));
             if(spender.compare("") == 0) {
-                unconfirmedBalance += stoll(txo.substr(80));
+                result.unconfirmedBalance += stoll(txo.substr(80));
             } else {
-                unconfirmedTxCount++;
+                result.unconfirmedTxCount++;
             }
         } else { 
-            txCount++;
+            result.txCount++;
         }
     }
     assert(it->status().ok());  // Check for any errors found during the scan
-    delete it;
 
-    cout << "Analyzed " << txoCount << " TXOs - Balance is " << balance << endl;
- 
     // Add mempool transactions
-    vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(request->get_path_parameter( "address" ));
+    vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(scriptId);
     for (VtcBlockIndexer::TransactionOutput txo : mempoolOutputs) {
-        txoCount++;
-        unconfirmedTxCount++;
+        result.txoCount++;
+        result.unconfirmedTxCount++;
         string spender = mempoolMonitor->outpointSpend(txo.txHash, txo.index);
-        cout << "Spender for " << txo.txHash << "/" << txo.index << " = " << spender;
         if(spender.compare("") == 0) {
-            unconfirmedBalance += txo.value;
+            result.unconfirmedBalance += txo.value;
         } else {
-            unconfirmedTxCount++;
+            result.unconfirmedTxCount++;
         }
     }
+    return result;
+}
+
+void VtcBlockIndexer::HttpServer::addressBalance( const shared_ptr< Session > session )
+{
+    VtcBlockIndexer::ReadContext reads(this->database);
+    const auto request = session->get_request( );
+    int details = stoi(request->get_query_parameter("details","0"));
+    
+    VTC_LOG(LOG_LEVEL_DEBUG, "Checking balance for address " << request->get_path_parameter( "address" ));
+
+    // Index keys use the script identifier, decode the address once
+    string scriptId = Utility::addressToScriptId(request->get_path_parameter( "address" ));
+    shared_ptr<VtcBlockIndexer::RequestState> requestState = RequestState::current();
+    VtcBlockIndexer::AddressBalance balance = getAddressBalance(reads, *requestState, scriptId);
+    if(requestState->stopped()) {
+        respond(session, SERVICE_UNAVAILABLE, requestState->getStopReason());
+        return;
+    }
 
-    cout << "Including mempool: Analyzed " << txoCount << " TXOs - Balance is " << balance << endl;
+    VTC_LOG(LOG_LEVEL_DEBUG, "Including mempool: Analyzed " << balance.txoCount << " TXOs - Balance is " << balance.balance);
     
     if(details != 0) {
-        json j;
-        j["balance"] = balance;
-        j["txCount"] = txCount;
-        j["unconfirmedBalance"] = unconfirmedBalance;
-        j["unconfirmedTxCount"] = unconfirmedTxCount;
-        string body = j.dump();
-        session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+        respondJson(session, OK, addressBalanceToJson(balance));
     } else {
         stringstream body;
-        body << balance;
+        body << balance.balance;
         
-        session->close( OK, body.str(), { {"Content-Type","text/plain"}, { "Content-Length",  std::to_string(body.str().size()) } } );
+        respond(session, OK, body.str());
     }
     
 }
 
-void VtcBlockIndexer::HttpServer::addressTxos( const shared_ptr< Session > session )
+json VtcBlockIndexer::HttpServer::addressBalanceToJson(const VtcBlockIndexer::AddressBalance& balance) {
+    json j;
+    j["balance"] = balance.balance;
+    j["txCount"] = balance.txCount;
+    j["unconfirmedBalance"] = balance.unconfirmedBalance;
+    j["unconfirmedTxCount"] = balance.unconfirmedTxCount;
+    return j;
+}
+
+bool VtcBlockIndexer::HttpServer::parseAddressList(const Bytes& body, vector<pair<string, long long>>& addresses, string& error) {
+    // Maximum number of addresses in one request
+    const size_t maxAddresses = 1000;
+
+    json input;
+    try {
+        input = json::parse(string(body.begin(), body.end()));
+    } catch(const std::exception& e) {
+        error = "Invalid JSON";
+        return false;
+    }
+    if(!input.is_array()) {
+        error = "Expected an array of addresses";
+        return false;
+    }
+    if(input.size() > maxAddresses) {
+        error = "At most " + std::to_string(maxAddresses) + " addresses are allowed per request";
+        return false;
+    }
+
+    for(const json& entry : input) {
+        if(entry.is_string()) {
+            addresses.push_back(make_pair(entry.get<string>(), 0));
+        } else if(entry.is_object() && entry.find("address") != entry.end() && entry.at("address").is_string()) {
+            long long since = 0;
+            if(entry.find("since") != entry.end() && entry.at("since").is_number()) {
+                since = entry.at("since").get<long long>();
+            }
+            addresses.push_back(make_pair(entry.at("address").get<string>(), since));
+        } else {
+            error = "Expected an address or an object with an address and optionally since";
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<size_t> VtcBlockIndexer::HttpServer::sortByScriptId(const vector<string>& scriptIds) {
+    vector<size_t> order(scriptIds.size());
+    for(size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&scriptIds](size_t a, size_t b) {
+        return scriptIds[a] < scriptIds[b];
+    });
+    return order;
+}
+
+void VtcBlockIndexer::HttpServer::addressBalances( const shared_ptr< Session > session )
 {
-    json j = json::array();
+    const auto request = session->get_request( );
+    size_t content_length = request->get_header( "Content-Length", 0);
+
+    // The body may arrive after the handler returned, keep the request's slot until it is handled
+    shared_ptr<VtcBlockIndexer::RequestState> requestState = RequestState::current();
+    session->fetch( content_length, [ this, requestState ]( const shared_ptr< Session > session, const Bytes & body )
+    {
+        vector<pair<string, long long>> addresses;
+        string error;
+        if(!parseAddressList(body, addresses, error)) {
+            respond(session, 400, error);
+            return;
+        }
+
+        VtcBlockIndexer::ReadContext reads(this->database);
+        vector<string> scriptIds;
+        for(const pair<string, long long>& address : addresses) {
+            scriptIds.push_back(Utility::addressToScriptId(address.first));
+        }
+
+        // Visit the addresses in key order, so neighbouring lookups hit the same blocks
+        vector<size_t> order = sortByScriptId(scriptIds);
+        vector<VtcBlockIndexer::AddressBalance> balances(addresses.size());
+        runInChunks(order.size(), minAddressesPerChunk, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end && !requestState->stopped(); i++) {
+                balances[order[i]] = getAddressBalance(reads, *requestState, scriptIds[order[i]]);
+            }
+        });
+        if(requestState->stopped()) {
+            respond(session, SERVICE_UNAVAILABLE, requestState->getStopReason());
+            return;
+        }
+
+        json output = json::array();
+        for(size_t i = 0; i < addresses.size(); i++) {
+            json j = addressBalanceToJson(balances[i]);
+            j["address"] = addresses[i].first;
+            output.push_back(j);
+        }
+
+        respondJson(session, OK, output);
+    } );
+}
 
+void VtcBlockIndexer::HttpServer::addressesTxos( const shared_ptr< Session > session )
+{
     const auto request = session->get_request( );
+    size_t content_length = request->get_header( "Content-Length", 0);
 
-    long long sinceBlock = stoll(request->get_path_parameter( "sinceBlock", "0" ));
-    
-    int txHashOnly = stoi(request->get_query_parameter("txHashOnly","0"));
-    int raw = stoi(request->get_query_parameter("raw","0"));
-    int unspent = stoi(request->get_query_parameter("unspent","0"));
-    int unconfirmed = stoi(request->get_query_parameter("unconfirmed","0"));
-    int scripts = stoi(request->get_query_parameter("script","0"));
-    cout << "Fetching address txos for address " << request->get_path_parameter( "address" ) << endl;
-   
-    string start(request->get_path_parameter( "address" ) + "-txo-00000001");
-    string limit(request->get_path_parameter( "address" ) + "-txo-99999999");
-    
-    leveldb::Iterator* it = this->db->NewIterator(leveldb::ReadOptions());
-    
-    for (it->Seek(start);
-            it->Valid() && it->key().ToString() < limit;
-            it->Next()) {
+    // The body may arrive after the handler returned, keep the request's slot until it is handled
+    shared_ptr<VtcBlockIndexer::RequestState> requestState = RequestState::current();
+    session->fetch( content_length, [ this, requestState ]( const shared_ptr< Session > session, const Bytes & body )
+    {
+        const auto request = session->get_request( );
+        vector<pair<string, long long>> addresses;
+        string error;
+        if(!parseAddressList(body, addresses, error)) {
+            respond(session, 400, error);
+            return;
+        }
+        bool sortByHeight = (request->get_query_parameter("sort", "") == "height");
+
+        // TXOs per response, the client fetches the rest with the cursor
+        const size_t maxTxosPerPage = 10000;
+        // TXOs read from an address at a time, between checks of the page size
+        const size_t txosPerRead = 100;
+        size_t pageLimit = stoull(request->get_query_parameter("limit", "0"));
+        if(pageLimit == 0 || pageLimit > maxTxosPerPage) {
+            pageLimit = maxTxosPerPage;
+        }
 
-        string spentTx;
-        string txo = it->value().ToString();
+        // The cursor is the index of the address to continue with and the entry
+        // index of its next TXO (<address index>-<8 digit index>)
+        size_t firstAddress = 0;
+        string firstCursor = "00000001";
+        string cursor = request->get_query_parameter("cursor", "");
+        if(!cursor.empty()) {
+            size_t separator = cursor.find('-');
+            if(separator == string::npos || separator == 0 || separator > 4 || cursor.size() != separator + 9 ||
+                    cursor.find_first_not_of("0123456789-") != string::npos || cursor.find('-', separator + 1) != string::npos ||
+                    stoull(cursor.substr(0, separator)) >= addresses.size()) {
+                respond(session, 400, "Invalid cursor");
+                return;
+            }
+            firstAddress = stoull(cursor.substr(0, separator));
+            firstCursor = cursor.substr(separator + 1);
+        }
 
-        leveldb::Status s = this->db->Get(leveldb::ReadOptions(), "txo-" + txo.substr(0,64) + "-" + txo.substr(64,8) + "-spent", &spentTx);
-        long long block = stoll(txo.substr(72,8));
-
-        stringstream ssBlockTimeHeightKey;
-        string blockTimeStr;
-        ssBlockTimeHeightKey << "block-time-" << setw(8) << setfill('0') << block;
-        this->db->Get(leveldb::ReadOptions(), ssBlockTimeHeightKey.str(), &blockTimeStr);
-
-        const long long blockTime = stoll(blockTimeStr);
-
-        // If the block count param is greater than 2000/1/1 consider
-        // it as a timestamp rather than block height
-        const long long blockTimeCrossover = 946702800;
-
-        if((block >= sinceBlock && sinceBlock < blockTimeCrossover) || 
-           (blockTime >= sinceBlock && sinceBlock >= blockTimeCrossover)) {
-            json txoObj;
-            txoObj["height"] = block;
-            txoObj["time"] = blockTime;
-
-            if(!s.ok()) {
-                if(unconfirmed) {
-                    string spender = mempoolMonitor->outpointSpend(txo.substr(0,64), stol(txo.substr(64,8)));
-                    if(spender.compare("") == 0) {
-                        txoObj["spender"] = nullptr;
-                    } else {
-                        if(unspent == 1) continue;
-                        txoObj["spender"] = spender;
+        shared_ptr<VtcBlockIndexer::ReadContext> reads = make_shared<VtcBlockIndexer::ReadContext>(this->database);
+        vector<string> scriptIds;
+        vector<VtcBlockIndexer::AddressTxoScan> scans(addresses.size());
+        for(size_t i = 0; i < addresses.size(); i++) {
+            VtcBlockIndexer::AddressTxoScan& scan = scans[i];
+            scan.scriptId = Utility::addressToScriptId(addresses[i].first);
+            scan.sinceBlock = addresses[i].second;
+            scan.txHashOnly = stoi(request->get_query_parameter("txHashOnly","0"));
+            scan.raw = stoi(request->get_query_parameter("raw","0"));
+            scan.unspent = stoi(request->get_query_parameter("unspent","0"));
+            scan.unconfirmed = stoi(request->get_query_parameter("unconfirmed","0"));
+            scan.scripts = stoi(request->get_query_parameter("script","0"));
+            scan.limit = 0;
+            scan.returned = 0;
+            scan.reads = reads;
+            scan.request = requestState;
+            scan.endKey = scan.scriptId + "-txo-99999999";
+            scriptIds.push_back(scan.scriptId);
+        }
+
+        vector<size_t> order = sortByScriptId(scriptIds);
+        vector<json> txos(addresses.size(), json::array());
+        vector<string> nextCursors(addresses.size());
+        vector<string> errors(addresses.size());
+        atomic<size_t> pageTxos(0);
+        runInChunks(order.size(), minAddressesPerChunk, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                VtcBlockIndexer::AddressTxoScan& scan = scans[order[i]];
+                if(scan.scriptId.empty() || order[i] < firstAddress) continue;
+                scan.it.reset(new VtcBlockIndexer::ReadContext::Iterator(reads->iterator(STORE_ADDRESSES)));
+                (*scan.it)->Seek(scan.scriptId + "-txo-" + (order[i] == firstAddress ? firstCursor : "00000001"));
+
+                // Addresses are read in parallel until the page is full. The first one
+                // always gets a read, so every page makes progress
+                vector<VtcBlockIndexer::AddressTxo> entries;
+                for(bool first = (order[i] == firstAddress); first || pageTxos.load() < pageLimit; first = false) {
+                    size_t before = entries.size();
+                    if(!readAddressTxos(scan, txosPerRead, entries, errors[order[i]])) break;
+                    pageTxos += entries.size() - before;
+                    if(getAddressTxosCursor(scan).empty()) break;
+                }
+                nextCursors[order[i]] = getAddressTxosCursor(scan);
+                bool complete = nextCursors[order[i]].empty();
+                scan.it.reset();
+                for(const VtcBlockIndexer::AddressTxo& txo : entries) {
+                    txos[order[i]].push_back(addressTxoToJson(scan, txo));
+                }
+                if(complete && scan.unconfirmed == 1) {
+                    for(const json& txoObj : getMempoolAddressTxos(scan.scriptId)) {
+                        txos[order[i]].push_back(txoObj);
                     }
-                } else { 
-                    txoObj["spender"] = nullptr;
                 }
-            } else {
-                if(unspent == 1) continue;
-                txoObj["spender"] = spentTx.substr(64, 64);
-
             }
+        });
 
-            if(raw != 0) {
-                try {
-                    const Json::Value tx = vertcoind->getrawtransaction(txo.substr(0,64), false);
-                    txoObj["tx"] = tx.asString();
-                } catch(const jsonrpc::JsonRpcException& e) {
-                    const std::string message(e.what());
-                    session->close(400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
-                    cout << "Not found " << message << endl;
-                    return;
-                }
+        // The page ends at the first address that wasn't read completely
+        json output = json::array();
+        json::array_t& merged = output.get_ref<json::array_t&>();
+        string nextCursor;
+        for(size_t i = firstAddress; i < addresses.size(); i++) {
+            if(!errors[i].empty()) {
+                respond(session, failureStatus(requestState), errors[i]);
+                return;
+            }
+            for(json& txoObj : txos[i]) {
+                txoObj["address"] = addresses[i].first;
+                merged.push_back(std::move(txoObj));
+            }
+            if(!nextCursors[i].empty()) {
+                nextCursor = std::to_string(i) + "-" + nextCursors[i];
+                break;
             }
+        }
 
-            if(raw == 0 && scripts != 0) {
-                 try {
-                    const Json::Value tx = vertcoind->getrawtransaction(txo.substr(0,64), true);
-                    const Json::Value scriptHex = tx["vout"][stoi(txo.substr(64,8))]["scriptPubKey"]["hex"];
-                    txoObj["script"] = scriptHex.asString();
-                } catch(const jsonrpc::JsonRpcException& e) {
-                    const std::string message(e.what());
-                    session->close(400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
-                    cout << "Not found " << message << endl;
-                    return;
-                }
+        if(sortByHeight) {
+            // Mempool TXOs have no height yet, they go last
+            std::stable_sort(merged.begin(), merged.end(), [](const json& a, const json& b) {
+                long long heightA = (a.find("height") != a.end() ? a.at("height").get<long long>() : std::numeric_limits<long long>::max());
+                long long heightB = (b.find("height") != b.end() ? b.at("height").get<long long>() : std::numeric_limits<long long>::max());
+                return heightA < heightB;
+            });
+        }
+
+        multimap<string, string> headers;
+        if(!nextCursor.empty()) {
+            headers.insert({ "X-Next-Cursor", nextCursor });
+        }
+        respondJson(session, OK, output, headers);
+    } );
+}
+
+uint32_t VtcBlockIndexer::HttpServer::scanXpubChain(VtcBlockIndexer::ReadContext& reads, VtcBlockIndexer::RequestState& request, const VtcBlockIndexer::ExtendedPubKey& xpub, uint32_t chain, unsigned char scriptIdType, uint32_t gapLimit, vector<VtcBlockIndexer::XpubAddress>& used, bool& truncated) {
+    // Upper bound on the addresses derived per chain, so one request can't keep a worker busy forever
+    const uint32_t maxAddressesPerChain = 10000;
+
+    VtcBlockIndexer::ExtendedPubKey chainKey;
+    if(!Utility::deriveChildPubKey(xpub, chain, chainKey)) {
+        return 0;
+    }
+
+    uint32_t next = 0;
+    uint32_t derived = 0;
+    while(derived < next + gapLimit && derived < maxAddressesPerChain && !request.stopped()) {
+        // Look up every address that could still fall within the gap at once
+        uint32_t batchEnd = std::min(next + gapLimit, maxAddressesPerChain);
+        size_t count = batchEnd - derived;
+        vector<string> scriptIds(count);
+        vector<VtcBlockIndexer::AddressBalance> balances(count);
+        runInChunks(count, minAddressesPerChunk, [&](size_t begin, size_t end) {
+            for(size_t i = begin; i < end; i++) {
+                VtcBlockIndexer::ExtendedPubKey child;
+                if(!Utility::deriveChildPubKey(chainKey, derived + i, child)) continue;
+                scriptIds[i] = Utility::publicKeyToScriptId(child.publicKey, scriptIdType);
+                balances[i] = getAddressBalance(reads, request, scriptIds[i]);
             }
+        });
+
+        for(size_t i = 0; i < count; i++) {
+            if(scriptIds[i].empty() || balances[i].txoCount == 0) continue;
+            VtcBlockIndexer::XpubAddress address;
+            address.chain = chain;
+            address.index = derived + i;
+            address.scriptId = scriptIds[i];
+            address.balance = balances[i];
+            used.push_back(address);
+            next = address.index + 1;
+        }
+        derived = batchEnd;
+    }
+
+    // The cap was reached before gapLimit unused addresses in a row
+    truncated = (derived < next + gapLimit && derived >= maxAddressesPerChain);
+    return next;
+}
 
-           
+void VtcBlockIndexer::HttpServer::xpubScan( const shared_ptr< Session > session )
+{
+    // Wallets use 20 by default (BIP44), larger gaps are allowed up to this
+    const uint32_t maxGapLimit = 1000;
 
-            if(raw != 0 && txoObj["spender"].is_string()) {
-                try {
-                    const Json::Value tx = vertcoind->getrawtransaction(txoObj["spender"].get<string>(), false);
-                    txoObj["spender"] = tx.asString();
-                } catch(const jsonrpc::JsonRpcException& e) {
-                    const std::string message(e.what());
-                    session->close(400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
-                    cout << "Not found " << message << endl;
-                    return;
+    const auto request = session->get_request( );
+
+    VtcBlockIndexer::ExtendedPubKey xpub;
+    if(!Utility::decodeExtendedPubKey(request->get_path_parameter( "xpub" ), xpub)) {
+        respond(session, 400, "Invalid extended public key");
+        return;
+    }
+
+    // Without an explicit type, use the one the version bytes (xpub, ypub, zpub) imply
+    string type = request->get_query_parameter("type", "");
+    if(type.empty()) {
+        if(xpub.version == 0x049D7CB2) {
+            type = "p2sh-p2wpkh";
+        } else if(xpub.version == 0x04B24746) {
+            type = "p2wpkh";
+        } else {
+            type = "p2pkh";
+        }
+    }
+    unsigned char scriptIdType;
+    if(type == "p2pkh") {
+        scriptIdType = SCRIPT_ID_P2PKH;
+    } else if(type == "p2sh-p2wpkh") {
+        scriptIdType = SCRIPT_ID_P2SH;
+    } else if(type == "p2wpkh") {
+        scriptIdType = SCRIPT_ID_P2WPKH;
+    } else {
+        respond(session, 400, "Unknown type, expected p2pkh, p2sh-p2wpkh or p2wpkh");
+        return;
+    }
+
+    uint32_t gapLimit = (uint32_t)std::min<unsigned long long>(stoull(request->get_query_parameter("gap", "20")), maxGapLimit + 1);
+    if(gapLimit == 0 || gapLimit > maxGapLimit) {
+        respond(session, 400, "The gap limit must be between 1 and " + std::to_string(maxGapLimit));
+        return;
+    }
+
+    VTC_LOG(LOG_LEVEL_DEBUG, "Scanning " << type << " extended public key");
+
+    shared_ptr<VtcBlockIndexer::RequestState> requestState = RequestState::current();
+    shared_ptr<VtcBlockIndexer::ReadContext> reads = make_shared<VtcBlockIndexer::ReadContext>(this->database);
+    vector<VtcBlockIndexer::XpubAddress> used;
+    bool receiveTruncated = false;
+    bool changeTruncated = false;
+    uint32_t nextReceiveIndex = scanXpubChain(*reads, *requestState, xpub, 0, scriptIdType, gapLimit, used, receiveTruncated);
+    uint32_t nextChangeIndex = scanXpubChain(*reads, *requestState, xpub, 1, scriptIdType, gapLimit, used, changeTruncated);
+
+    // Read the UTXOs of the used addresses, including the mempool
+    vector<json> utxos(used.size(), json::array());
+    runInChunks(used.size(), minAddressesPerChunk, [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; i++) {
+            VtcBlockIndexer::AddressTxoScan scan;
+            scan.scriptId = used[i].scriptId;
+            scan.sinceBlock = 0;
+            scan.txHashOnly = 0;
+            scan.raw = 0;
+            scan.unspent = 1;
+            scan.unconfirmed = 1;
+            scan.scripts = 0;
+            scan.limit = 0;
+            scan.returned = 0;
+            scan.reads = reads;
+            scan.request = requestState;
+            scan.endKey = scan.scriptId + "-txo-99999999";
+            scan.it.reset(new VtcBlockIndexer::ReadContext::Iterator(reads->iterator(STORE_ADDRESSES)));
+            (*scan.it)->Seek(scan.scriptId + "-txo-00000001");
+            string error;
+            vector<VtcBlockIndexer::AddressTxo> entries;
+            readAddressTxos(scan, std::numeric_limits<size_t>::max(), entries, error);
+            scan.it.reset();
+            for(const VtcBlockIndexer::AddressTxo& txo : entries) {
+                utxos[i].push_back(addressTxoToJson(scan, txo));
+            }
+            for(const json& txoObj : getMempoolAddressTxos(scan.scriptId)) {
+                if(txoObj.at("spender").is_null()) {
+                    utxos[i].push_back(txoObj);
                 }
             }
+        }
+    });
 
-            if(raw == 0) {
-                txoObj["txhash"] = txo.substr(0,64);
-            }
-            if(txHashOnly == 0 && raw == 0) {
-                txoObj["vout"] = stoll(txo.substr(64,8));
-                txoObj["value"] = stoll(txo.substr(80));
+    // A partial scan would report a wrong balance and next indexes
+    if(requestState->stopped()) {
+        respond(session, SERVICE_UNAVAILABLE, requestState->getStopReason());
+        return;
+    }
+
+    json output;
+    json addresses = json::array();
+    json allUtxos = json::array();
+    long long balance = 0;
+    long long unconfirmedBalance = 0;
+    for(size_t i = 0; i < used.size(); i++) {
+        string address = Utility::scriptIdToAddress(used[i].scriptId);
+        string path = "m/" + std::to_string(used[i].chain) + "/" + std::to_string(used[i].index);
+        json j = addressBalanceToJson(used[i].balance);
+        j["address"] = address;
+        j["path"] = path;
+        addresses.push_back(j);
+        balance += used[i].balance.balance;
+        unconfirmedBalance += used[i].balance.unconfirmedBalance;
+        for(json& txoObj : utxos[i]) {
+            txoObj["address"] = address;
+            txoObj["path"] = path;
+            allUtxos.push_back(std::move(txoObj));
+        }
+    }
+    output["type"] = type;
+    output["balance"] = balance;
+    output["unconfirmedBalance"] = unconfirmedBalance;
+    output["nextReceiveIndex"] = nextReceiveIndex;
+    output["nextChangeIndex"] = nextChangeIndex;
+    // Set when a chain has more used addresses than are scanned. The balance and
+    // next indexes then only cover the scanned part
+    output["truncated"] = receiveTruncated || changeTruncated;
+    output["addresses"] = addresses;
+    output["utxos"] = allUtxos;
+
+    VTC_LOG(LOG_LEVEL_DEBUG, "Found " << used.size() << " used addresses - Balance is " << balance);
+
+    respondJson(session, OK, output);
+}
+
+bool VtcBlockIndexer::HttpServer::readAddressTxo(VtcBlockIndexer::AddressTxoScan& scan, const string& txo, VtcBlockIndexer::AddressTxo& result, string& error) {
+    VtcBlockIndexer::ReadContext& reads = *scan.reads;
+    string spentTx;
+
+    // Skip outputs of a block that is still being indexed
+    if(stoll(txo.substr(72,8)) > reads.getTipHeight()) return false;
+
+    leveldb::Status s = reads.get(STORE_SPENT, "txo-" + txo.substr(0,64) + "-" + txo.substr(64,8) + "-spent", &spentTx);
+    long long block = stoll(txo.substr(72,8));
+
+    stringstream ssBlockTimeHeightKey;
+    string blockTimeStr;
+    ssBlockTimeHeightKey << "block-time-" << setw(8) << setfill('0') << block;
+    reads.get(STORE_CHAIN, ssBlockTimeHeightKey.str(), &blockTimeStr);
+
+    const long long blockTime = stoll(blockTimeStr);
+
+    // If the block count param is greater than 2000/1/1 consider
+    // it as a timestamp rather than block height
+    const long long blockTimeCrossover = 946702800;
+
+    if(!((block >= scan.sinceBlock && scan.sinceBlock < blockTimeCrossover) || 
+         (blockTime >= scan.sinceBlock && scan.sinceBlock >= blockTimeCrossover))) {
+        return false;
+    }
+
+    result.height = block;
+    result.time = blockTime;
+    result.txHash = txo.substr(0,64);
+    result.vout = stoll(txo.substr(64,8));
+    result.value = stoll(txo.substr(80));
+    result.spender.clear();
+    result.rawTx.clear();
+    result.script.clear();
+
+    if(!s.ok()) {
+        if(scan.unconfirmed) {
+            string spender = mempoolMonitor->outpointSpend(txo.substr(0,64), stol(txo.substr(64,8)));
+            if(spender.compare("") != 0) {
+                if(scan.unspent == 1) return false;
+                result.spender = spender;
             }
+        }
+    } else {
+        if(scan.unspent == 1) return false;
+        result.spender = spentTx.substr(64, 64);
+    }
+
+    return true;
+}
+
+json VtcBlockIndexer::HttpServer::addressTxoToJson(const VtcBlockIndexer::AddressTxoScan& scan, const VtcBlockIndexer::AddressTxo& txo) {
+    json txoObj;
+    txoObj["height"] = txo.height;
+    txoObj["time"] = txo.time;
+    if(txo.spender.empty()) {
+        txoObj["spender"] = nullptr;
+    } else {
+        txoObj["spender"] = txo.spender;
+    }
+    if(scan.raw != 0) {
+        txoObj["tx"] = txo.rawTx;
+    }
+    if(scan.raw == 0 && scan.scripts != 0) {
+        txoObj["script"] = txo.script;
+    }
+    if(scan.raw == 0) {
+        txoObj["txhash"] = txo.txHash;
+    }
+    if(scan.txHashOnly == 0 && scan.raw == 0) {
+        txoObj["vout"] = txo.vout;
+        txoObj["value"] = txo.value;
+    }
+    return txoObj;
+}
 
-            j.push_back(txoObj);
+void VtcBlockIndexer::HttpServer::writeAddressTxo(const VtcBlockIndexer::AddressTxoScan& scan, const VtcBlockIndexer::AddressTxo& txo, VtcBlockIndexer::JsonWriter& writer) {
+    // Keys in sorted order, like json objects keep them
+    writer.beginObject();
+    writer.key("height").value(txo.height);
+    if(scan.raw == 0 && scan.scripts != 0) {
+        writer.key("script").value(txo.script);
+    }
+    writer.key("spender");
+    if(txo.spender.empty()) {
+        writer.null();
+    } else {
+        writer.value(txo.spender);
+    }
+    writer.key("time").value(txo.time);
+    if(scan.raw != 0) {
+        writer.key("tx").value(txo.rawTx);
+    } else {
+        writer.key("txhash").value(txo.txHash);
+        if(scan.txHashOnly == 0) {
+            writer.key("value").value(txo.value);
+            writer.key("vout").value(txo.vout);
+        }
+    }
+    writer.endObject();
+}
+
+bool VtcBlockIndexer::HttpServer::readAddressTxos(VtcBlockIndexer::AddressTxoScan& scan, size_t maxEntries, vector<VtcBlockIndexer::AddressTxo>& entries, string& error) {
+    VtcBlockIndexer::ReadContext::Iterator& it = *scan.it;
+    size_t firstAdded = entries.size();
+    size_t added = 0;
+    while(added < maxEntries && (scan.limit == 0 || scan.returned < scan.limit) && 
+            it->Valid() && it->key().ToString() < scan.endKey) {
+        if(scan.request && scan.request->stopped()) {
+            // A page ends early, the client continues from the cursor
+            if(scan.limit > 0) break;
+            error = scan.request->getStopReason();
+            return false;
+        }
+        VtcBlockIndexer::AddressTxo txo;
+        bool included = readAddressTxo(scan, it->value().ToString(), txo, error);
+        if(!error.empty()) {
+            VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << error);
+            return false;
         }
+        if(included) {
+            entries.push_back(std::move(txo));
+            added++;
+            scan.returned++;
+        }
+        it->Next();
     }
     assert(it->status().ok());  // Check for any errors found during the scan
-    delete it;
-
-    if(unconfirmed == 1) {
-        // Add mempool transactions
-        vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(request->get_path_parameter( "address" ));
-        for (VtcBlockIndexer::TransactionOutput txo : mempoolOutputs) {
-            json txoObj;
-            txoObj["txhash"] = txo.txHash;
-            txoObj["vout"] = txo.index;
-            txoObj["value"] = txo.value;
-            txoObj["block"] = 0;
-            string spender = mempoolMonitor->outpointSpend(txo.txHash, txo.index);
-            if(spender.compare("") != 0) {
-                txoObj["spender"] = spender;
+
+    if(scan.raw == 0 && scan.scripts != 0) {
+        // Read the scripts from the block files, transactions that can't be read from
+        // there are fetched from the node together
+        vector<size_t> unread;
+        vector<string> unreadTxids;
+        for(size_t i = firstAdded; i < entries.size(); i++) {
+            VtcBlockIndexer::Transaction tx;
+            vector<unsigned char> rawTx;
+            if(readIndexedTransaction(*scan.reads, entries[i].txHash, tx, rawTx) && (size_t)entries[i].vout < tx.outputs.size()) {
+                entries[i].script = Utility::hashToHex(tx.outputs.at(entries[i].vout).script);
             } else {
-                txoObj["spender"] = nullptr;
+                unread.push_back(i);
+                unreadTxids.push_back(entries[i].txHash);
+            }
+        }
+        vector<string> hexes;
+        vector<string> errors;
+        getRawTransactionHexes(*scan.reads, unreadTxids, hexes, errors);
+        for(size_t i = 0; i < unread.size(); i++) {
+            VtcBlockIndexer::AddressTxo& entry = entries[unread[i]];
+            if(!errors[i].empty()) {
+                error = errors[i];
+                VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << error);
+                return false;
+            }
+            vector<unsigned char> rawTx = Utility::hexToBytes(hexes[i]);
+            VtcBlockIndexer::Transaction tx;
+            if(rawTx.size() > 0) {
+                byte_array_buffer streambuf(&rawTx[0], rawTx.size());
+                std::istream stream(&streambuf);
+                tx = this->blockReader->readTransaction(stream);
             }
-            j.push_back(txoObj);
+            if(tx.txHash != entry.txHash || (size_t)entry.vout >= tx.outputs.size()) {
+                error = "Transaction " + entry.txHash + " could not be read";
+                return false;
+            }
+            entry.script = Utility::hashToHex(tx.outputs.at(entry.vout).script);
+        }
+    }
+
+    if(scan.raw != 0) {
+        // Fetch the transactions and their spenders together, the ones that aren't
+        // indexed yet go to the node in one batch
+        vector<string> txids;
+        for(size_t i = firstAdded; i < entries.size(); i++) {
+            txids.push_back(entries[i].txHash);
+            if(!entries[i].spender.empty()) {
+                txids.push_back(entries[i].spender);
+            }
+        }
+        vector<string> hexes;
+        vector<string> errors;
+        getRawTransactionHexes(*scan.reads, txids, hexes, errors);
+        size_t next = 0;
+        for(size_t i = firstAdded; i < entries.size(); i++) {
+            if(!errors[next].empty()) {
+                error = errors[next];
+                VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << error);
+                return false;
+            }
+            entries[i].rawTx = hexes[next++];
+            if(!entries[i].spender.empty()) {
+                if(!errors[next].empty()) {
+                    error = errors[next];
+                    VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << error);
+                    return false;
+                }
+                entries[i].spender = hexes[next++];
+            }
+        }
+    }
+    return true;
+}
+
+string VtcBlockIndexer::HttpServer::getAddressTxosCursor(VtcBlockIndexer::AddressTxoScan& scan) {
+    VtcBlockIndexer::ReadContext::Iterator& it = *scan.it;
+    if(!it->Valid() || it->key().ToString() >= scan.endKey) {
+        return "";
+    }
+    // The cursor is the entry index of the next key (<scriptId>-txo-<index>)
+    string key = it->key().ToString();
+    return key.substr(key.size() - 8);
+}
+
+json VtcBlockIndexer::HttpServer::getMempoolAddressTxos(const string& scriptId) {
+    json j = json::array();
+    vector<VtcBlockIndexer::TransactionOutput> mempoolOutputs = mempoolMonitor->getTxos(scriptId);
+    for (VtcBlockIndexer::TransactionOutput txo : mempoolOutputs) {
+        json txoObj;
+        txoObj["txhash"] = txo.txHash;
+        txoObj["vout"] = txo.index;
+        txoObj["value"] = txo.value;
+        txoObj["block"] = 0;
+        string spender = mempoolMonitor->outpointSpend(txo.txHash, txo.index);
+        if(spender.compare("") != 0) {
+            txoObj["spender"] = spender;
+        } else {
+            txoObj["spender"] = nullptr;
+        }
+        j.push_back(txoObj);
+    }
+    return j;
+}
+
+void VtcBlockIndexer::HttpServer::addressTxos( const shared_ptr< Session > session )
+{
+    shared_ptr<VtcBlockIndexer::AddressTxoScan> scan = make_shared<VtcBlockIndexer::AddressTxoScan>();
+
+    const auto request = session->get_request( );
+
+    scan->sinceBlock = stoll(request->get_path_parameter( "sinceBlock", "0" ));
+    
+    scan->txHashOnly = stoi(request->get_query_parameter("txHashOnly","0"));
+    scan->raw = stoi(request->get_query_parameter("raw","0"));
+    scan->unspent = stoi(request->get_query_parameter("unspent","0"));
+    scan->unconfirmed = stoi(request->get_query_parameter("unconfirmed","0"));
+    scan->scripts = stoi(request->get_query_parameter("script","0"));
+    scan->limit = stoull(request->get_query_parameter("limit","0"));
+    scan->returned = 0;
+    scan->request = RequestState::current();
+    int stream = stoi(request->get_query_parameter("stream","0"));
+    string cursor = request->get_query_parameter("cursor","00000001");
+    VTC_LOG(LOG_LEVEL_DEBUG, "Fetching address txos for address " << request->get_path_parameter( "address" ));
+
+    if(cursor.size() != 8 || cursor.find_first_not_of("0123456789") != string::npos) {
+        respond(session, 400, "Invalid cursor");
+        return;
+    }
+   
+    // Index keys use the script identifier, decode the address once
+    scan->scriptId = Utility::addressToScriptId(request->get_path_parameter( "address" ));
+    scan->endKey = scan->scriptId + "-txo-99999999";
+    scan->reads.reset(new VtcBlockIndexer::ReadContext(this->database));
+    scan->it.reset(new VtcBlockIndexer::ReadContext::Iterator(scan->reads->iterator(STORE_ADDRESSES)));
+    if(scan->scriptId.size() > 0) {
+        (*scan->it)->Seek(scan->scriptId + "-txo-" + cursor);
+    }
+
+    if(stream != 0) {
+        // Send the headers now and the TXOs in chunks while iterating. The
+        // cursor for the next page is only known at the end, it is sent as a trailer.
+        // Streams are always JSON, whatever encoding the Accept header asks for.
+        scan->keepAlive = keepAlive(session);
+        scan->streamed = 0;
+        multimap<string, string> headers = {
+            { "Content-Type", "application/json" },
+            { "Transfer-Encoding", "chunked" },
+            { "Trailer", "X-Next-Cursor" },
+            { "Connection", scan->keepAlive ? "keep-alive" : "close" }
+        };
+        session->yield(OK, headers, [this, scan](const shared_ptr<Session> session) {
+            streamAddressTxos(session, scan);
+        });
+        return;
+    }
+
+    vector<VtcBlockIndexer::AddressTxo> txos;
+    string error;
+    if(!readAddressTxos(*scan, std::numeric_limits<size_t>::max(), txos, error)) {
+        respond(session, failureStatus(scan->request), error);
+        return;
+    }
+
+    string& body = JsonWriter::threadBuffer();
+    json tree;
+    JsonWriter writer = createWriter(session, body, tree);
+    writer.beginArray();
+    for(const VtcBlockIndexer::AddressTxo& txo : txos) {
+        writeAddressTxo(*scan, txo, writer);
+    }
+    string nextCursor = getAddressTxosCursor(*scan);
+    if(nextCursor.empty() && scan->unconfirmed == 1) {
+        // Add mempool transactions to the last page
+        for(const json& txoObj : getMempoolAddressTxos(scan->scriptId)) {
+            writer.value(txoObj);
         }
     }
+    writer.endArray();
+
+    multimap<string, string> headers;
+    if(!nextCursor.empty()) {
+        headers.insert({ "X-Next-Cursor", nextCursor });
+    }
 
-    string body = j.dump();
-     
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respondWritten(session, OK, writer, headers);
+}
+
+void VtcBlockIndexer::HttpServer::streamAddressTxos(const shared_ptr<Session> session, shared_ptr<VtcBlockIndexer::AddressTxoScan> scan) {
+    // TXOs per chunk, so the memory used by a stream stays bounded
+    const size_t txosPerChunk = 100;
+
+    vector<VtcBlockIndexer::AddressTxo> entries;
+    string error;
+    if(!readAddressTxos(*scan, txosPerChunk, entries, error)) {
+        // The status has been sent already, cut the stream short so the client
+        // sees an incomplete response
+        session->close();
+        return;
+    }
+
+    string nextCursor = getAddressTxosCursor(*scan);
+    bool finished = (entries.size() < txosPerChunk || (scan->limit > 0 && scan->returned >= scan->limit));
+
+    // The writer only sees this chunk, so the array brackets and the commas
+    // between chunks are added here
+    string& chunk = JsonWriter::threadBuffer();
+    if(scan->streamed == 0) chunk += "[";
+    for(const VtcBlockIndexer::AddressTxo& txo : entries) {
+        if(scan->streamed++ > 0) chunk += ",";
+        JsonWriter writer(chunk);
+        writeAddressTxo(*scan, txo, writer);
+    }
+    if(finished && nextCursor.empty() && scan->unconfirmed == 1) {
+        for(const json& txoObj : getMempoolAddressTxos(scan->scriptId)) {
+            if(scan->streamed++ > 0) chunk += ",";
+            chunk += txoObj.dump();
+        }
+    }
+    if(finished) {
+        chunk += "]";
+    }
+
+    stringstream encoded;
+    encoded << std::hex << chunk.size() << "\r\n" << chunk << "\r\n";
+    if(!finished) {
+        session->yield(encoded.str(), [this, scan](const shared_ptr<Session> session) {
+            streamAddressTxos(session, scan);
+        });
+        return;
+    }
+
+    // Last chunk and the trailer with the cursor of the next page
+    encoded << "0\r\n";
+    if(!nextCursor.empty()) {
+        encoded << "X-Next-Cursor: " << nextCursor << "\r\n";
+    }
+    encoded << "\r\n";
+
+    // Release the snapshots and the request's slot before the connection waits
+    // for its next request
+    scan->it.reset();
+    scan->reads.reset();
+    scan->request.reset();
+    if(scan->keepAlive) {
+        session->yield(encoded.str());
+    } else {
+        session->close(encoded.str());
+    }
 }
 
 void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > session )
 {
+    VtcBlockIndexer::ReadContext reads(this->database);
     json j;
     j["error"] = false;
     const auto request = session->get_request( );
@@ -776,7 +2077,7 @@ void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > ses
     stringstream txBlockKey;
     string txBlock;
     txBlockKey << "tx-" << txid << "-block";
-    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txBlockKey.str(), &txBlock);
+    leveldb::Status s = reads.get(STORE_TXS, txBlockKey.str(), &txBlock);
     if(!s.ok()) {
         j["error"] = true;
         j["errorDescription"] = "Transaction ID not found";
@@ -787,7 +2088,7 @@ void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > ses
         txoId << "txo-" << txid << "-" << setw(8) << setfill('0') << vout << "-spent";
         string spentTx;
 
-        s = this->db->Get(leveldb::ReadOptions(), txoId.str(), &spentTx);
+        s = reads.get(STORE_SPENT, txoId.str(), &spentTx);
         j["spent"] = s.ok();
         if(s.ok()) {
             j["spender"] = spentTx.substr(64, 64);
@@ -795,7 +2096,7 @@ void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > ses
             string blockHeightStr;
             stringstream blockHashId;
             blockHashId << "block-hash-" << spentTx.substr(0,64);
-            s = this->db->Get(leveldb::ReadOptions(), blockHashId.str(), &blockHeightStr);
+            s = reads.get(STORE_CHAIN, blockHashId.str(), &blockHeightStr);
             if(s.ok()) {
                 j["height"] = stol(blockHeightStr);
             }
@@ -809,16 +2110,16 @@ void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > ses
         }
 
         if(raw != 0 && j["spender"].is_string()) {
-            try {
-                const Json::Value tx = vertcoind->getrawtransaction(j["spender"].get<string>(), false);
-                j["spenderRaw"] = tx.asString();
-                j["spender"] = nullptr;
-            } catch(const jsonrpc::JsonRpcException& e) {
-                const std::string message(e.what());
-                session->close(400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
-                cout << "Not found " << message << endl;
+            vector<string> hexes;
+            vector<string> errors;
+            getRawTransactionHexes(reads, { j["spender"].get<string>() }, hexes, errors);
+            if(!errors[0].empty()) {
+                respond(session, 400, errors[0]);
+                VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << errors[0]);
                 return;
             }
+            j["spenderRaw"] = hexes[0];
+            j["spender"] = nullptr;
         }
 
 
@@ -826,9 +2127,7 @@ void VtcBlockIndexer::HttpServer::outpointSpend( const shared_ptr< Session > ses
 
     }
    
-    string body = j.dump();
-     
-    session->close( OK, body, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(body.size()) } } );
+    respondJson(session, OK, j);
 } 
 
 
@@ -840,8 +2139,11 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
     
     
     
-    session->fetch( content_length, [ request, this ]( const shared_ptr< Session > session, const Bytes & body )
+    // The body may arrive after the handler returned, keep the request's slot until it is handled
+    shared_ptr<VtcBlockIndexer::RequestState> requestState = RequestState::current();
+    session->fetch( content_length, [ request, requestState, this ]( const shared_ptr< Session > session, const Bytes & body )
     {
+        VtcBlockIndexer::ReadContext reads(this->database);
         const auto request = session->get_request( );
         int raw = stoi(request->get_query_parameter("raw","0"));
         int unconfirmed = stoi(request->get_query_parameter("unconfirmed","0"));
@@ -852,10 +2154,14 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
         json input = json::parse(content);
         if(!input.is_null()) {
             for (auto& txo : input) {
+                if(requestState->stopped()) {
+                    respond(session, SERVICE_UNAVAILABLE, requestState->getStopReason());
+                    return;
+                }
                 if(txo.is_object() && txo["txid"].is_string() && txo["vout"].is_number()) {
                     stringstream txoId;
                     txoId << "txo-" << txo["txid"].get<string>() << "-" << setw(8) << setfill('0') << txo["vout"].get<int>() << "-spent";
-                    cout << "Checking outpoint spent " << txoId.str() << endl;
+                    VTC_LOG(LOG_LEVEL_DEBUG, "Checking outpoint spent " << txoId.str());
             
                     json j;
                     j["txid"] = txo["txid"];
@@ -864,7 +2170,7 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
                     stringstream txBlockKey;
                     string txBlock;
                     txBlockKey << "tx-" << txo["txid"].get<string>() << "-block";
-                    leveldb::Status s = this->db->Get(leveldb::ReadOptions(), txBlockKey.str(), &txBlock);
+                    leveldb::Status s = reads.get(STORE_TXS, txBlockKey.str(), &txBlock);
                     if(!s.ok()) {
                         j["error"] = true;
                         j["errorDescription"] = "Transaction ID not found";
@@ -872,14 +2178,14 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
                     else 
                     {
                         string spentTx;
-                        s = this->db->Get(leveldb::ReadOptions(), txoId.str(), &spentTx);
+                        s = reads.get(STORE_SPENT, txoId.str(), &spentTx);
                         if(s.ok()) {
                             j["spender"] = spentTx.substr(64, 64);
                             j["spent"] = true;
                             string blockHeightStr;
                             stringstream blockHashId;
                             blockHashId << "block-hash-" << spentTx.substr(0,64);
-                            s = this->db->Get(leveldb::ReadOptions(), blockHashId.str(), &blockHeightStr);
+                            s = reads.get(STORE_CHAIN, blockHashId.str(), &blockHeightStr);
                             if(s.ok()) {
                                 j["height"] = stol(blockHeightStr);
                             }   
@@ -896,25 +2202,36 @@ void VtcBlockIndexer::HttpServer::outpointSpends( const shared_ptr< Session > se
                         }
                     }
 
-                    if(raw != 0 && j["spender"].is_string()) {
-                        try {
-                            const Json::Value tx = vertcoind->getrawtransaction(j["spender"].get<string>(), false);
-                            j["spenderRaw"] = tx.asString();
-                            j["spender"] = nullptr;
-                        } catch(const jsonrpc::JsonRpcException& e) {
-                            const std::string message(e.what());
-                            cout << "Not found " << message << endl;
-                        }
-                    }
-
                     output.push_back(j);
                     
                 }
             }
         }
+
+        if(raw != 0) {
+            // Fetch all spenders at once, the unconfirmed ones go to the node in one batch
+            vector<size_t> spent;
+            vector<string> spenders;
+            for(size_t i = 0; i < output.size(); i++) {
+                if(output[i]["spender"].is_string()) {
+                    spent.push_back(i);
+                    spenders.push_back(output[i]["spender"].get<string>());
+                }
+            }
+            vector<string> hexes;
+            vector<string> errors;
+            getRawTransactionHexes(reads, spenders, hexes, errors);
+            for(size_t i = 0; i < spent.size(); i++) {
+                if(!errors[i].empty()) {
+                    VTC_LOG(LOG_LEVEL_DEBUG, "Not found " << errors[i]);
+                    continue;
+                }
+                output[spent[i]]["spenderRaw"] = hexes[i];
+                output[spent[i]]["spender"] = nullptr;
+            }
+        }
     
-        string resultBody = output.dump();
-        session->close( OK, resultBody, { { "Content-Type",  "application/json" }, { "Content-Length",  std::to_string(resultBody.size()) } } );
+        respondJson(session, OK, output);
     } );
 } 
 
@@ -922,94 +2239,137 @@ void VtcBlockIndexer::HttpServer::sendRawTransaction( const shared_ptr< Session
 {
     const auto request = session->get_request( );
     const size_t content_length = request->get_header( "Content-Length", 0);
-    session->fetch( content_length, [ request, this ]( const shared_ptr< Session > session, const Bytes & body )
+
+    // The body may arrive after the handler returned, keep the request until it is handled
+    shared_ptr<VtcBlockIndexer::RequestState> requestState = RequestState::current();
+    session->fetch( content_length, [ request, requestState, this ]( const shared_ptr< Session > session, const Bytes & body )
     {
         const string rawtx = string(body.begin(), body.end());
         
         try {
-            const auto txid = vertcoind->sendrawtransaction(rawtx);
+            Json::Value params;
+            params.append(rawtx);
+            const Json::Value txid = rpc->call("sendrawtransaction", params).get();
+            if(!txid.isString()) {
+                throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, txid.toStyledString());
+            }
             
-            session->close(OK, txid, {{"Content-Type","text/plain"}, {"Content-Length",  std::to_string(txid.size())}});
+            respond(session, OK, txid.asString());
         } catch(const jsonrpc::JsonRpcException& e) {
             const std::string message(e.what());
-            session->close(400, message, {{"Content-Type","text/plain"},{"Content-Length",  std::to_string(message.size())}});
+            respond(session, 400, message);
         }
     });
 } 
 
 void VtcBlockIndexer::HttpServer::run()
 {
+    // Endpoints that iterate address histories or batches are limited, so they
+    // can't occupy all workers and starve the cheap lookups
+    size_t expensiveConcurrency = options.expensiveConcurrency;
+
     auto addressBalanceResource = make_shared< Resource >( );
     addressBalanceResource->set_path( "/addressBalance/{address: .*}" );
-    addressBalanceResource->set_method_handler( "GET", bind( &VtcBlockIndexer::HttpServer::addressBalance, this, std::placeholders::_1) );
+    addressBalanceResource->set_method_handler("GET", route("addressBalance", expensiveConcurrency, bind( &VtcBlockIndexer::HttpServer::addressBalance, this, std::placeholders::_1)) );
+
+    auto addressBalancesResource = make_shared< Resource >( );
+    addressBalancesResource->set_path( "/addressBalances" );
+    addressBalancesResource->set_method_handler("POST", route("addressBalances", expensiveConcurrency, bind( &VtcBlockIndexer::HttpServer::addressBalances, this, std::placeholders::_1)) );
+
+    auto addressesTxosResource = make_shared< Resource >( );
+    addressesTxosResource->set_path( "/addressesTxos" );
+    addressesTxosResource->set_method_handler("POST", route("addressesTxos", expensiveConcurrency, bind( &VtcBlockIndexer::HttpServer::addressesTxos, this, std::placeholders::_1)) );
+
+    auto xpubScanResource = make_shared< Resource >( );
+    xpubScanResource->set_path( "/xpubScan/{xpub: [0-9A-Za-z]*}" );
+    xpubScanResource->set_method_handler("GET", route("xpubScan", expensiveConcurrency, bind( &VtcBlockIndexer::HttpServer::xpubScan, this, std::placeholders::_1)) );
 
     auto addressTxosResource = make_shared< Resource >( );
     addressTxosResource->set_path( "/addressTxos/{address: .*}" );
-    addressTxosResource->set_method_handler( "GET", bind( &VtcBlockIndexer::HttpServer::addressTxos, this, std::placeholders::_1) );
+    addressTxosResource->set_method_handler("GET", route("addressTxos", expensiveConcurrency, bind( &VtcBlockIndexer::HttpServer::addressTxos, this, std::placeholders::_1)) );
 
     auto addressTxosSinceBlockResource = make_shared< Resource >( );
     addressTxosSinceBlockResource->set_path( "/addressTxosSince/{sinceBlock: ^[0-9]*$}/{address: .*}" );
-    addressTxosSinceBlockResource->set_method_handler( "GET", bind( &VtcBlockIndexer::HttpServer::addressTxos, this, std::placeholders::_1) );
+    addressTxosSinceBlockResource->set_method_handler("GET", route("addressTxosSince", expensiveConcurrency, bind( &VtcBlockIndexer::HttpServer::addressTxos, this, std::placeholders::_1)) );
     
     auto getTransactionResource = make_shared<Resource>();
     getTransactionResource->set_path( "/getTransaction/{id: [0-9a-f]*}" );
-    getTransactionResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getTransaction, this, std::placeholders::_1) );
+    getTransactionResource->set_method_handler("GET", route("getTransaction", 0, bind(&VtcBlockIndexer::HttpServer::getTransaction, this, std::placeholders::_1)) );
 
     auto getTransactionProofResource = make_shared<Resource>();
     getTransactionProofResource->set_path( "/getTransactionProof/{id: [0-9a-f]*}" );
-    getTransactionProofResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getTransactionProof, this, std::placeholders::_1) );
+    getTransactionProofResource->set_method_handler("GET", route("getTransactionProof", 0, bind(&VtcBlockIndexer::HttpServer::getTransactionProof, this, std::placeholders::_1)) );
+
+    auto getTransactionProofsResource = make_shared<Resource>();
+    getTransactionProofsResource->set_path( "/getTransactionProofs/{hash: [0-9a-f]*}" );
+    getTransactionProofsResource->set_method_handler("GET", route("getTransactionProofs", 0, bind(&VtcBlockIndexer::HttpServer::getTransactionProofs, this, std::placeholders::_1)) );
 
     auto outpointSpendResource = make_shared<Resource>();
     outpointSpendResource->set_path( "/outpointSpend/{txid: .*}/{vout: .*}" );
-    outpointSpendResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::outpointSpend, this, std::placeholders::_1) );
+    outpointSpendResource->set_method_handler("GET", route("outpointSpend", 0, bind(&VtcBlockIndexer::HttpServer::outpointSpend, this, std::placeholders::_1)) );
 
     auto outpointSpendsResource = make_shared<Resource>();
     outpointSpendsResource->set_path( "/outpointSpends" );
-    outpointSpendsResource->set_method_handler("POST", bind(&VtcBlockIndexer::HttpServer::outpointSpends, this, std::placeholders::_1) );
+    outpointSpendsResource->set_method_handler("POST", route("outpointSpends", expensiveConcurrency, bind(&VtcBlockIndexer::HttpServer::outpointSpends, this, std::placeholders::_1)) );
 
     auto sendRawTransactionResource = make_shared<Resource>();
     sendRawTransactionResource->set_path( "/sendRawTransaction" );
-    sendRawTransactionResource->set_method_handler("POST", bind(&VtcBlockIndexer::HttpServer::sendRawTransaction, this, std::placeholders::_1) );
+    sendRawTransactionResource->set_method_handler("POST", route("sendRawTransaction", 0, bind(&VtcBlockIndexer::HttpServer::sendRawTransaction, this, std::placeholders::_1)) );
 
     auto blocksResource = make_shared<Resource>();
     blocksResource->set_path( "/blocks" );
-    blocksResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getBlocks, this, std::placeholders::_1) );
+    blocksResource->set_method_handler("GET", route("blocks", 0, bind(&VtcBlockIndexer::HttpServer::getBlocks, this, std::placeholders::_1)) );
 
     auto blockResource = make_shared<Resource>();
     blockResource->set_path( "/block/{hash: [0-9a-f]*}" );
-    blockResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getBlock, this, std::placeholders::_1) );
+    blockResource->set_method_handler("GET", route("block", 0, bind(&VtcBlockIndexer::HttpServer::getBlock, this, std::placeholders::_1)) );
 
     auto blockTransactionResource = make_shared<Resource>();
     blockTransactionResource->set_path( "/blocktxs/{hash: [0-9a-f]*}/{page: [0-9]*}" );
-    blockTransactionResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getBlockTransactions, this, std::placeholders::_1) );
+    blockTransactionResource->set_method_handler("GET", route("blocktxs", 0, bind(&VtcBlockIndexer::HttpServer::getBlockTransactions, this, std::placeholders::_1)) );
 
     auto blocksByDateResource = make_shared<Resource>();
     blocksByDateResource->set_path( "/blocksbydate" );
-    blocksByDateResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::getBlocksByDate, this, std::placeholders::_1) );
+    blocksByDateResource->set_method_handler("GET", route("blocksbydate", 0, bind(&VtcBlockIndexer::HttpServer::getBlocksByDate, this, std::placeholders::_1)) );
 
     auto mempoolResource = make_shared<Resource>();
     mempoolResource->set_path( "/mempool" );
-    mempoolResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::mempoolTransactionIds, this, std::placeholders::_1) );
+    mempoolResource->set_method_handler("GET", route("mempool", 0, bind(&VtcBlockIndexer::HttpServer::mempoolTransactionIds, this, std::placeholders::_1)) );
 
 
+    auto subscribeResource = make_shared<Resource>();
+    subscribeResource->set_path( "/subscribe" );
+    subscribeResource->set_method_handler("GET", route("subscribe", 0, bind(&VtcBlockIndexer::HttpServer::subscribe, this, std::placeholders::_1)) );
+
     auto syncResource = make_shared<Resource>();
     syncResource->set_path( "/sync" );
-    syncResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::sync, this, std::placeholders::_1) );
+    syncResource->set_method_handler("GET", route("sync", 0, bind(&VtcBlockIndexer::HttpServer::sync, this, std::placeholders::_1)) );
+
+    auto metricsResource = make_shared<Resource>();
+    metricsResource->set_path( "/metrics" );
+    metricsResource->set_method_handler("GET", bind(&VtcBlockIndexer::HttpServer::metrics, this, std::placeholders::_1) );
 
 
 
 
     auto settings = make_shared< Settings >( );
     settings->set_port( 8888 );
-    settings->set_default_header( "Connection", "close" );
+    settings->set_worker_limit( options.workers );
+    settings->set_connection_timeout( std::chrono::seconds( options.idleTimeout ) );
     settings->set_default_header( "Access-Control-Allow-Origin", "*" );
     
+    VTC_LOG(LOG_LEVEL_INFO, "Serving HTTP requests on " << options.workers << " threads");
+
     Service service;
     service.publish( addressBalanceResource );
+    service.publish( addressBalancesResource );
+    service.publish( addressesTxosResource );
+    service.publish( xpubScanResource );
     service.publish( addressTxosResource );
     service.publish( addressTxosSinceBlockResource );
     service.publish( getTransactionResource );
     service.publish( getTransactionProofResource );
+    service.publish( getTransactionProofsResource );
     service.publish( outpointSpendResource );
     service.publish( outpointSpendsResource );
     service.publish( sendRawTransactionResource );
@@ -1018,6 +2378,8 @@ void VtcBlockIndexer::HttpServer::run()
     service.publish( blocksResource );
     service.publish( blocksByDateResource );
     service.publish( mempoolResource );
+    service.publish( subscribeResource );
     service.publish( syncResource );
+    service.publish( metricsResource );
     service.start( settings );
 }
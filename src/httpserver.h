@@ -1,5 +1,7 @@
 #include <fstream>
 #include <vector>
+#include <mutex>
+#include <map>
 
 /*  VTC Blockindexer - A utility to build additional indexes to the 
     Vertcoin blockchain by scanning and indexing the blockfiles
@@ -22,21 +24,138 @@
 */
 
 #include <restbed>
-#include <jsonrpccpp/client/connectors/httpclient.h>
 
 #include "leveldb/db.h"
 #include "leveldb/write_batch.h"
+#include "database.h"
+#include "readcontext.h"
+#include "responsecache.h"
+#include "merkletree.h"
+#include "responseencoding.h"
+#include "jsonwriter.h"
+#include "metrics.h"
+#include "requestlimiter.h"
 
-#include "vertcoinrpc.h"
+#include "rpcpool.h"
 #include "blockreader.h"
 #include "scriptsolver.h"
 #include "mempoolmonitor.h"
+#include "subscriptions.h"
+#include "chainstate.h"
+#include "utility.h"
+#include "json.hpp"
 
 using namespace std;
 using namespace restbed;
 
 namespace VtcBlockIndexer {
+
+    /**
+     * Settings for the HTTP service
+     */
+    struct HttpServerOptions {
+        // Number of threads handling requests, 0 for one per core
+        unsigned int workers;
+
+        // Seconds a kept-alive connection may sit idle before it is closed
+        unsigned int idleTimeout;
+
+        // Maximum number of connections kept alive at the same time. Requests on
+        // further connections are answered and the connection is closed.
+        unsigned int maxConnections;
+
+        // Bytes of block, block transaction and proof responses kept in memory
+        size_t responseCacheSize;
+
+        // Responses are only cached for blocks with at least this many confirmations
+        unsigned int cacheConfirmations;
+
+        // Bytes of per-block merkle trees kept in memory for transaction proofs
+        size_t merkleCacheSize;
+
+        // Requests handled at the same time per expensive endpoint (address balances and
+        // histories, batches, xpub scans), 0 for a quarter of the workers. Further requests wait
+        // in a queue of requestQueueSize and are rejected with 503 when it is full
+        unsigned int expensiveConcurrency;
+        unsigned int requestQueueSize;
+
+        // Seconds a request may take, including the time it waited in the queue
+        unsigned int requestTimeout;
+    };
     
+    /**
+     * State of an addressTxos request that reads the TXOs of an address in
+     * parts, either a page of them or the chunks of a stream
+     */
+    struct AddressTxoScan {
+        string scriptId;
+        long long sinceBlock;
+        int txHashOnly;
+        int raw;
+        int unspent;
+        int unconfirmed;
+        int scripts;
+
+        // Maximum number of TXOs to return, 0 for all of them
+        size_t limit;
+        size_t returned;
+
+        // The iterator is positioned at the next index entry to read. Entries
+        // of the address end before endKey
+        shared_ptr<ReadContext> reads;
+        unique_ptr<ReadContext::Iterator> it;
+        string endKey;
+
+        // The request the scan is for, to stop at its deadline. When the scan has
+        // a limit, stopping ends the page early with a cursor instead of failing
+        shared_ptr<RequestState> request;
+
+        // Streaming only: TXOs written so far and whether the connection stays open
+        size_t streamed;
+        bool keepAlive;
+    };
+
+    /**
+     * A TXO read by an addressTxos scan, with the fields the scan asked for
+     */
+    struct AddressTxo {
+        long long height;
+        long long time;
+        string txHash;
+        long long vout;
+        long long value;
+
+        // The spending transaction id (raw transaction when the scan is raw), or
+        // empty when unspent
+        string spender;
+
+        // Only set when the scan asks for raw transactions or scripts
+        string rawTx;
+        string script;
+    };
+
+    /**
+     * Balance and transaction counts of an address
+     */
+    struct AddressBalance {
+        long long balance;
+        long long unconfirmedBalance;
+        long long txCount;
+        long long unconfirmedTxCount;
+        int txoCount;
+    };
+
+    /**
+     * A used address found while scanning an extended public key
+     */
+    struct XpubAddress {
+        // Derivation path below the extended public key: chain (0 receive, 1 change) and index
+        uint32_t chain;
+        uint32_t index;
+        string scriptId;
+        AddressBalance balance;
+    };
+
     /**
      * The HttpServer class contains the methods used to run the HTTP public interface for
      * querying the blockchain.
@@ -44,19 +163,96 @@ namespace VtcBlockIndexer {
     
     class HttpServer {
         public:
-            HttpServer(const shared_ptr<leveldb::DB> db, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, string blocksDir);
+            HttpServer(const shared_ptr<VtcBlockIndexer::Database> database, const shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor, const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::ChainState> chainState, const shared_ptr<VtcBlockIndexer::RpcPool> rpc, string blocksDir, const HttpServerOptions& options);
             void run();
             /* REST Api for returning the balance of a given address */
             void addressBalance( const shared_ptr< Session > session );
 
-            /* REST Api for returning the TXOs on a given address */
+            /* REST Api for returning the balances of a list of addresses */
+            void addressBalances( const shared_ptr< Session > session );
+
+            /* REST Api for returning the TXOs of a list of addresses, each with an optional
+               since height, merged into one list. Responses hold at most limit (10000) TXOs,
+               X-Next-Cursor continues with the same body and ?cursor= */
+            void addressesTxos( const shared_ptr< Session > session );
+
+            /* Returns the balance of a script identifier, including the mempool. Stops early
+               (with a partial balance) when the request is stopped */
+            VtcBlockIndexer::AddressBalance getAddressBalance(VtcBlockIndexer::ReadContext& reads, VtcBlockIndexer::RequestState& request, const string& scriptId);
+
+            /* Returns the balance in the detailed addressBalance format */
+            nlohmann::json addressBalanceToJson(const VtcBlockIndexer::AddressBalance& balance);
+
+            /* Parses the body of a batch request: an array of addresses, or of objects with
+               an address and a since height. Returns false and sets error when it's invalid */
+            bool parseAddressList(const Bytes& body, vector<pair<string, long long>>& addresses, string& error);
+
+            /* Returns the indexes of the script identifiers in key order */
+            vector<size_t> sortByScriptId(const vector<string>& scriptIds);
+
+            /* REST Api for restoring an HD wallet: derives the receive and change addresses of
+               an extended public key until gap unused ones in a row, and returns the used
+               addresses with their balances and UTXOs */
+            void xpubScan( const shared_ptr< Session > session );
+
+            /* Derives and looks up the addresses of one chain of an extended public key in
+               batches of gapLimit. Appends the used ones and returns the index after the last one.
+               Stops early when the request is stopped. Sets truncated when the cap on addresses
+               per chain ended the scan before gapLimit unused ones in a row */
+            uint32_t scanXpubChain(VtcBlockIndexer::ReadContext& reads, VtcBlockIndexer::RequestState& request, const VtcBlockIndexer::ExtendedPubKey& xpub, uint32_t chain, unsigned char scriptIdType, uint32_t gapLimit, vector<VtcBlockIndexer::XpubAddress>& used, bool& truncated);
+
+            /* REST Api for returning the TXOs on a given address. Supports paging with
+               limit and cursor (the next cursor is returned in X-Next-Cursor) and
+               streaming the result with stream=1 */
             void addressTxos( const shared_ptr< Session > session );
+
+            /* Reads an addressTxos index entry. Returns false if the entry is filtered
+               out or on error, in which case error is set */
+            bool readAddressTxo(VtcBlockIndexer::AddressTxoScan& scan, const string& txo, VtcBlockIndexer::AddressTxo& result, string& error);
+
+            /* Converts a TXO to JSON in the addressTxos format */
+            nlohmann::json addressTxoToJson(const VtcBlockIndexer::AddressTxoScan& scan, const VtcBlockIndexer::AddressTxo& txo);
+
+            /* Writes a TXO in the addressTxos format, the same output as addressTxoToJson */
+            void writeAddressTxo(const VtcBlockIndexer::AddressTxoScan& scan, const VtcBlockIndexer::AddressTxo& txo, VtcBlockIndexer::JsonWriter& writer);
+
+            /* Reads up to maxEntries TXOs from the scan into entries. Returns false on error.
+               Raw transactions and scripts are fetched together after the entries are read */
+            bool readAddressTxos(VtcBlockIndexer::AddressTxoScan& scan, size_t maxEntries, vector<VtcBlockIndexer::AddressTxo>& entries, string& error);
+
+            /* Returns the cursor to continue the scan with, or an empty string if it's done */
+            string getAddressTxosCursor(VtcBlockIndexer::AddressTxoScan& scan);
+
+            /* Returns the mempool TXOs of a script identifier in the addressTxos format */
+            nlohmann::json getMempoolAddressTxos(const string& scriptId);
+
+            /* Writes the next chunk of a streamed addressTxos response */
+            void streamAddressTxos(const shared_ptr<Session> session, shared_ptr<VtcBlockIndexer::AddressTxoScan> scan);
             
             /* REST Api for returning the transaction details with a given hash */
             void getTransaction(const shared_ptr<Session> session);
             
-            /* REST Api for returning the transaction proof for a given hash */
+            /* REST Api for returning the transaction proof for a given hash: the merkle branch
+               of the transaction and the headers of its block and the ones below it */
             void getTransactionProof(const shared_ptr<Session> session);
+
+            /* REST Api for returning the merkle branches of several transactions in the same
+               block (txids=<id>,<id>,...) together with the block header */
+            void getTransactionProofs(const shared_ptr<Session> session);
+
+            /* Returns the merkle tree of the block's transaction ids from the cache, or builds
+               it from the index. Returns an empty pointer when the block isn't indexed */
+            shared_ptr<const VtcBlockIndexer::MerkleTree> getMerkleTree(VtcBlockIndexer::ReadContext& reads, const string& blockHash);
+
+            /* Reads the header of the block at the height. Returns false if it isn't indexed */
+            bool readBlockHeader(VtcBlockIndexer::ReadContext& reads, uint64_t height, VtcBlockIndexer::Block& block);
+
+            /* Returns true if the block is the one indexed at the height, false when it was
+               replaced in a reorg */
+            bool isBlockAtHeight(VtcBlockIndexer::ReadContext& reads, const string& blockHash, uint64_t height);
+
+            /* Converts a block header to JSON in the getTransactionProof format */
+            nlohmann::json blockHeaderToJson(const VtcBlockIndexer::Block& block);
             
             /* REST Api for returning if a given outpoint is spent (and if so, which TX spends it) */
             void outpointSpend( const shared_ptr< Session > session );
@@ -70,6 +266,9 @@ namespace VtcBlockIndexer {
              /* REST Api for returning list of blocks */
             void getBlock( const shared_ptr< Session > session );
             
+            /* Writes a block in the format of the block lists, from the index values */
+            void writeBlockSummary(VtcBlockIndexer::JsonWriter& writer, const string& hash, const string& height, const string& size, const string& time, const string& txCount);
+
             /* REST Api for returning list of blocks by date */
             void getBlocksByDate( const shared_ptr< Session > session );
 
@@ -82,22 +281,104 @@ namespace VtcBlockIndexer {
             /* REST Api for returning sync status */
             void sync( const shared_ptr< Session > session );
 
-            vector<string> getAddressesForTxo(string txHash, uint64_t idx);
-            uint64_t getValueForTxo(string txHash, uint64_t idx);
+            /* Metrics of the HTTP endpoints, the indexer, LevelDB and the mempool in the
+               Prometheus text format */
+            void metrics( const shared_ptr< Session > session );
+
+            /* WebSocket endpoint pushing events for new blocks, addresses and outpoints
+               the client subscribes to */
+            void subscribe( const shared_ptr< Session > session );
+
+            /* Handles a subscribe or unsubscribe message of a WebSocket client */
+            void subscriptionMessage(const shared_ptr<WebSocket> socket, uint64_t subscriberId, const shared_ptr<WebSocketMessage> message);
+
+            /* Reads a transaction from the block files using the tx-filePosition index. Returns
+               false if the transaction is not in the index (for instance, when it's in the mempool) */
+            bool readIndexedTransaction(VtcBlockIndexer::ReadContext& reads, const string& txid, VtcBlockIndexer::Transaction& tx, vector<unsigned char>& rawTx);
+
+            /* Returns the raw transactions as hex in hexes. Reads them from the block files when
+               indexed and asks the node for the others (unconfirmed transactions) in one batch.
+               errors has the error for each transaction that could not be read, or is empty */
+            void getRawTransactionHexes(VtcBlockIndexer::ReadContext& reads, const vector<string>& txids, vector<string>& hexes, vector<string>& errors);
+
+            /* Returns the transaction as verbose JSON in the same format the node's
+               getrawtransaction returns it */
+            nlohmann::json transactionToJson(VtcBlockIndexer::ReadContext& reads, const VtcBlockIndexer::Transaction& tx, const vector<unsigned char>& rawTx);
+
+            /* Returns the value and script identifiers of the output spent by the given input */
+            VtcBlockIndexer::PrevOutput getPrevOutputForInput(VtcBlockIndexer::ReadContext& reads, const VtcBlockIndexer::TransactionInput& txi);
 
             /* REST Api for sending a hex transaction on the VTC p2p network*/
             void sendRawTransaction( const shared_ptr< Session > session );
             
+            /* Returns the cached response for the key, unless its block has been reorged out */
+            shared_ptr<const VtcBlockIndexer::CachedResponse> getCachedResponse(VtcBlockIndexer::ReadContext& reads, const string& key);
+
+            /* Caches a response built from its block, if the block is deep enough to not be
+               reorged out. Its size is the length of the text and the slots */
+            void cacheResponse(VtcBlockIndexer::ReadContext& reads, const string& key, const shared_ptr<const VtcBlockIndexer::CachedResponse> response);
+
+            /* Sends a (cached) response with the confirmations and spends of the outputs
+               filled in at its slots */
+            void respondCached(const shared_ptr<Session> session, VtcBlockIndexer::ReadContext& reads, const VtcBlockIndexer::CachedResponse& response);
+
+            /* Sends the response. Keeps the connection open for the next request when the
+               client allows it and the connection cap isn't reached, closes it otherwise */
+            void respond(const shared_ptr<Session> session, const int status, const string& body, const string& contentType = "text/plain", const multimap<string, string>& extraHeaders = {});
+
+            /* Sends a JSON body in the encoding the Accept header asks for (JSON, CBOR or
+               MessagePack). Binary encodings send hashes as raw bytes when rawHashes=1 */
+            void respondJson(const shared_ptr<Session> session, const int status, const nlohmann::json& body, const multimap<string, string>& extraHeaders = {});
+
+            /* Sends a body of JSON text. JSON clients get the text as is, for the binary
+               encodings it is parsed and sent through respondJson. Used for cached responses */
+            void respondWritten(const shared_ptr<Session> session, const int status, const string& body, const multimap<string, string>& extraHeaders = {});
+
+            /* Returns a writer for the response: one writing JSON text into body, or one
+               building tree when the Accept header asks for a binary encoding */
+            VtcBlockIndexer::JsonWriter createWriter(const shared_ptr<Session> session, string& body, nlohmann::json& tree);
+
+            /* Sends what the writer from createWriter wrote, without a text round trip
+               for the binary encodings */
+            void respondWritten(const shared_ptr<Session> session, const int status, VtcBlockIndexer::JsonWriter& writer, const multimap<string, string>& extraHeaders = {});
+
+
         private:
-            shared_ptr<leveldb::DB> db;
-            unique_ptr<VertcoinClient> vertcoind;
-            unique_ptr<jsonrpc::HttpClient> httpClient;
+            shared_ptr<VtcBlockIndexer::Database> database;
+            shared_ptr<VtcBlockIndexer::RpcPool> rpc;
             unique_ptr<VtcBlockIndexer::BlockReader> blockReader;
             unique_ptr<VtcBlockIndexer::ScriptSolver> scriptSolver;
+            unique_ptr<VtcBlockIndexer::ResponseCache> responseCache;
+            unique_ptr<VtcBlockIndexer::MerkleTreeCache> merkleTreeCache;
             shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor;
+            shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions;
+            shared_ptr<VtcBlockIndexer::ChainState> chainState;
             /** Directory containing the blocks
              */
             string blocksDir; 
 
+            HttpServerOptions options;
+
+            /** Returns true if the connection of the session can be kept open after
+             * responding. Registers it as a persistent connection if it wasn't yet
+             */
+            bool keepAlive(const shared_ptr<Session> session);
+
+            /** Wraps the handler of an endpoint in a RequestLimiter allowing maxConcurrent
+             * requests at once (0 for no limit), and records its requests in the metrics. The
+             * time covers waiting in the queue up to when the request state is released, so
+             * it includes responses completed from callbacks (request bodies, streamed chunks)
+             */
+            function<void(const shared_ptr<Session>)> route(const string& endpoint, size_t maxConcurrent, const function<void(const shared_ptr<Session>)>& handler);
+
+            /** Returns the status to respond with when a handler failed: 503 when the
+             * request was stopped, 400 otherwise
+             */
+            int failureStatus(const shared_ptr<VtcBlockIndexer::RequestState> request);
+
+            // Connections currently kept alive
+            mutex persistentSessionsMutex;
+            map<const Session*, weak_ptr<Session>> persistentSessions;
+
     };
 }
\ No newline at end of file
@@ -0,0 +1,235 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "jsonwriter.h"
+
+using namespace std;
+
+// Buffers that grew beyond this are released instead of kept for the next request
+const size_t maxRetainedBufferSize = 4 * 1024 * 1024;
+
+VtcBlockIndexer::JsonWriter::JsonWriter(string& out) {
+    this->out = &out;
+    this->tree = NULL;
+    this->afterKey = false;
+}
+
+VtcBlockIndexer::JsonWriter::JsonWriter(nlohmann::json& tree) {
+    this->out = NULL;
+    this->tree = &tree;
+    this->afterKey = false;
+}
+
+string* VtcBlockIndexer::JsonWriter::getText() {
+    return out;
+}
+
+nlohmann::json* VtcBlockIndexer::JsonWriter::getTree() {
+    return tree;
+}
+
+nlohmann::json* VtcBlockIndexer::JsonWriter::add(nlohmann::json value) {
+    if(containers.empty()) {
+        *tree = std::move(value);
+        return tree;
+    }
+    nlohmann::json& container = *containers.back();
+    if(container.is_object()) {
+        nlohmann::json& member = container[pendingKey];
+        member = std::move(value);
+        return &member;
+    }
+    container.push_back(std::move(value));
+    return &container.back();
+}
+
+string& VtcBlockIndexer::JsonWriter::threadBuffer() {
+    thread_local string buffer;
+    if(buffer.capacity() > maxRetainedBufferSize) {
+        string().swap(buffer);
+    }
+    buffer.clear();
+    return buffer;
+}
+
+void VtcBlockIndexer::JsonWriter::separate() {
+    if(afterKey) {
+        afterKey = false;
+        return;
+    }
+    if(!first.empty()) {
+        if(!first.back()) {
+            out->push_back(',');
+        }
+        first.back() = false;
+    }
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::beginObject() {
+    if(tree) {
+        containers.push_back(add(nlohmann::json::object()));
+        return *this;
+    }
+    separate();
+    out->push_back('{');
+    first.push_back(true);
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::endObject() {
+    if(tree) {
+        containers.pop_back();
+        return *this;
+    }
+    out->push_back('}');
+    first.pop_back();
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::beginArray() {
+    if(tree) {
+        containers.push_back(add(nlohmann::json::array()));
+        return *this;
+    }
+    separate();
+    out->push_back('[');
+    first.push_back(true);
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::endArray() {
+    if(tree) {
+        containers.pop_back();
+        return *this;
+    }
+    out->push_back(']');
+    first.pop_back();
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::key(const string& name) {
+    if(tree) {
+        pendingKey = name;
+        return *this;
+    }
+    separate();
+    writeEscaped(name);
+    out->push_back(':');
+    afterKey = true;
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(const string& text) {
+    if(tree) {
+        add(text);
+        return *this;
+    }
+    separate();
+    writeEscaped(text);
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(const char* text) {
+    return value(string(text));
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(long long number) {
+    if(tree) {
+        add(number);
+        return *this;
+    }
+    separate();
+    out->append(std::to_string(number));
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(unsigned long long number) {
+    if(tree) {
+        add(number);
+        return *this;
+    }
+    separate();
+    out->append(std::to_string(number));
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(int number) {
+    return value((long long)number);
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(unsigned int number) {
+    return value((unsigned long long)number);
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(bool flag) {
+    if(tree) {
+        add(flag);
+        return *this;
+    }
+    separate();
+    out->append(flag ? "true" : "false");
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::null() {
+    if(tree) {
+        add(nullptr);
+        return *this;
+    }
+    separate();
+    out->append("null");
+    return *this;
+}
+
+VtcBlockIndexer::JsonWriter& VtcBlockIndexer::JsonWriter::value(const nlohmann::json& j) {
+    if(tree) {
+        add(j);
+        return *this;
+    }
+    separate();
+    out->append(j.dump());
+    return *this;
+}
+
+void VtcBlockIndexer::JsonWriter::writeEscaped(const string& text) {
+    static const char hexDigits[] = "0123456789abcdef";
+    out->push_back('"');
+    for(char c : text) {
+        switch(c) {
+            case '"': out->append("\\\""); break;
+            case '\\': out->append("\\\\"); break;
+            case '\b': out->append("\\b"); break;
+            case '\f': out->append("\\f"); break;
+            case '\n': out->append("\\n"); break;
+            case '\r': out->append("\\r"); break;
+            case '\t': out->append("\\t"); break;
+            default:
+                if(c >= 0x00 && c <= 0x1F) {
+                    out->append("\\u00");
+                    out->push_back(hexDigits[(c >> 4) & 0x0F]);
+                    out->push_back(hexDigits[c & 0x0F]);
+                } else {
+                    out->push_back(c);
+                }
+                break;
+        }
+    }
+    out->push_back('"');
+}
@@ -0,0 +1,116 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JSONWRITER_H_INCLUDED
+#define JSONWRITER_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "json.hpp"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * The JsonWriter class writes JSON text straight into a string, without building
+ * an nlohmann::json tree first. The output matches json::dump() as long as object
+ * keys are written in sorted order, which is the order json objects keep them in.
+ * For the binary encodings, which are serialized from a tree, it builds the tree
+ * with the same calls instead.
+ */
+
+class JsonWriter {
+public:
+    /** Constructs a writer appending to out
+     */
+    JsonWriter(string& out);
+
+    /** Constructs a writer building tree instead of text
+     */
+    JsonWriter(nlohmann::json& tree);
+
+    /** Returns the text written to, or NULL when the writer builds a tree
+     */
+    string* getText();
+
+    /** Returns the tree built, or NULL when the writer writes text
+     */
+    nlohmann::json* getTree();
+
+    /** Returns a cleared buffer owned by the calling thread. Its capacity is kept
+     * between requests so large responses don't regrow it every time
+     */
+    static string& threadBuffer();
+
+    JsonWriter& beginObject();
+    JsonWriter& endObject();
+    JsonWriter& beginArray();
+    JsonWriter& endArray();
+
+    /** Writes the key of the next object member
+     */
+    JsonWriter& key(const string& name);
+
+    JsonWriter& value(const string& text);
+    JsonWriter& value(const char* text);
+    JsonWriter& value(long long number);
+    JsonWriter& value(unsigned long long number);
+    JsonWriter& value(int number);
+    JsonWriter& value(unsigned int number);
+    JsonWriter& value(bool flag);
+    JsonWriter& null();
+
+    /** Writes an existing json value, for the parts of a response that are
+     * built as a tree anyway
+     */
+    JsonWriter& value(const nlohmann::json& j);
+
+private:
+    /** Writes the separator needed before the next value
+     */
+    void separate();
+
+    void writeEscaped(const string& text);
+
+    /** Adds a value to the open array or object (under the pending key), or sets
+     * the tree to it. Returns where it was stored
+     */
+    nlohmann::json* add(nlohmann::json value);
+
+    // Exactly one of them is set
+    string* out;
+    nlohmann::json* tree;
+
+    // Tree only: the open arrays and objects, and the key of the next member
+    vector<nlohmann::json*> containers;
+    string pendingKey;
+
+    // One entry per open array or object: true until its first element is written
+    vector<bool> first;
+
+    // A key was just written, the value follows without a separator
+    bool afterKey;
+};
+
+}
+
+#endif // JSONWRITER_H_INCLUDED
@@ -0,0 +1,153 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "logger.h"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+
+using namespace std;
+
+// Messages waiting to be written before new ones are dropped
+const size_t maxQueuedMessages = 100000;
+
+// How long the writer thread sleeps when the queue is empty
+const chrono::milliseconds writeInterval(20);
+
+namespace {
+    std::thread writerThread;
+
+    const char* levelName(VtcBlockIndexer::LogLevel level) {
+        switch(level) {
+            case VtcBlockIndexer::LOG_LEVEL_DEBUG: return "DEBUG";
+            case VtcBlockIndexer::LOG_LEVEL_INFO: return "INFO";
+            case VtcBlockIndexer::LOG_LEVEL_WARNING: return "WARNING";
+            default: return "ERROR";
+        }
+    }
+}
+
+atomic<int> VtcBlockIndexer::Logger::minimumLevel(LOG_LEVEL_INFO);
+// The queue always holds one entry whose message was already written (or the
+// initial empty one). The tail points at it, the head at the newest entry.
+VtcBlockIndexer::Logger::Entry* VtcBlockIndexer::Logger::tail = new VtcBlockIndexer::Logger::Entry();
+atomic<VtcBlockIndexer::Logger::Entry*> VtcBlockIndexer::Logger::head(VtcBlockIndexer::Logger::tail);
+atomic<size_t> VtcBlockIndexer::Logger::queued(0);
+atomic<size_t> VtcBlockIndexer::Logger::dropped(0);
+atomic<bool> VtcBlockIndexer::Logger::running(false);
+
+bool VtcBlockIndexer::Logger::parseLevel(const string& name, LogLevel& level) {
+    if(name == "debug") {
+        level = LOG_LEVEL_DEBUG;
+    } else if(name == "info") {
+        level = LOG_LEVEL_INFO;
+    } else if(name == "warning") {
+        level = LOG_LEVEL_WARNING;
+    } else if(name == "error") {
+        level = LOG_LEVEL_ERROR;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void VtcBlockIndexer::Logger::setLevel(LogLevel level) {
+    minimumLevel.store(level, memory_order_relaxed);
+}
+
+void VtcBlockIndexer::Logger::write(LogLevel level, string message) {
+    if(queued.fetch_add(1, memory_order_relaxed) >= maxQueuedMessages) {
+        queued.fetch_sub(1, memory_order_relaxed);
+        dropped.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    Entry* entry = new Entry();
+    entry->next.store(nullptr, memory_order_relaxed);
+    entry->level = level;
+    entry->time = chrono::system_clock::now();
+    entry->message = std::move(message);
+
+    // Link the entry behind the previous head. Until the store below the writer
+    // thread sees the queue end at the previous entry.
+    Entry* previous = head.exchange(entry, memory_order_acq_rel);
+    previous->next.store(entry, memory_order_release);
+}
+
+bool VtcBlockIndexer::Logger::pop(Entry& entry) {
+    Entry* next = tail->next.load(memory_order_acquire);
+    if(next == nullptr) return false;
+
+    entry.level = next->level;
+    entry.time = next->time;
+    entry.message = std::move(next->message);
+    delete tail;
+    tail = next;
+    queued.fetch_sub(1, memory_order_relaxed);
+    return true;
+}
+
+void VtcBlockIndexer::Logger::drain() {
+    string lines;
+    Entry entry;
+    while(pop(entry)) {
+        time_t seconds = chrono::system_clock::to_time_t(entry.time);
+        long long milliseconds = chrono::duration_cast<chrono::milliseconds>(entry.time.time_since_epoch()).count() % 1000;
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char timestamp[32];
+        strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &utc);
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "%s.%03lldZ %-7s ", timestamp, milliseconds, levelName(entry.level));
+        lines.append(prefix);
+        lines.append(entry.message);
+        lines.push_back('\n');
+    }
+
+    size_t droppedMessages = dropped.exchange(0, memory_order_relaxed);
+    if(droppedMessages > 0) {
+        lines.append("Dropped " + std::to_string(droppedMessages) + " log messages\n");
+    }
+
+    // One write and flush per batch instead of per line
+    if(!lines.empty()) {
+        fwrite(lines.data(), 1, lines.size(), stdout);
+        fflush(stdout);
+    }
+}
+
+void VtcBlockIndexer::Logger::start() {
+    if(running.exchange(true)) return;
+    writerThread = std::thread([]() {
+        while(running.load()) {
+            drain();
+            std::this_thread::sleep_for(writeInterval);
+        }
+    });
+    std::atexit(VtcBlockIndexer::Logger::stop);
+}
+
+void VtcBlockIndexer::Logger::stop() {
+    if(running.exchange(false) && writerThread.joinable()) {
+        writerThread.join();
+    }
+    drain();
+}
@@ -0,0 +1,130 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOGGER_H_INCLUDED
+#define LOGGER_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR
+};
+
+/**
+ * The Logger class writes log lines from a background thread. Threads logging a
+ * message only append it to a lock-free queue, so they never wait for stdout or
+ * for each other. Messages below the configured level are not even formatted
+ * when the VTC_LOG macros are used.
+ */
+
+class Logger {
+public:
+    /** Parses debug, info, warning or error. Returns false for other names
+     */
+    static bool parseLevel(const string& name, LogLevel& level);
+
+    static void setLevel(LogLevel level);
+
+    /** Returns true if messages of the level are written
+     */
+    static bool enabled(LogLevel level) {
+        return (int)level >= minimumLevel.load(memory_order_relaxed);
+    }
+
+    /** Queues a message. When the queue is full (stdout can't keep up) the
+     * message is dropped and counted instead
+     */
+    static void write(LogLevel level, string message);
+
+    /** Starts the thread writing the queued messages. Messages logged before
+     * are kept until it starts. The rest of the queue is written at exit.
+     */
+    static void start();
+
+    /** Writes what is queued and stops the thread
+     */
+    static void stop();
+
+private:
+    struct Entry {
+        atomic<Entry*> next;
+        LogLevel level;
+        chrono::system_clock::time_point time;
+        string message;
+    };
+
+    /** Takes the oldest message off the queue, returns false if it's empty.
+     * Only called from the writer thread
+     */
+    static bool pop(Entry& entry);
+
+    /** Writes everything queued so far to stdout
+     */
+    static void drain();
+
+    static atomic<int> minimumLevel;
+
+    // Multi-producer single-consumer queue: producers swap themselves in at
+    // the head, the writer thread follows the next pointers from the tail
+    static atomic<Entry*> head;
+    static Entry* tail;
+    static atomic<size_t> queued;
+    static atomic<size_t> dropped;
+    static atomic<bool> running;
+
+    Logger() {}
+};
+
+}
+
+// Logs a message built with stream operators, e.g. VTC_LOG(LOG_LEVEL_INFO, "Height " << height).
+// The message is only built when the level is enabled.
+#define VTC_LOG(level, message) \
+    do { \
+        if(VtcBlockIndexer::Logger::enabled(VtcBlockIndexer::level)) { \
+            std::ostringstream logMessage; \
+            logMessage << message; \
+            VtcBlockIndexer::Logger::write(VtcBlockIndexer::level, logMessage.str()); \
+        } \
+    } while(0)
+
+// Logs only every Nth occurrence of a message, for messages on hot paths that
+// could otherwise flood the log
+#define VTC_LOG_SAMPLED(level, every, message) \
+    do { \
+        static std::atomic<unsigned long long> logOccurrences(0); \
+        if(VtcBlockIndexer::Logger::enabled(VtcBlockIndexer::level) && logOccurrences++ % (every) == 0) { \
+            std::ostringstream logMessage; \
+            logMessage << message << " (logging 1 in " << (every) << ")"; \
+            VtcBlockIndexer::Logger::write(VtcBlockIndexer::level, logMessage.str()); \
+        } \
+    } while(0)
+
+#endif // LOGGER_H_INCLUDED
@@ -0,0 +1,115 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LRUCACHE_H_INCLUDED
+#define LRUCACHE_H_INCLUDED
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The LruCache class keeps shared values by key, evicting the least recently
+ * used ones when their total size exceeds the budget. The caller passes the
+ * size of a value when adding it. Values are immutable, so a value handed out
+ * stays valid after it is evicted.
+ */
+
+template<typename T>
+class LruCache {
+public:
+    /** Constructs a cache holding up to maxBytes of values
+     */
+    LruCache(size_t maxBytes) {
+        this->maxBytes = maxBytes;
+        this->usedBytes = 0;
+    }
+
+    /** Returns the value for the key, or an empty pointer
+     */
+    std::shared_ptr<const T> get(const std::string& key) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto entry = entriesByKey.find(key);
+        if(entry == entriesByKey.end()) {
+            return NULL;
+        }
+        entries.splice(entries.begin(), entries, entry->second);
+        return entry->second->value;
+    }
+
+    /** Adds or replaces the value for the key. Values larger than the whole
+     * budget are not kept
+     */
+    void put(const std::string& key, const std::shared_ptr<const T> value, size_t size) {
+        size += key.size();
+        if(size > maxBytes) return;
+
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        remove(key);
+        entries.push_front({key, value, size});
+        entriesByKey[key] = entries.begin();
+        usedBytes += size;
+        while(usedBytes > maxBytes && !entries.empty()) {
+            usedBytes -= entries.back().size;
+            entriesByKey.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    /** Removes the value for the key, if any
+     */
+    void erase(const std::string& key) {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        remove(key);
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const T> value;
+        size_t size;
+    };
+
+    /** Removes the entry of the key, the caller holds cacheMutex
+     */
+    void remove(const std::string& key) {
+        auto entry = entriesByKey.find(key);
+        if(entry == entriesByKey.end()) return;
+        usedBytes -= entry->second->size;
+        entries.erase(entry->second);
+        entriesByKey.erase(entry);
+    }
+
+    size_t maxBytes;
+    size_t usedBytes;
+    std::mutex cacheMutex;
+
+    // Most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, typename std::list<Entry>::iterator> entriesByKey;
+};
+
+}
+
+#endif // LRUCACHE_H_INCLUDED
@@ -27,46 +27,49 @@
 #include <memory>
 #include <vector>
 #include <ctime>
-#include "leveldb/db.h"
-#include "leveldb/write_batch.h"
-#include "leveldb/filter_policy.h"
-#include "leveldb/cache.h"
+#include <algorithm>
+#include "database.h"
 #include "utility.h"
 #include "blockchaintypes.h"
 #include "httpserver.h"
 #include "mempoolmonitor.h"
 #include "blockfilewatcher.h"
+#include "chainstate.h"
+#include "rpcpool.h"
 #include <thread>
 #include "cxxopts.hpp"
 #include "coinparams.h"
+#include "logger.h"
 
 using namespace std;
 
 
-shared_ptr<leveldb::DB> database;
+shared_ptr<VtcBlockIndexer::Database> database;
 shared_ptr<VtcBlockIndexer::HttpServer> httpServer;
 shared_ptr<VtcBlockIndexer::BlockFileWatcher> blockFileWatcher;
 shared_ptr<VtcBlockIndexer::MempoolMonitor> mempoolMonitor;
+shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions;
+shared_ptr<VtcBlockIndexer::ChainState> chainState;
+shared_ptr<VtcBlockIndexer::RpcPool> rpc;
+unsigned int nodePollInterval;
 
 void runBlockfileWatcher() {
-    cout << "Starting blockfile watcher..." << endl;
+    VTC_LOG(LOG_LEVEL_INFO, "Starting blockfile watcher...");
     blockFileWatcher->startWatcher();
 }
 
 void runMempoolMonitor() {
-    cout << "Starting mempool monitor..." << endl;
+    VTC_LOG(LOG_LEVEL_INFO, "Starting mempool monitor...");
     mempoolMonitor->startWatcher();
 }
 
-void openDatabase(std::string indexDir) {
-    leveldb::DB* db;
-    leveldb::Options options;
-    options.create_if_missing = true;
-    options.block_cache = leveldb::NewLRUCache(300 * 1024 * 1024);
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    leveldb::Status status = leveldb::DB::Open(options, indexDir, &db);
-    assert(status.ok());
-    database.reset(db);
+void runChainStatePoller() {
+    VTC_LOG(LOG_LEVEL_INFO, "Starting node height poller...");
+    chainState->startPoller(rpc, std::chrono::seconds(nodePollInterval));
+}
+
+void openDatabase(std::string indexDir, std::string profileName, const vector<std::string>& storeDirs) {
+    database = make_shared<VtcBlockIndexer::Database>(indexDir, profileName, storeDirs);
 }
 
 
@@ -77,6 +80,25 @@ int main(int argc, char* argv[]) {
     ("coinParams", "Coin parameters file", cxxopts::value<std::string>())
     ("indexDir", "Directory to save the indexes [Default: /index]", cxxopts::value<std::string>()->default_value("/index"))
     ("blocksDir", "Directory where the block files are located [Default: /blocks]", cxxopts::value<std::string>()->default_value("/blocks"))
+    ("chainDir", "Directory for the block metadata store [Default: <indexDir>/chain]", cxxopts::value<std::string>()->default_value(""))
+    ("txsDir", "Directory for the transaction location store [Default: <indexDir>/txs]", cxxopts::value<std::string>()->default_value(""))
+    ("addressesDir", "Directory for the address history store [Default: <indexDir>/addresses]", cxxopts::value<std::string>()->default_value(""))
+    ("spentDir", "Directory for the spent outputs store [Default: <indexDir>/spent]", cxxopts::value<std::string>()->default_value(""))
+    ("dbProfile", "Database storage profile: sync, serve or auto (sync until the index has reached the tip, serve from then on) [Default: auto]", cxxopts::value<std::string>()->default_value("auto"))
+    ("httpWorkers", "Number of threads serving HTTP requests, 0 for one per core [Default: 0]", cxxopts::value<unsigned int>()->default_value("0"))
+    ("httpIdleTimeout", "Seconds before an idle HTTP connection is closed [Default: 30]", cxxopts::value<unsigned int>()->default_value("30"))
+    ("httpMaxConnections", "Maximum number of HTTP connections kept alive [Default: 1024]", cxxopts::value<unsigned int>()->default_value("1024"))
+    ("responseCacheSize", "Megabytes of block and transaction proof responses to cache [Default: 64]", cxxopts::value<unsigned int>()->default_value("64"))
+    ("merkleCacheSize", "Megabytes of per-block merkle trees to keep for transaction proofs [Default: 16]", cxxopts::value<unsigned int>()->default_value("16"))
+    ("cacheConfirmations", "Minimum confirmations of a block before its responses are cached [Default: 6]", cxxopts::value<unsigned int>()->default_value("6"))
+    ("httpExpensiveConcurrency", "Requests handled at once per expensive endpoint (address balances and histories, batches, xpub scans), 0 for a quarter of the workers [Default: 0]", cxxopts::value<unsigned int>()->default_value("0"))
+    ("httpQueueSize", "Requests waiting per expensive endpoint before new ones are rejected with 503 [Default: 64]", cxxopts::value<unsigned int>()->default_value("64"))
+    ("httpRequestTimeout", "Seconds a request may take before it is stopped [Default: 30]", cxxopts::value<unsigned int>()->default_value("30"))
+    ("rpcConnections", "Number of connections to the node's RPC interface [Default: 4]", cxxopts::value<unsigned int>()->default_value("4"))
+    ("rpcBatchSize", "Maximum number of calls sent to the node in one batch [Default: 100]", cxxopts::value<unsigned int>()->default_value("100"))
+    ("rpcTimeout", "Seconds before a request to the node fails [Default: 30]", cxxopts::value<unsigned int>()->default_value("30"))
+    ("nodePollInterval", "Seconds between asking the node for its block height [Default: 5]", cxxopts::value<unsigned int>()->default_value("5"))
+    ("logLevel", "Minimum level of logged messages: debug, info, warning or error [Default: info]", cxxopts::value<std::string>()->default_value("info"))
     ("dumpDoubleSpends", "Only run through the blockchain to found reorgd blocks containing double spends [default: no]", cxxopts::value<std::string>()->default_value("no"))
    
     ;
@@ -88,28 +110,71 @@ int main(int argc, char* argv[]) {
         return -1;
     }
 
-    // Open the database
-    openDatabase(options["indexDir"].as<string>());
+    if(!VtcBlockIndexer::Database::isValidProfileName(options["dbProfile"].as<string>())) {
+        cerr << "Unknown database profile " << options["dbProfile"].as<string>() << ". Exiting." << endl;
+        return -1;
+    }
+
+    VtcBlockIndexer::LogLevel logLevel;
+    if(!VtcBlockIndexer::Logger::parseLevel(options["logLevel"].as<string>(), logLevel)) {
+        cerr << "Unknown log level " << options["logLevel"].as<string>() << ". Exiting." << endl;
+        return -1;
+    }
+    VtcBlockIndexer::Logger::setLevel(logLevel);
+    VtcBlockIndexer::Logger::start();
+
+    // Open the database. Stores without an explicit directory go in indexDir
+    vector<string> storeDirs(VtcBlockIndexer::STORE_COUNT);
+    storeDirs[VtcBlockIndexer::STORE_CHAIN] = options["chainDir"].as<string>();
+    storeDirs[VtcBlockIndexer::STORE_TXS] = options["txsDir"].as<string>();
+    storeDirs[VtcBlockIndexer::STORE_ADDRESSES] = options["addressesDir"].as<string>();
+    storeDirs[VtcBlockIndexer::STORE_SPENT] = options["spentDir"].as<string>();
+    openDatabase(options["indexDir"].as<string>(), options["dbProfile"].as<string>(), storeDirs);
 
     // Read coin parameters
     VtcBlockIndexer::CoinParams::readFromFile(options["coinParams"].as<string>());
 
+    // Clients subscribed over the WebSocket endpoint are notified of new blocks
+    // and transactions as the watchers find them
+    subscriptions = make_shared<VtcBlockIndexer::SubscriptionManager>();
+
+    // The indexed tip and the node's height are kept in memory for the handlers
+    chainState = make_shared<VtcBlockIndexer::ChainState>(database);
+
     // Start blockfile watcher on separate thread
     
     if(options.count("dumpDoubleSpends") > 0) {
-        blockFileWatcher.reset(new VtcBlockIndexer::BlockFileWatcher(options["blocksDir"].as<string>(), database, mempoolMonitor));
+        blockFileWatcher.reset(new VtcBlockIndexer::BlockFileWatcher(options["blocksDir"].as<string>(), database, mempoolMonitor, subscriptions, chainState));
         blockFileWatcher->dumpDoubleSpends();
     } else {
+        // Calls to the node from all threads share the connections of the pool
+        rpc = make_shared<VtcBlockIndexer::RpcPool>(options["rpcConnections"].as<unsigned int>(), options["rpcBatchSize"].as<unsigned int>(), std::chrono::seconds(options["rpcTimeout"].as<unsigned int>()));
+
+        // Create the watchers before their threads start using them
+        mempoolMonitor = make_shared<VtcBlockIndexer::MempoolMonitor>(subscriptions, rpc);
+        blockFileWatcher.reset(new VtcBlockIndexer::BlockFileWatcher(options["blocksDir"].as<string>(), database, mempoolMonitor, subscriptions, chainState));
+
         std::thread watcherThread(runBlockfileWatcher);   
 
         // Start memory pool monitor on a separate thread
-        mempoolMonitor = make_shared<VtcBlockIndexer::MempoolMonitor>();
         std::thread mempoolThread(runMempoolMonitor);   
-                
-        blockFileWatcher.reset(new VtcBlockIndexer::BlockFileWatcher(options["blocksDir"].as<string>(), database, mempoolMonitor));
+
+        // Poll the node's height on a separate thread
+        nodePollInterval = std::max(1u, options["nodePollInterval"].as<unsigned int>());
+        std::thread chainStateThread(runChainStatePoller);
         
         // Start webserver on main thread.
-        httpServer.reset(new VtcBlockIndexer::HttpServer(database, mempoolMonitor, options["blocksDir"].as<string>()));
+        VtcBlockIndexer::HttpServerOptions httpOptions;
+        httpOptions.workers = options["httpWorkers"].as<unsigned int>();
+        httpOptions.idleTimeout = options["httpIdleTimeout"].as<unsigned int>();
+        httpOptions.maxConnections = options["httpMaxConnections"].as<unsigned int>();
+        httpOptions.responseCacheSize = (size_t)options["responseCacheSize"].as<unsigned int>() * 1024 * 1024;
+        httpOptions.cacheConfirmations = options["cacheConfirmations"].as<unsigned int>();
+        httpOptions.merkleCacheSize = (size_t)options["merkleCacheSize"].as<unsigned int>() * 1024 * 1024;
+        httpOptions.expensiveConcurrency = options["httpExpensiveConcurrency"].as<unsigned int>();
+        httpOptions.requestQueueSize = options["httpQueueSize"].as<unsigned int>();
+        httpOptions.requestTimeout = options["httpRequestTimeout"].as<unsigned int>();
+        httpServer.reset(new VtcBlockIndexer::HttpServer(database, mempoolMonitor, subscriptions, chainState, rpc, options["blocksDir"].as<string>(), httpOptions));
         httpServer->run(); 
     }
 }
@@ -18,6 +18,8 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "mempoolmonitor.h"
+#include "logger.h"
+#include "metrics.h"
 #include "utility.h"
 #include "scriptsolver.h"
 #include "blockchaintypes.h"
@@ -25,111 +27,191 @@
 #include <chrono>
 #include <thread>
 #include <time.h>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
 #include "byte_array_buffer.h"
 using namespace std;
 
 // This map keeps the memorypool transactions deserialized in memory.
 
 
-VtcBlockIndexer::MempoolMonitor::MempoolMonitor() {
-    httpClient.reset(new jsonrpc::HttpClient("http://" + std::string(std::getenv("COIND_RPCUSER")) + ":" + std::string(std::getenv("COIND_RPCPASSWORD")) + "@" + std::string(std::getenv("COIND_HOST")) + ":" + std::string(std::getenv("COIND_RPCPORT"))));
-    vertcoind.reset(new VertcoinClient(*httpClient));
+VtcBlockIndexer::MempoolMonitor::MempoolMonitor(const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::RpcPool> rpc) {
+    this->subscriptions = subscriptions;
+    this->rpc = rpc;
     blockReader.reset(new VtcBlockIndexer::BlockReader(""));
     scriptSolver.reset(new VtcBlockIndexer::ScriptSolver());
+    lastUpdateNanoseconds = 0;
+    lastUpdateTime = 0;
 }
 
 void VtcBlockIndexer::MempoolMonitor::startWatcher() {
     while(true) {
         try {
-            const Json::Value mempool = vertcoind->getrawmempool();
+            chrono::steady_clock::time_point updateStart = chrono::steady_clock::now();
+            const Json::Value mempool = rpc->call("getrawmempool", Json::Value()).get();
+            if(!mempool.isArray()) {
+                throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, mempool.toStyledString());
+            }
+            vector<string> newTxids;
             for ( uint index = 0; index < mempool.size(); ++index )
             {
-                if(mempoolTransactions.find(mempool[index].asString()) == mempoolTransactions.end()) {
-                    const Json::Value rawTx = vertcoind->getrawtransaction(mempool[index].asString(), false);
-                    std::vector<unsigned char> rawTxBytes = VtcBlockIndexer::Utility::hexToBytes(rawTx.asString());
-
-                    byte_array_buffer streambuf(&rawTxBytes[0], rawTxBytes.size());
-                    std::istream stream(&streambuf);
-
-                    VtcBlockIndexer::Transaction tx = blockReader->readTransaction(stream);
-                    mempoolTransactions[mempool[index].asString()] = tx;
-
-                  
-                    for(VtcBlockIndexer::TransactionOutput out : tx.outputs) {
-                        out.txHash = tx.txHash;
-                        vector<string> addresses = scriptSolver->getAddressesFromScript(out.script);
-                        for(string address : addresses) {
-                            if(addressMempoolTransactions.find(address) == addressMempoolTransactions.end())
-                            {
-                                addressMempoolTransactions[address] = {};
-                            }
-                            addressMempoolTransactions[address].push_back(out);
-                        }
+                if(!hasTransaction(mempool[index].asString())) {
+                    newTxids.push_back(mempool[index].asString());
+                }
+            }
+
+            // Fetch all new transactions at once and parse them without holding the
+            // lock, so readers are only blocked while they are added
+            vector<future<Json::Value>> rawTxs = rpc->getRawTransactions(newTxids);
+            for(size_t i = 0; i < rawTxs.size(); i++) {
+                Json::Value rawTx;
+                try {
+                    rawTx = rawTxs[i].get();
+                    if(!rawTx.isString()) {
+                        throw jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, rawTx.toStyledString());
                     }
+                } catch(const jsonrpc::JsonRpcException& e) {
+                    // Mined or evicted since the mempool was listed
+                    VTC_LOG(LOG_LEVEL_DEBUG, "Could not read mempool transaction " << newTxids[i] << ": " << e.what());
+                    continue;
                 }
+                std::vector<unsigned char> rawTxBytes = VtcBlockIndexer::Utility::hexToBytes(rawTx.asString());
+
+                byte_array_buffer streambuf(&rawTxBytes[0], rawTxBytes.size());
+                std::istream stream(&streambuf);
+
+                addTransaction(blockReader->readTransaction(stream));
+                Metrics::add(METRIC_MEMPOOL_TRANSACTIONS_ADDED);
             }
+            lastUpdateNanoseconds = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - updateStart).count();
+            lastUpdateTime = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
         } catch(const jsonrpc::JsonRpcException& e) {
             const std::string message(e.what());
-            cout << "Error reading mempool " << message << endl;
+            VTC_LOG(LOG_LEVEL_WARNING, "Error reading mempool " << message);
         }
         
         std::this_thread::sleep_for(std::chrono::seconds(1));
     }
 }
 
-string VtcBlockIndexer::MempoolMonitor::outpointSpend(string txid, uint32_t vout) {
-    for (auto kvp : mempoolTransactions) {
-        VtcBlockIndexer::Transaction tx = kvp.second;
-        for (VtcBlockIndexer::TransactionInput txi : tx.inputs) {
-            if(txi.txHash.compare(txid) == 0 && txi.txoIndex == vout) {
-                return tx.txHash;
+bool VtcBlockIndexer::MempoolMonitor::hasTransaction(const string& txid) {
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    return mempoolTransactions.find(txid) != mempoolTransactions.end();
+}
+
+void VtcBlockIndexer::MempoolMonitor::addTransaction(const VtcBlockIndexer::Transaction& tx) {
+    vector<vector<string>> outputScriptIds;
+    for(const VtcBlockIndexer::TransactionOutput& out : tx.outputs) {
+        outputScriptIds.push_back(scriptSolver->getScriptIdsFromScript(out.script));
+    }
+
+    unordered_set<string> scriptIds;
+    vector<string> spends;
+    {
+        // Only hold the lock while the maps change, subscribers are notified after
+        unique_lock<shared_timed_mutex> lock(mempoolMutex);
+        if(mempoolTransactions.find(tx.txHash) != mempoolTransactions.end()) return;
+        mempoolTransactions[tx.txHash] = tx;
+
+        for(size_t i = 0; i < tx.outputs.size(); i++) {
+            VtcBlockIndexer::TransactionOutput out = tx.outputs[i];
+            out.txHash = tx.txHash;
+            for(const string& scriptId : outputScriptIds[i]) {
+                addressMempoolTransactions[scriptId].push_back(out);
+                scriptIds.insert(scriptId);
             }
         }
+
+        for(const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+            if(txi.coinbase) continue;
+            stringstream outpoint;
+            outpoint << txi.txHash << setw(8) << setfill('0') << txi.txoIndex;
+            mempoolSpends[outpoint.str()] = tx.txHash;
+            spends.push_back(outpoint.str());
+        }
     }
-    return "";
+
+    // The addresses spent from aren't known without the index, subscribers to
+    // them see the spend through the outpoint or once it is in a block
+    subscriptions->notifyTransaction(tx.txHash, scriptIds, spends, 0);
+}
+
+string VtcBlockIndexer::MempoolMonitor::outpointSpend(string txid, uint32_t vout) {
+    stringstream outpoint;
+    outpoint << txid << setw(8) << setfill('0') << vout;
+
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto spend = mempoolSpends.find(outpoint.str());
+    if(spend == mempoolSpends.end()) {
+        return "";
+    }
+    return spend->second;
 }
 
 vector<std::string> VtcBlockIndexer::MempoolMonitor::getTxIds() {
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
     vector<std::string> result = {};
-    for (auto kvp : mempoolTransactions) {
-        VtcBlockIndexer::Transaction tx = kvp.second;
-        result.push_back(tx.txHash);
+    for (const auto& kvp : mempoolTransactions) {
+        result.push_back(kvp.second.txHash);
     }
     return result;
 }
+
+size_t VtcBlockIndexer::MempoolMonitor::getTransactionCount() {
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    return mempoolTransactions.size();
+}
+
+double VtcBlockIndexer::MempoolMonitor::getLastUpdateSeconds() {
+    return lastUpdateNanoseconds.load() / 1e9;
+}
+
+int64_t VtcBlockIndexer::MempoolMonitor::getLastUpdateTime() {
+    return lastUpdateTime.load();
+}
  
-vector<VtcBlockIndexer::TransactionOutput> VtcBlockIndexer::MempoolMonitor::getTxos(std::string address) {
-    if(addressMempoolTransactions.find(address) == addressMempoolTransactions.end())
+vector<VtcBlockIndexer::TransactionOutput> VtcBlockIndexer::MempoolMonitor::getTxos(std::string scriptId) {
+    shared_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto txos = addressMempoolTransactions.find(scriptId);
+    if(txos == addressMempoolTransactions.end())
     {
         return {};
     } 
-    return vector<VtcBlockIndexer::TransactionOutput>(addressMempoolTransactions[address]);
+    return txos->second;
 }
 
 void VtcBlockIndexer::MempoolMonitor::transactionIndexed(std::string txid) {
-    if(mempoolTransactions.find(txid) != mempoolTransactions.end()) {
-        mempoolTransactions.erase(txid);
-
-        unordered_map<string, std::vector<VtcBlockIndexer::TransactionOutput>> changedMempoolAddressTxes;
-        for (auto kvp : addressMempoolTransactions) {
-
-            vector<VtcBlockIndexer::TransactionOutput> newVector = {};
-            bool itemsRemoved = false;
-            for (VtcBlockIndexer::TransactionOutput txo : kvp.second) {
-                if(txo.txHash.compare(txid) != 0) {
-                    newVector.push_back(txo);
-                } else {
-                    itemsRemoved = true;
-                }
-            }
-
-            if(itemsRemoved) {
-                changedMempoolAddressTxes[kvp.first] = newVector;
+    unique_lock<shared_timed_mutex> lock(mempoolMutex);
+    auto indexedTx = mempoolTransactions.find(txid);
+    if(indexedTx == mempoolTransactions.end()) return;
+
+    const VtcBlockIndexer::Transaction& tx = indexedTx->second;
+
+    // Only the addresses the transaction pays to can hold its outputs
+    for(const VtcBlockIndexer::TransactionOutput& out : tx.outputs) {
+        for(const string& scriptId : scriptSolver->getScriptIdsFromScript(out.script)) {
+            auto txos = addressMempoolTransactions.find(scriptId);
+            if(txos == addressMempoolTransactions.end()) continue;
+            vector<VtcBlockIndexer::TransactionOutput>& outputs = txos->second;
+            outputs.erase(std::remove_if(outputs.begin(), outputs.end(), [&txid](const VtcBlockIndexer::TransactionOutput& txo) {
+                return txo.txHash == txid;
+            }), outputs.end());
+            if(outputs.empty()) {
+                addressMempoolTransactions.erase(txos);
             }
         }
+    }
 
-        for (auto kvp : changedMempoolAddressTxes) {
-            addressMempoolTransactions[kvp.first] = kvp.second;
+    for(const VtcBlockIndexer::TransactionInput& txi : tx.inputs) {
+        if(txi.coinbase) continue;
+        stringstream outpoint;
+        outpoint << txi.txHash << setw(8) << setfill('0') << txi.txoIndex;
+        auto spend = mempoolSpends.find(outpoint.str());
+        if(spend != mempoolSpends.end() && spend->second == txid) {
+            mempoolSpends.erase(spend);
         }
     }
+
+    mempoolTransactions.erase(indexedTx);
 }
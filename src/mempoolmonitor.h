@@ -18,12 +18,15 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
-#include "vertcoinrpc.h"
-#include <jsonrpccpp/client/connectors/httpclient.h>
+#include "rpcpool.h"
 #include <memory>
 #include "blockreader.h"
 #include "scriptsolver.h"
+#include "subscriptions.h"
 #include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <shared_mutex>
 #ifndef MEMPOOLMONITOR_H_INCLUDED
 #define MEMPOOLMONITOR_H_INCLUDED
 
@@ -38,9 +41,10 @@ namespace VtcBlockIndexer {
 
 class MempoolMonitor {
 public:
-    /** Constructs a MempoolMonitor instance
+    /** Constructs a MempoolMonitor instance reading the mempool through the RPC pool.
+     * New transactions are announced to the subscriptions
      */
-    MempoolMonitor();
+    MempoolMonitor(const shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions, const shared_ptr<VtcBlockIndexer::RpcPool> rpc);
 
     /** Starts watching the mempool for new transactions */
     void startWatcher();
@@ -51,19 +55,46 @@ public:
     /** Returns the spender txid if an outpoint is spent */
     string outpointSpend(string txid, uint32_t vout);
 
-    /** Returns TXOs in the memorypool matching an address */
-    vector<VtcBlockIndexer::TransactionOutput> getTxos(string address);
+    /** Returns TXOs in the memorypool matching a script identifier (see SCRIPT_ID_*) */
+    vector<VtcBlockIndexer::TransactionOutput> getTxos(string scriptId);
 
     /** Returns all TX IDs in the mempool */
     vector<std::string> getTxIds();
+
+    /** Returns the number of transactions in the mempool */
+    size_t getTransactionCount();
+
+    /** Returns the seconds the last update took to read the new transactions
+     * from the node, which is how far the mempool state lags behind the node's */
+    double getLastUpdateSeconds();
+
+    /** Returns the unix time the mempool was last read from the node, 0 if never */
+    int64_t getLastUpdateTime();
     
 private:
-    unique_ptr<VertcoinClient> vertcoind;
-    unique_ptr<jsonrpc::HttpClient> httpClient;
+    /** Adds a transaction read from the node to the mempool state */
+    void addTransaction(const VtcBlockIndexer::Transaction& tx);
+
+    /** Returns true if the transaction is in the mempool state */
+    bool hasTransaction(const string& txid);
+
+    shared_ptr<VtcBlockIndexer::RpcPool> rpc;
+
+    // Guards the maps below. The watcher and the indexer change them while
+    // holding it exclusively, HTTP handlers read them holding it shared.
+    shared_timed_mutex mempoolMutex;
     unordered_map<string, VtcBlockIndexer::Transaction> mempoolTransactions;
+    // Mempool TXOs by script identifier
     unordered_map<string, vector<VtcBlockIndexer::TransactionOutput>> addressMempoolTransactions;
+    // Spending mempool transaction by outpoint (txid + 8 digit vout)
+    unordered_map<string, string> mempoolSpends;
     unique_ptr<VtcBlockIndexer::BlockReader> blockReader;
     unique_ptr<VtcBlockIndexer::ScriptSolver> scriptSolver;
+    shared_ptr<VtcBlockIndexer::SubscriptionManager> subscriptions;
+
+    // Duration in nanoseconds and unix time of the last successful update
+    atomic<int64_t> lastUpdateNanoseconds;
+    atomic<int64_t> lastUpdateTime;
 }; 
 
 }
@@ -0,0 +1,110 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "merkletree.h"
+#include "utility.h"
+#include <algorithm>
+#include <cstring>
+#include <openssl/sha.h>
+
+using namespace std;
+
+VtcBlockIndexer::MerkleTree::MerkleTree(const vector<string>& txids) {
+    // A tree of n leaves has less than 2n + log2(n) hashes with the duplicated odd ones
+    hashes.reserve(txids.size() * 2 + 32);
+    for(const string& txid : txids) {
+        vector<unsigned char> bytes = Utility::hexToBytes(txid);
+        bytes.resize(32);
+        Hash leaf;
+        std::reverse_copy(bytes.begin(), bytes.end(), leaf.begin());
+        hashes.push_back(leaf);
+    }
+
+    layerStarts.push_back(0);
+    size_t layerStart = 0;
+    size_t layerSize = hashes.size();
+    while(layerSize > 1) {
+        for(size_t i = 0; i < layerSize; i += 2) {
+            // An odd last hash is combined with itself
+            unsigned char pair[64];
+            memcpy(pair, hashes[layerStart + i].data(), 32);
+            memcpy(pair + 32, hashes[layerStart + std::min(i + 1, layerSize - 1)].data(), 32);
+            Hash single;
+            Hash parent;
+            SHA256(pair, 64, single.data());
+            SHA256(single.data(), 32, parent.data());
+            hashes.push_back(parent);
+        }
+        layerStart += layerSize;
+        layerSize = (layerSize + 1) / 2;
+        layerStarts.push_back(layerStart);
+    }
+    layerStarts.push_back(hashes.size());
+
+    positionsById.resize(txids.size());
+    for(size_t i = 0; i < positionsById.size(); i++) {
+        positionsById[i] = i;
+    }
+    std::sort(positionsById.begin(), positionsById.end(), [this](uint32_t a, uint32_t b) {
+        return hashes[a] < hashes[b];
+    });
+}
+
+size_t VtcBlockIndexer::MerkleTree::getTransactionCount() const {
+    return positionsById.size();
+}
+
+int64_t VtcBlockIndexer::MerkleTree::findTransaction(const string& txid) const {
+    vector<unsigned char> bytes = Utility::hexToBytes(txid);
+    if(bytes.size() != 32) return -1;
+    Hash leaf;
+    std::reverse_copy(bytes.begin(), bytes.end(), leaf.begin());
+
+    auto found = std::lower_bound(positionsById.begin(), positionsById.end(), leaf, [this](uint32_t position, const Hash& hash) {
+        return hashes[position] < hash;
+    });
+    if(found == positionsById.end() || hashes[*found] != leaf) return -1;
+    return *found;
+}
+
+string VtcBlockIndexer::MerkleTree::getRoot() const {
+    if(hashes.empty()) return "";
+    return toReverseHex(hashes.back());
+}
+
+vector<string> VtcBlockIndexer::MerkleTree::getBranch(size_t position) const {
+    vector<string> branch;
+    // The last layer is the root, it has no sibling
+    for(size_t layer = 0; layer + 2 < layerStarts.size(); layer++) {
+        size_t layerSize = layerStarts[layer + 1] - layerStarts[layer];
+        size_t sibling = std::min(position ^ 1, layerSize - 1);
+        branch.push_back(toReverseHex(hashes[layerStarts[layer] + sibling]));
+        position /= 2;
+    }
+    return branch;
+}
+
+size_t VtcBlockIndexer::MerkleTree::getByteSize() const {
+    return hashes.size() * sizeof(Hash) + layerStarts.size() * sizeof(size_t) + positionsById.size() * sizeof(uint32_t);
+}
+
+string VtcBlockIndexer::MerkleTree::toReverseHex(const Hash& hash) {
+    return Utility::hashToReverseHex(vector<unsigned char>(hash.begin(), hash.end()));
+}
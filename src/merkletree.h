@@ -0,0 +1,96 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MERKLETREE_H_INCLUDED
+#define MERKLETREE_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "lrucache.h"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * The MerkleTree class holds all layers of the merkle tree of a block's transaction
+ * ids, so the branch proving a transaction is in the block can be read without
+ * hashing anything. Hashes are passed in and returned as reverse hex, like the
+ * transaction ids and merkle roots elsewhere.
+ */
+
+class MerkleTree {
+public:
+    /** Builds the tree of the transaction ids, in the order of the block
+     */
+    MerkleTree(const vector<string>& txids);
+
+    /** Returns the number of transactions in the block
+     */
+    size_t getTransactionCount() const;
+
+    /** Returns the position of the transaction in the block, or -1 when it
+     * is not in the block
+     */
+    int64_t findTransaction(const string& txid) const;
+
+    /** Returns the merkle root, which matches the block header's
+     */
+    string getRoot() const;
+
+    /** Returns the hashes the transaction at the position is combined with on
+     * the way up to the root, starting at the bottom. The position tells on which
+     * side each hash goes: bit n set means the n-th hash is on the left
+     */
+    vector<string> getBranch(size_t position) const;
+
+    /** Returns the bytes the tree holds
+     */
+    size_t getByteSize() const;
+
+private:
+    typedef array<unsigned char, 32> Hash;
+
+    static string toReverseHex(const Hash& hash);
+
+    // All layers in one array, the transaction ids first and the root last.
+    // layerStarts has the index of each layer's first hash, and the total
+    // number of hashes at the end
+    vector<Hash> hashes;
+    vector<size_t> layerStarts;
+
+    // Positions of the transactions, ordered by transaction id, to find them
+    // with a binary search
+    vector<uint32_t> positionsById;
+};
+
+/**
+ * Keeps the trees of recently proven blocks in memory by block hash, evicting the
+ * least recently used ones when the total size exceeds the budget. The tree of a
+ * block hash never changes, so entries don't go stale.
+ */
+typedef LruCache<MerkleTree> MerkleTreeCache;
+
+}
+
+#endif // MERKLETREE_H_INCLUDED
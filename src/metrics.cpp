@@ -0,0 +1,290 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "metrics.h"
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+// Maximum number of HTTP endpoints that can be registered
+const int maxEndpoints = 32;
+
+// Upper bounds of the request latency buckets in seconds. The last bucket (+Inf)
+// is implied
+const double requestBuckets[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10 };
+const int requestBucketCount = sizeof(requestBuckets) / sizeof(requestBuckets[0]) + 1;
+
+namespace {
+    // The counts of one thread
+    struct Shard {
+        atomic<uint64_t> counters[VtcBlockIndexer::METRIC_COUNTER_COUNT];
+
+        // Per endpoint the number of requests in each latency bucket (not cumulative)
+        // and the total time taken in nanoseconds
+        atomic<uint64_t> requests[maxEndpoints][requestBucketCount];
+        atomic<uint64_t> requestNanoseconds[maxEndpoints];
+    };
+
+    // Adds to a value only the owning thread writes to, readers may see it
+    // from other threads at any time
+    inline void increment(atomic<uint64_t>& value, uint64_t amount) {
+        value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+    }
+
+    struct Registry {
+        mutex registryMutex;
+        vector<Shard*> shards;
+
+        // Counts of threads that exited, so they aren't lost
+        Shard retired;
+
+        vector<string> endpoints;
+    };
+
+    // Never destroyed, threads still running at exit may use it
+    Registry& registry() {
+        static Registry* instance = new Registry();
+        return *instance;
+    }
+
+    void clear(Shard& shard) {
+        for(auto& counter : shard.counters) counter.store(0);
+        for(auto& endpoint : shard.requests) {
+            for(auto& bucket : endpoint) bucket.store(0);
+        }
+        for(auto& nanoseconds : shard.requestNanoseconds) nanoseconds.store(0);
+    }
+
+    void addTo(Shard& total, const Shard& shard) {
+        for(int i = 0; i < VtcBlockIndexer::METRIC_COUNTER_COUNT; i++) {
+            increment(total.counters[i], shard.counters[i].load(memory_order_relaxed));
+        }
+        for(int i = 0; i < maxEndpoints; i++) {
+            for(int j = 0; j < requestBucketCount; j++) {
+                increment(total.requests[i][j], shard.requests[i][j].load(memory_order_relaxed));
+            }
+            increment(total.requestNanoseconds[i], shard.requestNanoseconds[i].load(memory_order_relaxed));
+        }
+    }
+
+    string formatBound(double bound) {
+        char text[32];
+        snprintf(text, sizeof(text), "%g", bound);
+        return text;
+    }
+
+    // Registers the shard of a thread when it's first used and folds its counts
+    // into the retired shard when the thread exits
+    class ShardHandle {
+    public:
+        ShardHandle() {
+            shard = new Shard();
+            clear(*shard);
+            Registry& shards = registry();
+            lock_guard<mutex> lock(shards.registryMutex);
+            shards.shards.push_back(shard);
+        }
+
+        ~ShardHandle() {
+            Registry& shards = registry();
+            lock_guard<mutex> lock(shards.registryMutex);
+            addTo(shards.retired, *shard);
+            for(auto it = shards.shards.begin(); it != shards.shards.end(); it++) {
+                if(*it == shard) {
+                    shards.shards.erase(it);
+                    break;
+                }
+            }
+            delete shard;
+        }
+
+        Shard* shard;
+    };
+
+    Shard& localShard() {
+        static thread_local ShardHandle handle;
+        return *handle.shard;
+    }
+}
+
+void VtcBlockIndexer::Metrics::add(MetricCounter counter, uint64_t amount) {
+    increment(localShard().counters[counter], amount);
+}
+
+void VtcBlockIndexer::Metrics::addElapsed(MetricCounter counter, chrono::steady_clock::time_point& since) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    add(counter, chrono::duration_cast<chrono::nanoseconds>(now - since).count());
+    since = now;
+}
+
+int VtcBlockIndexer::Metrics::registerEndpoint(const string& name) {
+    Registry& shards = registry();
+    lock_guard<mutex> lock(shards.registryMutex);
+    if(shards.endpoints.size() >= maxEndpoints) {
+        return -1;
+    }
+    shards.endpoints.push_back(name);
+    return shards.endpoints.size() - 1;
+}
+
+void VtcBlockIndexer::Metrics::observeRequest(int endpoint, chrono::steady_clock::duration duration) {
+    if(endpoint < 0 || endpoint >= maxEndpoints) return;
+
+    uint64_t nanoseconds = chrono::duration_cast<chrono::nanoseconds>(duration).count();
+    double seconds = nanoseconds / 1e9;
+    int bucket = 0;
+    while(bucket < requestBucketCount - 1 && seconds > requestBuckets[bucket]) {
+        bucket++;
+    }
+
+    Shard& shard = localShard();
+    increment(shard.requests[endpoint][bucket], 1);
+    increment(shard.requestNanoseconds[endpoint], nanoseconds);
+}
+
+void VtcBlockIndexer::Metrics::renderHeader(string& out, const string& name, const string& type, const string& help) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+void VtcBlockIndexer::Metrics::renderSample(string& out, const string& name, const string& labels, double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.17g", value);
+    out += name;
+    if(!labels.empty()) {
+        out += "{" + labels + "}";
+    }
+    out += " ";
+    out += text;
+    out += "\n";
+}
+
+void VtcBlockIndexer::Metrics::render(string& out) {
+    Shard total;
+    clear(total);
+    vector<string> endpoints;
+    {
+        Registry& shards = registry();
+        lock_guard<mutex> lock(shards.registryMutex);
+        addTo(total, shards.retired);
+        for(const Shard* shard : shards.shards) {
+            addTo(total, *shard);
+        }
+        endpoints = shards.endpoints;
+    }
+
+    auto counter = [&total](MetricCounter metric) {
+        return (double)total.counters[metric].load(memory_order_relaxed);
+    };
+
+    renderHeader(out, "vtc_indexer_blocks_indexed_total", "counter", "Blocks written to the index");
+    renderSample(out, "vtc_indexer_blocks_indexed_total", "", counter(METRIC_BLOCKS_INDEXED));
+    renderHeader(out, "vtc_indexer_transactions_indexed_total", "counter", "Transactions written to the index");
+    renderSample(out, "vtc_indexer_transactions_indexed_total", "", counter(METRIC_TRANSACTIONS_INDEXED));
+
+    renderHeader(out, "vtc_indexer_index_stage_seconds_total", "counter", "Time spent indexing blocks per stage");
+    const pair<const char*, MetricCounter> stages[] = {
+        { "read", METRIC_INDEX_READ_NANOSECONDS },
+        { "solve", METRIC_INDEX_SOLVE_NANOSECONDS },
+        { "resolve", METRIC_INDEX_RESOLVE_NANOSECONDS },
+        { "build", METRIC_INDEX_BUILD_NANOSECONDS },
+        { "write", METRIC_INDEX_WRITE_NANOSECONDS }
+    };
+    for(const auto& stage : stages) {
+        renderSample(out, "vtc_indexer_index_stage_seconds_total", "stage=\"" + string(stage.first) + "\"", counter(stage.second) / 1e9);
+    }
+
+    renderHeader(out, "vtc_indexer_leveldb_gets_total", "counter", "LevelDB point reads");
+    renderSample(out, "vtc_indexer_leveldb_gets_total", "", counter(METRIC_DB_GETS));
+    renderHeader(out, "vtc_indexer_leveldb_iterators_total", "counter", "LevelDB iterators opened for range reads");
+    renderSample(out, "vtc_indexer_leveldb_iterators_total", "", counter(METRIC_DB_ITERATORS));
+    renderHeader(out, "vtc_indexer_leveldb_writes_total", "counter", "LevelDB write batches");
+    renderSample(out, "vtc_indexer_leveldb_writes_total", "", counter(METRIC_DB_WRITES));
+    renderHeader(out, "vtc_indexer_leveldb_written_records_total", "counter", "Transaction records the indexer wrote to LevelDB");
+    renderSample(out, "vtc_indexer_leveldb_written_records_total", "", counter(METRIC_DB_WRITTEN_RECORDS));
+
+    renderHeader(out, "vtc_indexer_mempool_transactions_added_total", "counter", "Transactions read from the node's mempool");
+    renderSample(out, "vtc_indexer_mempool_transactions_added_total", "", counter(METRIC_MEMPOOL_TRANSACTIONS_ADDED));
+
+    renderHeader(out, "vtc_indexer_http_rejected_total", "counter", "HTTP requests rejected because too many were running or waiting");
+    renderSample(out, "vtc_indexer_http_rejected_total", "", counter(METRIC_HTTP_REJECTED));
+    renderHeader(out, "vtc_indexer_http_stopped_total", "counter", "HTTP requests stopped at their deadline or because the client disconnected");
+    renderSample(out, "vtc_indexer_http_stopped_total", "", counter(METRIC_HTTP_STOPPED));
+    renderHeader(out, "vtc_indexer_rpc_calls_total", "counter", "Calls made to the node");
+    renderSample(out, "vtc_indexer_rpc_calls_total", "", counter(METRIC_RPC_CALLS));
+    renderHeader(out, "vtc_indexer_rpc_requests_total", "counter", "HTTP requests sent to the node, a batch of calls counts once");
+    renderSample(out, "vtc_indexer_rpc_requests_total", "", counter(METRIC_RPC_REQUESTS));
+
+    renderHeader(out, "vtc_indexer_http_request_duration_seconds", "histogram", "Time taken to handle HTTP requests per endpoint");
+    for(size_t i = 0; i < endpoints.size(); i++) {
+        string endpointLabel = "endpoint=\"" + endpoints[i] + "\"";
+        uint64_t cumulative = 0;
+        for(int j = 0; j < requestBucketCount; j++) {
+            cumulative += total.requests[i][j].load(memory_order_relaxed);
+            string bound = (j < requestBucketCount - 1) ? formatBound(requestBuckets[j]) : "+Inf";
+            renderSample(out, "vtc_indexer_http_request_duration_seconds_bucket", endpointLabel + ",le=\"" + bound + "\"", cumulative);
+        }
+        renderSample(out, "vtc_indexer_http_request_duration_seconds_sum", endpointLabel, total.requestNanoseconds[i].load(memory_order_relaxed) / 1e9);
+        renderSample(out, "vtc_indexer_http_request_duration_seconds_count", endpointLabel, cumulative);
+    }
+}
+
+void VtcBlockIndexer::Metrics::renderLevelDbStats(string& out, const vector<pair<string, string>>& storeStats) {
+    // The property holds a table like:
+    //                                Compactions
+    // Level  Files Size(MB) Time(sec) Read(MB) Write(MB)
+    // --------------------------------------------------
+    //   0        2        0         0        0         0
+    struct LevelStats {
+        string labels;
+        double files;
+        double sizeMb;
+        double seconds;
+        double readMb;
+        double writtenMb;
+    };
+    vector<LevelStats> levels;
+    for(const auto& store : storeStats) {
+        istringstream lines(store.second);
+        string line;
+        while(getline(lines, line)) {
+            int level;
+            LevelStats stats;
+            if(sscanf(line.c_str(), "%d %lf %lf %lf %lf %lf", &level, &stats.files, &stats.sizeMb, &stats.seconds, &stats.readMb, &stats.writtenMb) == 6) {
+                stats.labels = "store=\"" + store.first + "\",level=\"" + std::to_string(level) + "\"";
+                levels.push_back(stats);
+            }
+        }
+    }
+
+    const double megabyte = 1048576;
+    renderHeader(out, "vtc_indexer_leveldb_level_files", "gauge", "Table files per LevelDB level");
+    for(const LevelStats& stats : levels) renderSample(out, "vtc_indexer_leveldb_level_files", stats.labels, stats.files);
+    renderHeader(out, "vtc_indexer_leveldb_level_size_bytes", "gauge", "Size of the tables per LevelDB level");
+    for(const LevelStats& stats : levels) renderSample(out, "vtc_indexer_leveldb_level_size_bytes", stats.labels, stats.sizeMb * megabyte);
+    renderHeader(out, "vtc_indexer_leveldb_level_compaction_seconds", "gauge", "Time spent compacting into the level since the store was opened");
+    for(const LevelStats& stats : levels) renderSample(out, "vtc_indexer_leveldb_level_compaction_seconds", stats.labels, stats.seconds);
+    renderHeader(out, "vtc_indexer_leveldb_level_compaction_read_bytes", "gauge", "Bytes read by compactions into the level since the store was opened");
+    for(const LevelStats& stats : levels) renderSample(out, "vtc_indexer_leveldb_level_compaction_read_bytes", stats.labels, stats.readMb * megabyte);
+    renderHeader(out, "vtc_indexer_leveldb_level_compaction_written_bytes", "gauge", "Bytes written by compactions into the level since the store was opened");
+    for(const LevelStats& stats : levels) renderSample(out, "vtc_indexer_leveldb_level_compaction_written_bytes", stats.labels, stats.writtenMb * megabyte);
+}
@@ -0,0 +1,118 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+enum MetricCounter {
+    METRIC_BLOCKS_INDEXED = 0,
+    METRIC_TRANSACTIONS_INDEXED,
+
+    // Time spent per stage of indexing a block, in nanoseconds
+    METRIC_INDEX_READ_NANOSECONDS,
+    METRIC_INDEX_SOLVE_NANOSECONDS,
+    METRIC_INDEX_RESOLVE_NANOSECONDS,
+    METRIC_INDEX_BUILD_NANOSECONDS,
+    METRIC_INDEX_WRITE_NANOSECONDS,
+
+    // LevelDB point reads, iterators opened, batches written and the transaction
+    // records the indexer wrote in them
+    METRIC_DB_GETS,
+    METRIC_DB_ITERATORS,
+    METRIC_DB_WRITES,
+    METRIC_DB_WRITTEN_RECORDS,
+
+    METRIC_MEMPOOL_TRANSACTIONS_ADDED,
+
+    // HTTP requests rejected because the endpoint's queue was full (or they timed out
+    // waiting in it), and requests stopped at their deadline or disconnect
+    METRIC_HTTP_REJECTED,
+    METRIC_HTTP_STOPPED,
+
+    // Calls made to the node and the HTTP requests (single calls or batches) they
+    // were sent in
+    METRIC_RPC_CALLS,
+    METRIC_RPC_REQUESTS,
+
+    METRIC_COUNTER_COUNT
+};
+
+/**
+ * The Metrics class keeps the counters and request latency histograms exposed on
+ * /metrics. Every thread counts into its own shard, which only that thread writes
+ * to, so counting is a plain load and store without any locked instruction or
+ * shared cache line. The shards are only summed when the metrics are scraped.
+ */
+
+class Metrics {
+public:
+    /** Adds to a counter
+     */
+    static void add(MetricCounter counter, uint64_t amount = 1);
+
+    /** Adds the nanoseconds elapsed since the passed time to a counter, and sets
+     * the time to now so the next stage can be timed from there
+     */
+    static void addElapsed(MetricCounter counter, chrono::steady_clock::time_point& since);
+
+    /** Registers an HTTP endpoint and returns the number to record its requests
+     * with. Must be called before requests are served
+     */
+    static int registerEndpoint(const string& name);
+
+    /** Records a request to the endpoint that took the given time
+     */
+    static void observeRequest(int endpoint, chrono::steady_clock::duration duration);
+
+    /** Appends the counters and histograms in the Prometheus text format
+     */
+    static void render(string& out);
+
+    /** Appends the HELP and TYPE lines of a metric
+     */
+    static void renderHeader(string& out, const string& name, const string& type, const string& help);
+
+    /** Appends a sample. Labels are passed formatted, e.g. store="chain", or empty
+     */
+    static void renderSample(string& out, const string& name, const string& labels, double value);
+
+    /** Appends the per level tables of the leveldb.stats property of the stores
+     * (store name and property value) as gauges
+     */
+    static void renderLevelDbStats(string& out, const vector<pair<string, string>>& storeStats);
+
+private:
+    Metrics() {}
+};
+
+}
+
+#endif // METRICS_H_INCLUDED
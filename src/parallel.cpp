@@ -0,0 +1,92 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "parallel.h"
+
+using namespace std;
+
+namespace {
+    thread_local bool workerThread = false;
+}
+
+VtcBlockIndexer::WorkerPool& VtcBlockIndexer::WorkerPool::instance() {
+    // The threads are never stopped, the pool is left allocated at exit
+    static WorkerPool* pool = new WorkerPool();
+    return *pool;
+}
+
+VtcBlockIndexer::WorkerPool::WorkerPool() {
+    threadCount = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    for(size_t i = 0; i < threadCount; i++) {
+        std::thread(&WorkerPool::runWorker, this).detach();
+    }
+}
+
+size_t VtcBlockIndexer::WorkerPool::getThreadCount() {
+    return threadCount;
+}
+
+bool VtcBlockIndexer::WorkerPool::isWorkerThread() {
+    return workerThread;
+}
+
+void VtcBlockIndexer::WorkerPool::submit(packaged_task<void()> task) {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        queue.push_back(std::move(task));
+    }
+    queueCondition.notify_one();
+}
+
+bool VtcBlockIndexer::WorkerPool::runQueued() {
+    packaged_task<void()> task;
+    {
+        lock_guard<mutex> lock(queueMutex);
+        if(queue.empty()) return false;
+        task = std::move(queue.front());
+        queue.pop_front();
+    }
+    // Exceptions are stored in the task's future
+    task();
+    return true;
+}
+
+void VtcBlockIndexer::WorkerPool::wait(future<void>& result) {
+    while(result.wait_for(chrono::seconds(0)) != future_status::ready) {
+        if(!runQueued()) {
+            result.wait();
+        }
+    }
+    result.get();
+}
+
+void VtcBlockIndexer::WorkerPool::runWorker() {
+    workerThread = true;
+    while(true) {
+        packaged_task<void()> task;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this]() { return !queue.empty(); });
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
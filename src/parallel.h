@@ -0,0 +1,126 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PARALLEL_H_INCLUDED
+#define PARALLEL_H_INCLUDED
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace VtcBlockIndexer {
+
+/**
+ * The WorkerPool class runs tasks on threads that live as long as the process,
+ * one per hardware thread besides the callers. Use it through runInChunks.
+ */
+
+class WorkerPool {
+public:
+    /** Returns the pool, starting its threads on first use
+     */
+    static WorkerPool& instance();
+
+    /** Returns the number of threads of the pool
+     */
+    size_t getThreadCount();
+
+    /** Queues a task
+     */
+    void submit(std::packaged_task<void()> task);
+
+    /** Waits for the result while running queued tasks on the calling thread, so
+     * a caller never waits on tasks that nobody runs. Rethrows the task's exception
+     */
+    void wait(std::future<void>& result);
+
+    /** Returns true on the pool's own threads
+     */
+    static bool isWorkerThread();
+
+private:
+    WorkerPool();
+
+    /** Runs a queued task, if there is one. Returns false when the queue is empty
+     */
+    bool runQueued();
+
+    void runWorker();
+
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<std::packaged_task<void()>> queue;
+    size_t threadCount;
+};
+
+/**
+ * Splits [0, count) into one chunk per hardware thread, as long as every chunk
+ * gets at least minChunk items, and runs work(begin, end) on each of them. The
+ * first chunk runs on the calling thread, the others on the WorkerPool. Returns
+ * when all chunks are done, rethrowing the first exception a chunk threw.
+ */
+template<typename Work>
+void runInChunks(size_t count, size_t minChunk, Work work) {
+    WorkerPool& pool = WorkerPool::instance();
+    size_t threads = pool.getThreadCount() + 1;
+    threads = std::min(threads, std::max((size_t)1, count / minChunk));
+    if(threads <= 1 || WorkerPool::isWorkerThread()) {
+        work(0, count);
+        return;
+    }
+
+    size_t chunkSize = (count + threads - 1) / threads;
+    std::vector<std::future<void>> results;
+    for(size_t begin = chunkSize; begin < count; begin += chunkSize) {
+        size_t end = std::min(count, begin + chunkSize);
+        std::packaged_task<void()> task([&work, begin, end]() { work(begin, end); });
+        results.push_back(task.get_future());
+        pool.submit(std::move(task));
+    }
+
+    // The chunks use the caller's state, so all of them finish before an
+    // exception is passed on
+    std::exception_ptr error;
+    try {
+        work(0, chunkSize);
+    } catch(...) {
+        error = std::current_exception();
+    }
+    for(std::future<void>& result : results) {
+        try {
+            pool.wait(result);
+        } catch(...) {
+            if(!error) error = std::current_exception();
+        }
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}
+
+#endif // PARALLEL_H_INCLUDED
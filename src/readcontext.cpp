@@ -0,0 +1,120 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "readcontext.h"
+#include "metrics.h"
+
+using namespace std;
+
+VtcBlockIndexer::ReadContext::ReadContext(const shared_ptr<VtcBlockIndexer::Database> database) {
+    this->database = database;
+    database->beginRead();
+
+    // Chain first: blocks in the chain snapshot were completely written to the
+    // other stores before it was taken
+    for(int i = 0; i < STORE_COUNT; i++) {
+        dbs[i] = database->get((DatabaseStore)i);
+        snapshots[i] = dbs[i]->GetSnapshot();
+    }
+    tipHeight = unreadTipHeight;
+}
+
+VtcBlockIndexer::ReadContext::~ReadContext() {
+    // Iterators pin the snapshot's memtables and files, so they go first
+    for(int i = 0; i < STORE_COUNT; i++) {
+        idleIterators[i].clear();
+        iterators[i].clear();
+        dbs[i]->ReleaseSnapshot(snapshots[i]);
+        dbs[i].reset();
+    }
+    database->endRead();
+}
+
+leveldb::ReadOptions VtcBlockIndexer::ReadContext::readOptions(DatabaseStore store) {
+    leveldb::ReadOptions options;
+    options.snapshot = snapshots[store];
+    return options;
+}
+
+leveldb::Status VtcBlockIndexer::ReadContext::get(DatabaseStore store, const string& key, string* value) {
+    Metrics::add(METRIC_DB_GETS);
+    return dbs[store]->Get(readOptions(store), key, value);
+}
+
+bool VtcBlockIndexer::ReadContext::getProperty(DatabaseStore store, const string& property, string* value) {
+    return dbs[store]->GetProperty(property, value);
+}
+
+VtcBlockIndexer::ReadContext::Iterator VtcBlockIndexer::ReadContext::iterator(DatabaseStore store) {
+    Metrics::add(METRIC_DB_ITERATORS);
+    lock_guard<mutex> lock(iteratorsMutex);
+    leveldb::Iterator* it;
+    if(idleIterators[store].empty()) {
+        it = dbs[store]->NewIterator(readOptions(store));
+        iterators[store].emplace_back(it);
+    } else {
+        it = idleIterators[store].back();
+        idleIterators[store].pop_back();
+    }
+    return Iterator(this, store, it);
+}
+
+int64_t VtcBlockIndexer::ReadContext::getTipHeight() {
+    int64_t height = tipHeight.load(memory_order_relaxed);
+    if(height != unreadTipHeight) {
+        return height;
+    }
+
+    // Read from the chain snapshot on first use. Threads racing here read the
+    // same value, so it doesn't matter which one stores it
+    string highestBlock;
+    leveldb::Status s = get(STORE_CHAIN, "highestblock", &highestBlock);
+    height = s.ok() ? stoll(highestBlock) : -1;
+    tipHeight.store(height, memory_order_relaxed);
+    return height;
+}
+
+void VtcBlockIndexer::ReadContext::release(DatabaseStore store, leveldb::Iterator* it) {
+    lock_guard<mutex> lock(iteratorsMutex);
+    idleIterators[store].push_back(it);
+}
+
+VtcBlockIndexer::ReadContext::Iterator::Iterator(ReadContext* context, DatabaseStore store, leveldb::Iterator* it) {
+    this->context = context;
+    this->store = store;
+    this->it = it;
+}
+
+VtcBlockIndexer::ReadContext::Iterator::Iterator(Iterator&& other) {
+    this->context = other.context;
+    this->store = other.store;
+    this->it = other.it;
+    other.it = NULL;
+}
+
+VtcBlockIndexer::ReadContext::Iterator::~Iterator() {
+    if(it != NULL) {
+        context->release(store, it);
+    }
+}
+
+leveldb::Iterator* VtcBlockIndexer::ReadContext::Iterator::operator->() const {
+    return it;
+}
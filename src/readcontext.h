@@ -0,0 +1,127 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef READCONTEXT_H_INCLUDED
+#define READCONTEXT_H_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "leveldb/db.h"
+#include "database.h"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * The ReadContext class gives a request a consistent view of the index. It pins
+ * a snapshot of every store for its lifetime, so all reads of one request see the
+ * same chain tip, and hands out iterators on those snapshots from a pool that is
+ * cleaned up when the context goes out of scope.
+ *
+ * The indexer writes the chain store last, so the chain snapshot is taken first:
+ * every block in it is complete in the other stores. The other stores may already
+ * hold (part of) the block after the tip; getTipHeight() can be used to skip it.
+ *
+ * get() and iterator() may be called from several threads at once, an
+ * individual iterator must only be used by one thread at a time.
+ */
+
+class ReadContext {
+public:
+    /** An iterator on the snapshot of a store. Goes back to the pool of its
+     * context when it goes out of scope. Must not outlive the context.
+     */
+    class Iterator {
+    public:
+        Iterator(Iterator&& other);
+        ~Iterator();
+        leveldb::Iterator* operator->() const;
+
+    private:
+        friend class ReadContext;
+        Iterator(ReadContext* context, DatabaseStore store, leveldb::Iterator* it);
+        Iterator(const Iterator&) = delete;
+        Iterator& operator=(const Iterator&) = delete;
+
+        ReadContext* context;
+        DatabaseStore store;
+        leveldb::Iterator* it;
+    };
+
+    /** Takes the snapshots of all stores. Waits while the database reopens them
+     */
+    ReadContext(const shared_ptr<VtcBlockIndexer::Database> database);
+
+    /** Deletes the iterators and releases the snapshots
+     */
+    ~ReadContext();
+
+    /** Reads a key from the snapshot of the store
+     */
+    leveldb::Status get(DatabaseStore store, const string& key, string* value);
+
+    /** Returns an unpositioned iterator on the snapshot of the store. Reuses an
+     * iterator that was returned to the pool earlier if there is one.
+     */
+    Iterator iterator(DatabaseStore store);
+
+    /** Reads a LevelDB property (such as leveldb.stats) of the store
+     */
+    bool getProperty(DatabaseStore store, const string& property, string* value);
+
+    /** Returns the height of the highest block in the snapshot, or -1 when
+     * the index is empty. Read from the snapshot on the first call
+     */
+    int64_t getTipHeight();
+
+private:
+    ReadContext(const ReadContext&) = delete;
+    ReadContext& operator=(const ReadContext&) = delete;
+
+    /** Puts an iterator back in the pool
+     */
+    void release(DatabaseStore store, leveldb::Iterator* it);
+
+    leveldb::ReadOptions readOptions(DatabaseStore store);
+
+    // The database can't reopen the stores while this context holds them
+    shared_ptr<VtcBlockIndexer::Database> database;
+    shared_ptr<leveldb::DB> dbs[STORE_COUNT];
+    const leveldb::Snapshot* snapshots[STORE_COUNT];
+
+    // All iterators created by this context, and the ones not currently in use.
+    // Guarded by iteratorsMutex
+    mutex iteratorsMutex;
+    vector<unique_ptr<leveldb::Iterator>> iterators[STORE_COUNT];
+    vector<leveldb::Iterator*> idleIterators[STORE_COUNT];
+
+    // The tip height once it was read, unreadTipHeight before
+    static const int64_t unreadTipHeight = -2;
+    atomic<int64_t> tipHeight;
+};
+
+}
+
+#endif // READCONTEXT_H_INCLUDED
@@ -0,0 +1,145 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "requestlimiter.h"
+#include "metrics.h"
+
+using namespace std;
+
+namespace {
+    // The request whose handler the thread is running
+    thread_local shared_ptr<VtcBlockIndexer::RequestState> currentRequest;
+}
+
+VtcBlockIndexer::RequestState::RequestState(const shared_ptr<Session> session, const shared_ptr<VtcBlockIndexer::RequestLimiter> limiter, chrono::steady_clock::time_point arrival, chrono::steady_clock::time_point deadline) {
+    this->session = session;
+    this->limiter = limiter;
+    this->arrival = arrival;
+    this->deadline = deadline;
+    this->wasStopped = false;
+}
+
+VtcBlockIndexer::RequestState::~RequestState() {
+    // The last reference goes away once the response is complete, also when it
+    // was sent from a callback after the handler returned
+    Metrics::observeRequest(limiter->endpoint, chrono::steady_clock::now() - arrival);
+    limiter->release();
+}
+
+bool VtcBlockIndexer::RequestState::stopped() {
+    if(wasStopped.load(memory_order_relaxed)) return true;
+
+    bool stop = (chrono::steady_clock::now() >= deadline);
+    if(!stop) {
+        // A disconnect is only noticed once the service reads from or writes to the
+        // connection, a closed session always means the response can't be sent anymore
+        shared_ptr<Session> requestSession = session.lock();
+        stop = (!requestSession || requestSession->is_closed());
+    }
+    if(stop && !wasStopped.exchange(true)) {
+        Metrics::add(METRIC_HTTP_STOPPED);
+    }
+    return stop;
+}
+
+string VtcBlockIndexer::RequestState::getStopReason() {
+    if(chrono::steady_clock::now() >= deadline) {
+        return "The request took longer than " + std::to_string(limiter->timeout.count() / 1000) + " seconds";
+    }
+    return "The connection was closed";
+}
+
+shared_ptr<VtcBlockIndexer::RequestState> VtcBlockIndexer::RequestState::current() {
+    return currentRequest;
+}
+
+VtcBlockIndexer::RequestLimiter::RequestLimiter(int endpoint, size_t maxConcurrent, size_t maxQueued, chrono::milliseconds timeout, const function<void(const shared_ptr<Session>, const string&)>& reject) {
+    this->endpoint = endpoint;
+    this->maxConcurrent = maxConcurrent;
+    this->maxQueued = maxQueued;
+    this->timeout = timeout;
+    this->reject = reject;
+    this->running = 0;
+}
+
+void VtcBlockIndexer::RequestLimiter::admit(const shared_ptr<Session> session, const Handler& handler) {
+    chrono::steady_clock::time_point arrival = chrono::steady_clock::now();
+    {
+        unique_lock<mutex> lock(limiterMutex);
+        if(maxConcurrent == 0 || running < maxConcurrent) {
+            running++;
+        } else if(queue.size() < maxQueued) {
+            queue.push_back({ session, handler, arrival });
+            return;
+        } else {
+            lock.unlock();
+            Metrics::add(METRIC_HTTP_REJECTED);
+            reject(session, "Too many requests, try again later");
+            return;
+        }
+    }
+    run(session, handler, arrival);
+}
+
+void VtcBlockIndexer::RequestLimiter::run(const shared_ptr<Session> session, const Handler& handler, chrono::steady_clock::time_point arrival) {
+    shared_ptr<RequestState> state = make_shared<RequestState>(session, shared_from_this(), arrival, arrival + timeout);
+    currentRequest = state;
+    try {
+        handler(session);
+    } catch(...) {
+        currentRequest.reset();
+        throw;
+    }
+    // The slot is released here, unless the handler kept the state for a callback
+    currentRequest.reset();
+}
+
+void VtcBlockIndexer::RequestLimiter::release() {
+    while(true) {
+        QueuedRequest next;
+        {
+            lock_guard<mutex> lock(limiterMutex);
+            if(queue.empty()) {
+                running--;
+                return;
+            }
+            next = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        shared_ptr<Session> session = std::move(next.session);
+        if(session->is_closed()) continue;
+        if(chrono::steady_clock::now() >= next.arrival + timeout) {
+            Metrics::add(METRIC_HTTP_REJECTED);
+            reject(session, "Too many requests, try again later");
+            continue;
+        }
+
+        // The slot goes to the queued request. Its handler runs on a worker thread
+        // of the service rather than on this one, which is finishing another request
+        shared_ptr<RequestLimiter> limiter = shared_from_this();
+        Handler handler = next.handler;
+        chrono::steady_clock::time_point arrival = next.arrival;
+        session->sleep_for(chrono::milliseconds(0), [limiter, handler, arrival](const shared_ptr<Session> session) {
+            limiter->run(session, handler, arrival);
+        });
+        return;
+    }
+}
@@ -0,0 +1,141 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef REQUESTLIMITER_H_INCLUDED
+#define REQUESTLIMITER_H_INCLUDED
+
+#include <restbed>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+using namespace restbed;
+
+namespace VtcBlockIndexer {
+
+class RequestLimiter;
+
+/**
+ * The RequestState class is the admission of a request by a RequestLimiter. It
+ * holds a slot of the limiter until the last reference to it goes away, so handlers
+ * that continue in callbacks (streams, request bodies) keep a reference until they
+ * are done. Long running handlers check stopped() in their loops. stopped() may
+ * be called from several threads at once.
+ */
+
+class RequestState {
+public:
+    RequestState(const shared_ptr<Session> session, const shared_ptr<RequestLimiter> limiter, chrono::steady_clock::time_point arrival, chrono::steady_clock::time_point deadline);
+
+    /** Records the time since the request arrived in the metrics of the endpoint,
+     * and gives the slot to the next queued request or frees it
+     */
+    ~RequestState();
+
+    /** Returns true when the handler should stop working on the request, because
+     * its deadline passed or the connection was closed
+     */
+    bool stopped();
+
+    /** Returns why the request was stopped, to send to the client
+     */
+    string getStopReason();
+
+    /** Returns the request the calling thread is handling. Only set while the
+     * handler passed to RequestLimiter::admit runs, callbacks have to keep the
+     * state themselves
+     */
+    static shared_ptr<RequestState> current();
+
+private:
+    friend class RequestLimiter;
+
+    weak_ptr<Session> session;
+    shared_ptr<RequestLimiter> limiter;
+    chrono::steady_clock::time_point arrival;
+    chrono::steady_clock::time_point deadline;
+
+    // Set once stopped() returned true, so the request is counted once
+    atomic<bool> wasStopped;
+};
+
+/**
+ * The RequestLimiter class limits the number of requests of an endpoint handled at
+ * the same time. Requests over the limit wait in a queue without holding a worker
+ * thread, and are rejected when the queue is full. Every admitted request gets a
+ * deadline.
+ */
+
+class RequestLimiter : public enable_shared_from_this<RequestLimiter> {
+public:
+    typedef function<void(const shared_ptr<Session>)> Handler;
+
+    /** Constructs a limiter for the endpoint registered in the metrics, running at most
+     * maxConcurrent requests at once (0 for no limit) with up to maxQueued waiting.
+     * Requests that can't be queued, or are still queued at their deadline, are passed
+     * to reject with the reason
+     */
+    RequestLimiter(int endpoint, size_t maxConcurrent, size_t maxQueued, chrono::milliseconds timeout, const function<void(const shared_ptr<Session>, const string&)>& reject);
+
+    /** Runs the handler for the request now if there's a free slot, later when a
+     * running request finishes if there isn't, or rejects the request
+     */
+    void admit(const shared_ptr<Session> session, const Handler& handler);
+
+private:
+    friend class RequestState;
+
+    // The queued request holds its session, so the connection stays open until it
+    // is answered or rejected
+    struct QueuedRequest {
+        shared_ptr<Session> session;
+        Handler handler;
+        chrono::steady_clock::time_point arrival;
+    };
+
+    /** Runs the handler with a new RequestState holding the slot
+     */
+    void run(const shared_ptr<Session> session, const Handler& handler, chrono::steady_clock::time_point arrival);
+
+    /** Called when a request finishes. Hands the slot to the first queued request
+     * that is still waiting, or frees it
+     */
+    void release();
+
+    int endpoint;
+    size_t maxConcurrent;
+    size_t maxQueued;
+    chrono::milliseconds timeout;
+    function<void(const shared_ptr<Session>, const string&)> reject;
+
+    // Guards running and queue
+    mutex limiterMutex;
+    size_t running;
+    deque<QueuedRequest> queue;
+};
+
+}
+
+#endif // REQUESTLIMITER_H_INCLUDED
@@ -0,0 +1,71 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RESPONSECACHE_H_INCLUDED
+#define RESPONSECACHE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "lrucache.h"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * A place in a cached body where fields that change with the tip are filled in
+ * when it is served. The offset is right after the opening brace of an object,
+ * so the fields are written followed by a comma.
+ */
+struct TipFieldSlot {
+    size_t offset;
+
+    // The output whose spend goes here, or an empty txHash for the confirmations
+    string txHash;
+    uint32_t vout;
+};
+
+/**
+ * A response that only depends on the contents of a block, kept as JSON text.
+ * Fields that change with the tip (confirmations, spends) are left out and
+ * inserted at their slots when it is served.
+ */
+struct CachedResponse {
+    string body;
+
+    // In the order of their offsets
+    vector<TipFieldSlot> slots;
+
+    // The block the response was built from. When it is no longer in the
+    // chain at this height, the entry is stale.
+    string blockHash;
+    uint64_t blockHeight;
+};
+
+/**
+ * Keeps recently built responses in memory, evicting the least recently used ones
+ * when the total size exceeds the budget.
+ */
+typedef LruCache<CachedResponse> ResponseCache;
+
+}
+
+#endif // RESPONSECACHE_H_INCLUDED
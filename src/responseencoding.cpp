@@ -0,0 +1,293 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "responseencoding.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+using json = nlohmann::json;
+
+VtcBlockIndexer::ResponseEncoding VtcBlockIndexer::ResponseEncoder::fromAcceptHeader(const string& accept) {
+    stringstream ss(accept);
+    string mediaType;
+    while(getline(ss, mediaType, ',')) {
+        // Drop parameters (such as q=0.9) and surrounding whitespace
+        mediaType = mediaType.substr(0, mediaType.find(';'));
+        mediaType.erase(std::remove_if(mediaType.begin(), mediaType.end(), ::isspace), mediaType.end());
+        std::transform(mediaType.begin(), mediaType.end(), mediaType.begin(), ::tolower);
+
+        if(mediaType == "application/cbor") {
+            return ENCODING_CBOR;
+        }
+        if(mediaType == "application/msgpack" || mediaType == "application/x-msgpack") {
+            return ENCODING_MSGPACK;
+        }
+        if(mediaType == "application/json") {
+            return ENCODING_JSON;
+        }
+    }
+    return ENCODING_JSON;
+}
+
+string VtcBlockIndexer::ResponseEncoder::contentType(ResponseEncoding encoding) {
+    switch(encoding) {
+        case ENCODING_CBOR:
+            return "application/cbor";
+        case ENCODING_MSGPACK:
+            return "application/msgpack";
+        default:
+            return "application/json";
+    }
+}
+
+string VtcBlockIndexer::ResponseEncoder::encode(const json& body, ResponseEncoding encoding, bool rawHashes) {
+    string out;
+    switch(encoding) {
+        case ENCODING_CBOR:
+            writeCbor(body, rawHashes, false, out);
+            return out;
+        case ENCODING_MSGPACK:
+            writeMsgpack(body, rawHashes, false, out);
+            return out;
+        default:
+            return body.dump();
+    }
+}
+
+bool VtcBlockIndexer::ResponseEncoder::isHashKey(const string& key) {
+    // "tx" is the list of transaction ids of a block. Raw transactions under
+    // the same key are longer than a hash, so they are left alone.
+    return key == "hash" || key == "txid" || key == "txhash" || key == "txHash" ||
+           key == "blockhash" || key == "blockHash" || key == "previousBlockHash" ||
+           key == "merkleRoot" || key == "spender" || key == "spentTxId" ||
+           key == "spentBlock" || key == "tx";
+}
+
+string VtcBlockIndexer::ResponseEncoder::hashBytes(const json& j) {
+    if(!j.is_string()) return "";
+    const string& hex = j.get_ref<const string&>();
+    if(hex.size() != 64) return "";
+
+    string bytes(32, '\0');
+    for(size_t i = 0; i < 32; i++) {
+        int value = 0;
+        for(size_t k = 0; k < 2; k++) {
+            char c = hex[i * 2 + k];
+            value <<= 4;
+            if(c >= '0' && c <= '9') value |= c - '0';
+            else if(c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else return "";
+        }
+        bytes[i] = (char)value;
+    }
+    return bytes;
+}
+
+void VtcBlockIndexer::ResponseEncoder::writeBigEndian(uint64_t value, int bytes, string& out) {
+    for(int i = bytes - 1; i >= 0; i--) {
+        out.push_back((char)((value >> (i * 8)) & 0xFF));
+    }
+}
+
+void VtcBlockIndexer::ResponseEncoder::writeCborHead(unsigned char majorType, uint64_t value, string& out) {
+    unsigned char major = majorType << 5;
+    if(value < 24) {
+        out.push_back((char)(major | value));
+    } else if(value <= 0xFF) {
+        out.push_back((char)(major | 24));
+        writeBigEndian(value, 1, out);
+    } else if(value <= 0xFFFF) {
+        out.push_back((char)(major | 25));
+        writeBigEndian(value, 2, out);
+    } else if(value <= 0xFFFFFFFF) {
+        out.push_back((char)(major | 26));
+        writeBigEndian(value, 4, out);
+    } else {
+        out.push_back((char)(major | 27));
+        writeBigEndian(value, 8, out);
+    }
+}
+
+void VtcBlockIndexer::ResponseEncoder::writeCbor(const json& j, bool rawHashes, bool isHash, string& out) {
+    switch(j.type()) {
+        case json::value_t::null:
+            out.push_back((char)0xF6);
+            break;
+        case json::value_t::boolean:
+            out.push_back((char)(j.get<bool>() ? 0xF5 : 0xF4));
+            break;
+        case json::value_t::number_unsigned:
+            writeCborHead(0, j.get<uint64_t>(), out);
+            break;
+        case json::value_t::number_integer: {
+            int64_t value = j.get<int64_t>();
+            if(value >= 0) {
+                writeCborHead(0, (uint64_t)value, out);
+            } else {
+                writeCborHead(1, (uint64_t)(-1 - value), out);
+            }
+            break;
+        }
+        case json::value_t::number_float: {
+            double value = j.get<double>();
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            out.push_back((char)0xFB);
+            writeBigEndian(bits, 8, out);
+            break;
+        }
+        case json::value_t::string: {
+            string bytes = (rawHashes && isHash ? hashBytes(j) : "");
+            if(!bytes.empty()) {
+                writeCborHead(2, bytes.size(), out);
+                out.append(bytes);
+            } else {
+                const string& value = j.get_ref<const string&>();
+                writeCborHead(3, value.size(), out);
+                out.append(value);
+            }
+            break;
+        }
+        case json::value_t::array:
+            writeCborHead(4, j.size(), out);
+            for(const json& element : j) {
+                writeCbor(element, rawHashes, isHash, out);
+            }
+            break;
+        case json::value_t::object:
+            writeCborHead(5, j.size(), out);
+            for(json::const_iterator it = j.begin(); it != j.end(); ++it) {
+                writeCborHead(3, it.key().size(), out);
+                out.append(it.key());
+                writeCbor(it.value(), rawHashes, isHashKey(it.key()), out);
+            }
+            break;
+        default:
+            // Discarded values don't occur in responses, send them as undefined
+            out.push_back((char)0xF7);
+            break;
+    }
+}
+
+void VtcBlockIndexer::ResponseEncoder::writeMsgpackLength(unsigned char fixType, size_t fixLimit, unsigned char type8, unsigned char type16, unsigned char type32, size_t length, string& out) {
+    if(length < fixLimit) {
+        out.push_back((char)(fixType | length));
+    } else if(type8 != 0 && length <= 0xFF) {
+        out.push_back((char)type8);
+        writeBigEndian(length, 1, out);
+    } else if(length <= 0xFFFF) {
+        out.push_back((char)type16);
+        writeBigEndian(length, 2, out);
+    } else {
+        out.push_back((char)type32);
+        writeBigEndian(length, 4, out);
+    }
+}
+
+void VtcBlockIndexer::ResponseEncoder::writeMsgpack(const json& j, bool rawHashes, bool isHash, string& out) {
+    switch(j.type()) {
+        case json::value_t::null:
+            out.push_back((char)0xC0);
+            break;
+        case json::value_t::boolean:
+            out.push_back((char)(j.get<bool>() ? 0xC3 : 0xC2));
+            break;
+        case json::value_t::number_unsigned:
+        case json::value_t::number_integer: {
+            if(j.is_number_unsigned() || j.get<int64_t>() >= 0) {
+                uint64_t value = j.get<uint64_t>();
+                if(value < 128) {
+                    out.push_back((char)value);
+                } else if(value <= 0xFF) {
+                    out.push_back((char)0xCC);
+                    writeBigEndian(value, 1, out);
+                } else if(value <= 0xFFFF) {
+                    out.push_back((char)0xCD);
+                    writeBigEndian(value, 2, out);
+                } else if(value <= 0xFFFFFFFF) {
+                    out.push_back((char)0xCE);
+                    writeBigEndian(value, 4, out);
+                } else {
+                    out.push_back((char)0xCF);
+                    writeBigEndian(value, 8, out);
+                }
+            } else {
+                int64_t value = j.get<int64_t>();
+                if(value >= -32) {
+                    out.push_back((char)value);
+                } else if(value >= -128) {
+                    out.push_back((char)0xD0);
+                    writeBigEndian((uint64_t)value, 1, out);
+                } else if(value >= -32768) {
+                    out.push_back((char)0xD1);
+                    writeBigEndian((uint64_t)value, 2, out);
+                } else if(value >= -2147483648LL) {
+                    out.push_back((char)0xD2);
+                    writeBigEndian((uint64_t)value, 4, out);
+                } else {
+                    out.push_back((char)0xD3);
+                    writeBigEndian((uint64_t)value, 8, out);
+                }
+            }
+            break;
+        }
+        case json::value_t::number_float: {
+            double value = j.get<double>();
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            out.push_back((char)0xCB);
+            writeBigEndian(bits, 8, out);
+            break;
+        }
+        case json::value_t::string: {
+            string bytes = (rawHashes && isHash ? hashBytes(j) : "");
+            if(!bytes.empty()) {
+                out.push_back((char)0xC4);
+                writeBigEndian(bytes.size(), 1, out);
+                out.append(bytes);
+            } else {
+                const string& value = j.get_ref<const string&>();
+                writeMsgpackLength(0xA0, 32, 0xD9, 0xDA, 0xDB, value.size(), out);
+                out.append(value);
+            }
+            break;
+        }
+        case json::value_t::array:
+            writeMsgpackLength(0x90, 16, 0, 0xDC, 0xDD, j.size(), out);
+            for(const json& element : j) {
+                writeMsgpack(element, rawHashes, isHash, out);
+            }
+            break;
+        case json::value_t::object:
+            writeMsgpackLength(0x80, 16, 0, 0xDE, 0xDF, j.size(), out);
+            for(json::const_iterator it = j.begin(); it != j.end(); ++it) {
+                writeMsgpackLength(0xA0, 32, 0xD9, 0xDA, 0xDB, it.key().size(), out);
+                out.append(it.key());
+                writeMsgpack(it.value(), rawHashes, isHashKey(it.key()), out);
+            }
+            break;
+        default:
+            out.push_back((char)0xC0);
+            break;
+    }
+}
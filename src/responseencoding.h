@@ -0,0 +1,84 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RESPONSEENCODING_H_INCLUDED
+#define RESPONSEENCODING_H_INCLUDED
+
+#include <string>
+#include "json.hpp"
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+// Wire formats a response body can be sent in
+enum ResponseEncoding {
+    ENCODING_JSON = 0,
+    ENCODING_CBOR,
+    ENCODING_MSGPACK
+};
+
+/**
+ * The ResponseEncoder class serializes response bodies in the format the client
+ * asked for. JSON is the default, CBOR and MessagePack are compact binary encodings
+ * of the same shape.
+ */
+
+class ResponseEncoder {
+public:
+    /** Returns the encoding to use for an Accept header. The first supported binary
+     * type listed wins, anything else gets JSON
+     */
+    static ResponseEncoding fromAcceptHeader(const string& accept);
+
+    /** Returns the Content-Type to send with the encoding
+     */
+    static string contentType(ResponseEncoding encoding);
+
+    /** Serializes the body. With rawHashes, hashes (64 hex characters under keys such
+     * as txid or blockHash) are sent as 32 byte binary strings, in the byte order
+     * they are displayed in. JSON has no binary strings, so it keeps them as hex.
+     */
+    static string encode(const nlohmann::json& body, ResponseEncoding encoding, bool rawHashes);
+
+private:
+    static void writeCbor(const nlohmann::json& j, bool rawHashes, bool isHash, string& out);
+    static void writeCborHead(unsigned char majorType, uint64_t value, string& out);
+    static void writeMsgpack(const nlohmann::json& j, bool rawHashes, bool isHash, string& out);
+    static void writeMsgpackLength(unsigned char fixType, size_t fixLimit, unsigned char type8, unsigned char type16, unsigned char type32, size_t length, string& out);
+
+    /** Appends value in network byte order using the given number of bytes
+     */
+    static void writeBigEndian(uint64_t value, int bytes, string& out);
+
+    /** Returns true if values under the key are hashes (or arrays of them)
+     */
+    static bool isHashKey(const string& key);
+
+    /** Returns the 32 bytes of a hex hash, or an empty string if the value is no hash
+     */
+    static string hashBytes(const nlohmann::json& j);
+
+    ResponseEncoder() {}
+};
+
+}
+
+#endif // RESPONSEENCODING_H_INCLUDED
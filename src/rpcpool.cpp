@@ -0,0 +1,159 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "rpcpool.h"
+#include "logger.h"
+#include "metrics.h"
+#include <jsonrpccpp/client/connectors/httpclient.h>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+VtcBlockIndexer::RpcPool::RpcPool(size_t connections, size_t maxBatchSize, chrono::milliseconds timeout) {
+    this->url = "http://" + std::string(std::getenv("COIND_RPCUSER")) + ":" + std::string(std::getenv("COIND_RPCPASSWORD")) + "@" + std::string(std::getenv("COIND_HOST")) + ":" + std::string(std::getenv("COIND_RPCPORT"));
+    this->maxBatchSize = std::max<size_t>(1, maxBatchSize);
+    this->timeout = timeout;
+    this->stopping = false;
+    for(size_t i = 0; i < std::max<size_t>(1, connections); i++) {
+        this->connections.emplace_back(&RpcPool::runConnection, this);
+    }
+}
+
+VtcBlockIndexer::RpcPool::~RpcPool() {
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    queueCondition.notify_all();
+    for(thread& connection : connections) {
+        connection.join();
+    }
+    for(QueuedCall& queued : queue) {
+        queued.result.set_exception(make_exception_ptr(jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_CONNECTOR, "Shutting down")));
+    }
+}
+
+future<Json::Value> VtcBlockIndexer::RpcPool::call(const string& method, const Json::Value& params) {
+    return std::move(callAll({ { method, params } }).front());
+}
+
+vector<future<Json::Value>> VtcBlockIndexer::RpcPool::callAll(const vector<VtcBlockIndexer::RpcCall>& calls) {
+    vector<future<Json::Value>> results;
+    results.reserve(calls.size());
+    {
+        lock_guard<mutex> lock(queueMutex);
+        for(const VtcBlockIndexer::RpcCall& call : calls) {
+            queue.push_back({ call, promise<Json::Value>() });
+            results.push_back(queue.back().result.get_future());
+        }
+    }
+    Metrics::add(METRIC_RPC_CALLS, calls.size());
+    if(calls.size() > 1) {
+        queueCondition.notify_all();
+    } else {
+        queueCondition.notify_one();
+    }
+    return results;
+}
+
+vector<future<Json::Value>> VtcBlockIndexer::RpcPool::getRawTransactions(const vector<string>& txids) {
+    vector<VtcBlockIndexer::RpcCall> calls;
+    calls.reserve(txids.size());
+    for(const string& txid : txids) {
+        Json::Value params;
+        params.append(txid);
+        params.append(false);
+        calls.push_back({ "getrawtransaction", params });
+    }
+    return callAll(calls);
+}
+
+void VtcBlockIndexer::RpcPool::runConnection() {
+    // The client keeps its connection, so it's only used by this thread
+    jsonrpc::HttpClient httpClient(url);
+    httpClient.SetTimeout(timeout.count());
+    jsonrpc::Client client(httpClient, jsonrpc::JSONRPC_CLIENT_V1);
+
+    while(true) {
+        vector<QueuedCall> calls;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            queueCondition.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if(stopping) return;
+            while(!queue.empty() && calls.size() < maxBatchSize) {
+                calls.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+        }
+        send(client, calls);
+    }
+}
+
+void VtcBlockIndexer::RpcPool::send(jsonrpc::Client& client, vector<QueuedCall>& calls) {
+    Metrics::add(METRIC_RPC_REQUESTS);
+    // The promises are fulfilled in order, the ones from here on are still pending
+    size_t resolved = 0;
+    exception_ptr failure;
+    try {
+        if(calls.size() == 1) {
+            calls[0].result.set_value(client.CallMethod(calls[0].call.method, calls[0].call.params));
+            return;
+        }
+
+        jsonrpc::BatchCall batch;
+        vector<int> ids;
+        for(const QueuedCall& queued : calls) {
+            ids.push_back(batch.addCall(queued.call.method, queued.call.params));
+        }
+        jsonrpc::BatchResponse response = client.CallProcedures(batch);
+        for(; resolved < calls.size(); resolved++) {
+            Json::Value id(ids[resolved]);
+            int errorCode = response.getErrorCode(id);
+            Json::Value result = response.getResult(ids[resolved]);
+            if(errorCode != 0) {
+                calls[resolved].result.set_exception(make_exception_ptr(jsonrpc::JsonRpcException(errorCode, response.getErrorMessage(id))));
+            } else if(result.isNull()) {
+                calls[resolved].result.set_exception(make_exception_ptr(jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, "No result for " + calls[resolved].call.method)));
+            } else {
+                calls[resolved].result.set_value(result);
+            }
+        }
+        return;
+    } catch(const jsonrpc::JsonRpcException& e) {
+        // A single call failed, or the whole batch could not be sent
+        if(calls.size() > 1) {
+            VTC_LOG(LOG_LEVEL_WARNING, "RPC batch of " << calls.size() << " calls failed: " << e.what());
+        }
+        failure = current_exception();
+    } catch(const std::exception& e) {
+        // A reply that could not be read. Callers expect a JsonRpcException, and the
+        // connection thread has to keep running
+        VTC_LOG(LOG_LEVEL_WARNING, "RPC request of " << calls.size() << " calls failed: " << e.what());
+        failure = make_exception_ptr(jsonrpc::JsonRpcException(jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE, e.what()));
+    } catch(...) {
+        VTC_LOG(LOG_LEVEL_WARNING, "RPC request of " << calls.size() << " calls failed");
+        failure = current_exception();
+    }
+
+    for(; resolved < calls.size(); resolved++) {
+        calls[resolved].result.set_exception(failure);
+    }
+}
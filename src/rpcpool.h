@@ -0,0 +1,111 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RPCPOOL_H_INCLUDED
+#define RPCPOOL_H_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <jsonrpccpp/client.h>
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+/**
+ * A call to a method of the node
+ */
+struct RpcCall {
+    string method;
+    Json::Value params;
+};
+
+/**
+ * The RpcPool class calls the node over a fixed number of connections, each with
+ * a thread of its own. Callers queue calls and get futures for the results, so
+ * they can queue all the lookups they need at once and wait for them together.
+ * A connection sends the calls waiting in the queue as one JSON-RPC batch (up to
+ * maxBatchSize per HTTP request). Futures of failed calls throw the
+ * jsonrpc::JsonRpcException of the failure, a reply that could not be read
+ * fails the calls that weren't resolved yet with ERROR_CLIENT_INVALID_RESPONSE.
+ */
+
+class RpcPool {
+public:
+    /** Constructs a pool of connections to the node configured in the COIND_*
+     * environment variables. Requests taking longer than timeout fail
+     */
+    RpcPool(size_t connections, size_t maxBatchSize, chrono::milliseconds timeout);
+
+    /** Fails the calls still queued and waits for the connections to finish
+     */
+    ~RpcPool();
+
+    /** Queues a call
+     */
+    future<Json::Value> call(const string& method, const Json::Value& params);
+
+    /** Queues the calls together, so they go out in as few batches as possible
+     */
+    vector<future<Json::Value>> callAll(const vector<RpcCall>& calls);
+
+    /** Queues getrawtransaction (not verbose) for each transaction id. The results
+     * are the raw transactions in hex
+     */
+    vector<future<Json::Value>> getRawTransactions(const vector<string>& txids);
+
+private:
+    struct QueuedCall {
+        RpcCall call;
+        promise<Json::Value> result;
+    };
+
+    /** Sends the queued calls over one connection until the pool is destroyed
+     */
+    void runConnection();
+
+    /** Sends the calls as one request, or as a batch if there are several, and
+     * fulfils their promises
+     */
+    void send(jsonrpc::Client& client, vector<QueuedCall>& calls);
+
+    string url;
+    size_t maxBatchSize;
+    chrono::milliseconds timeout;
+
+    // Guards queue and stopping
+    mutex queueMutex;
+    condition_variable queueCondition;
+    deque<QueuedCall> queue;
+    bool stopping;
+
+    vector<thread> connections;
+};
+
+}
+
+#endif // RPCPOOL_H_INCLUDED
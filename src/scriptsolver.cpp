@@ -20,6 +20,7 @@
 #include "scriptsolver.h"
 #include "blockchaintypes.h"
 #include "utility.h"
+#include "logger.h"
 #include <iostream>
 #include <sstream>
 #include "leveldb/db.h"
@@ -32,256 +33,500 @@ VtcBlockIndexer::ScriptSolver::ScriptSolver() {
 
 }
 
-uint8_t  VtcBlockIndexer::ScriptSolver::getScriptType(vector<unsigned char> script) {
-    uint64_t scriptSize = script.size();
-    
-    // The most common output script type that pays to hash160(pubKey)
-    if(
-        
-            (25==scriptSize                  &&
-            0x76==script.at(0)              &&  // OP_DUP
-            0xA9==script.at(1)              &&  // OP_HASH160
-              20==script.at(2)              &&  // OP_PUSHDATA(20)
-            
-            (0x88==script.at(scriptSize-2)   &&  // OP_EQUALVERIFY
-            0xAC==script.at(scriptSize-1)))      // OP_CHECKSIG
-
-            ||
-// scripts appended with OP_NOP1. Since OP_NOP1 does nothing, this should still be valid.
-
-            (25==scriptSize                  &&
-                0x76==script.at(0)              &&  // OP_DUP
-                0xA9==script.at(1)              &&  // OP_HASH160
-                  20==script.at(2)              &&  // OP_PUSHDATA(20)
-                
-                (0x88==script.at(scriptSize-2)   &&  // OP_EQUALVERIFY
-                0xB0==script.at(scriptSize-1)))      // OP_NOP1
-    
-                ||
-
-            // scripts appended with OP_NOP. Since OP_NOP does nothing, this should still be valid.
-
-            (26==scriptSize                  &&
-            0x76==script.at(0)              &&  // OP_DUP
-            0xA9==script.at(1)              &&  // OP_HASH160
-              20==script.at(2)              &&  // OP_PUSHDATA(20)
-
-            
-            (0x88==script.at(scriptSize-3)   &&  // OP_EQUALVERIFY
-            0xAC==script.at(scriptSize-2)   &&  // OP_CHECKSIG
-            0x61==script.at(scriptSize-1)))     // OP_NOP
-            
-              
-        
-    ) { 
-        return SCRIPT_TYPE_P2PKH;
-    }
+namespace {
+    // Fixed size script templates: the script has exactly this size, starts
+    // with prefix and ends with suffix. The payload is the hash or public key.
+    struct ScriptPattern {
+        uint8_t type;
+        uint8_t size;
+        uint8_t prefixLength;
+        unsigned char prefix[6];
+        uint8_t suffixLength;
+        unsigned char suffix[3];
+        uint8_t payloadBegin;
+        uint8_t payloadEnd;
+    };
 
-    // Output script commonly found in block reward TX, that pays to an explicit pubKey
-    if(
-                67==scriptSize                &&  
-                65==script.at(0)            &&  // OP_PUSHDATA(65)
-                0xAC==script.at(scriptSize-1) // OP_CHECKSIG
-                
-        ) {
-        return SCRIPT_TYPE_P2PK;
-    }
+    // Checked in order, before the nulldata and multisig checks
+    constexpr ScriptPattern standardPatterns[] = {
+        // The most common output script type that pays to hash160(pubKey)
+        // OP_DUP OP_HASH160 OP_PUSHDATA(20) <hash> OP_EQUALVERIFY OP_CHECKSIG
+        {SCRIPT_TYPE_P2PKH, 25, 3, {0x76, 0xA9, 20}, 2, {0x88, 0xAC}, 3, 23},
+        // Scripts appended with OP_NOP1. Since OP_NOP1 does nothing, this should still be valid.
+        {SCRIPT_TYPE_P2PKH, 25, 3, {0x76, 0xA9, 20}, 2, {0x88, 0xB0}, 3, 23},
+        // Scripts appended with OP_NOP. Since OP_NOP does nothing, this should still be valid.
+        {SCRIPT_TYPE_P2PKH, 26, 3, {0x76, 0xA9, 20}, 3, {0x88, 0xAC, 0x61}, 3, 23},
+        // Output script commonly found in block reward TX, that pays to an explicit pubKey
+        // OP_PUSHDATA(65) <pubkey> OP_CHECKSIG
+        {SCRIPT_TYPE_P2PK, 67, 1, {65}, 1, {0xAC}, 1, 66},
+        // Pay to compressed pubkey script: OP_PUSHDATA(33) <pubkey> OP_CHECKSIG
+        {SCRIPT_TYPE_P2CPK, 35, 1, {0x21}, 1, {0xAC}, 1, 34},
+        // Witness v0 with a 20 byte program
+        {SCRIPT_TYPE_P2WSH, 22, 2, {0x00, 0x14}, 0, {}, 2, 22},
+        // Witness v0 with a 32 byte program
+        {SCRIPT_TYPE_P2WPKH, 34, 2, {0x00, 0x20}, 0, {}, 2, 34},
+        // OP_HASH160 OP_PUSHDATA(20) <hash> OP_EQUAL
+        {SCRIPT_TYPE_P2SH, 23, 2, {0xA9, 20}, 1, {0x87}, 2, 22},
+    };
 
-    // Pay to compressed pubkey script
-     if(
-        35==scriptSize                &&
-        0x21==script.at(0)            &&  // OP_PUSHDATA(33)
-        0xAC==script.at(scriptSize-1)     // OP_CHECKSIG
-    ) {
-        return SCRIPT_TYPE_P2CPK;
-    }
+    // Checked in order, after the nulldata and multisig checks
+    constexpr ScriptPattern knownNonStandardPatterns[] = {
+        // OP_PUSHDATA(32) + data only (Found in litecoin chain - nonstandard script)
+        // Public block explorers show these as "unknown" (https://bchain.info/LTC/tx/265278e51d1b29cdce906a858251b7ce15e2dab09de7dede0acb4c629f780b91)  
+        {SCRIPT_TYPE_KNOWN_NONSTANDARD, 33, 1, {0x20}, 0, {}, 0, 0},
+        // OP_PUSHDATA(36) + data only (Found in litecoin chain - nonstandard script)
+        // Public block explorers show these as "unknown" (http://explorer.litecoin.net/tx/936e8ed1cfca736320fdced61c2d03886b232497ea975e41d101f1d83bb74c44)
+        {SCRIPT_TYPE_KNOWN_NONSTANDARD, 37, 1, {0x24}, 0, {}, 0, 0},
+        // OP_PUSHDATA(20) + data only. Unparseable (BTC)
+        // Public block explorers show these as "unknown" (https://blockchain.info/tx/b8fd633e7713a43d5ac87266adc78444669b987a56b3a65fb92d58c2c4b0e84d)
+        {SCRIPT_TYPE_KNOWN_NONSTANDARD, 24, 1, {0x14}, 0, {}, 0, 0},
+        // Unknown (seems malformed) output script found on Litecoin in p2pool blocks
+        // For example https://bchain.info/LTC/tx/8f1220670b5d4ade8f9c6a82fde3d88a28d2e1c290f2edc6d7a7a13aa0352fc7 
+        // OP_IFDUP OP_IF OP_2SWAP OP_VERIFY OP_2OVER OP_DEPTH
+        {SCRIPT_TYPE_KNOWN_NONSTANDARD, 6, 6, {0x73, 0x63, 0x72, 0x69, 0x70, 0x74}, 0, {}, 0, 0},
+        // A challenge: anyone who can find X such that 0==RIPEMD160(X) stands to earn a bunch of coins
+        // OP_DUP OP_HASH160 OP_0 OP_EQUALVERIFY OP_CHECKSIG
+        {SCRIPT_TYPE_KNOWN_NONSTANDARD, 5, 5, {0x76, 0xA9, 0x00, 0x88, 0xAC}, 0, {}, 0, 0},
+    };
 
-    // Pay to witness script hash
-    if(
-        22 == scriptSize            &&
-        0x00 == script.at(0)        &&  
-        0x14 == script.at(1)        
-    ) {
-        return SCRIPT_TYPE_P2WSH;
+    bool matchesPattern(const VtcBlockIndexer::ScriptSpan& script, const ScriptPattern& pattern) {
+        if(script.size != pattern.size) return false;
+        for(uint8_t i = 0; i < pattern.prefixLength; i++) {
+            if(script[i] != pattern.prefix[i]) return false;
+        }
+        for(uint8_t i = 0; i < pattern.suffixLength; i++) {
+            if(script[script.size - pattern.suffixLength + i] != pattern.suffix[i]) return false;
+        }
+        return true;
     }
 
-    // P2WPKH
-    if(
-        34 == scriptSize            &&
-        0x00 == script.at(0)        &&  
-        0x20 == script.at(1)        
-    ) {
-        return SCRIPT_TYPE_P2WPKH;
+    template<size_t N>
+    bool classifyByPatterns(const VtcBlockIndexer::ScriptSpan& script, const ScriptPattern (&patterns)[N], VtcBlockIndexer::ScriptClassification& result) {
+        for(const ScriptPattern& pattern : patterns) {
+            if(matchesPattern(script, pattern)) {
+                result.type = pattern.type;
+                result.payloadBegin = pattern.payloadBegin;
+                result.payloadEnd = pattern.payloadEnd;
+                result.keyCount = (pattern.payloadEnd > pattern.payloadBegin ? 1 : 0);
+                return true;
+            }
+        }
+        return false;
     }
 
-     if(
-        23 == scriptSize                &&
-            0xA9==script.at(0)             &&  // OP_HASH160
-              20==script.at(1)             &&  // OP_PUSHDATA(20)
-            0x87==script.at(scriptSize-1)      // OP_EQUAL
-              
-        
-    ) {
-        return SCRIPT_TYPE_P2SH;
+    // Friendly script type names, by SCRIPT_TYPE_*
+    const char* const scriptTypeNames[] = {"", "pay-to-pubkeyhash", "pay-to-pubkey", "pay-to-scripthash", "pay-to-witness-pubkeyhash", "pay-to-witnessscripthash","nulldata","multisig","pay-to-pubkey"};
+}
+
+VtcBlockIndexer::ScriptClassification VtcBlockIndexer::ScriptSolver::classifyScript(ScriptSpan script) {
+    ScriptClassification result;
+    result.type = SCRIPT_TYPE_UNKNOWN;
+    result.payloadBegin = 0;
+    result.payloadEnd = 0;
+    result.keyCount = 0;
+    result.requiredSignatures = 0;
+
+    if(classifyByPatterns(script, standardPatterns, result)) {
+        return result;
     }
 
     // NULLDATA
-    if(
-            scriptSize > 0        && 
-            0x6A == script.at(0)    
-        ) {
-            uint32_t pos = 1;
-            
-            bool foundOpcodes = false;
-            while(pos < script.size()) {
-                if(script.at(pos) >= 0x01 && script.at(pos) <= 0x4B) { 
-                    pos += script.at(pos) + 1;
-                } else {
-                    foundOpcodes = true;
-                    break;
-                } 
-            }
-
-        if(!foundOpcodes)
-            return SCRIPT_TYPE_NULLDATA;
-        else
-            return SCRIPT_TYPE_UNKNOWN;
+    if(script.size > 0 && 0x6A == script[0]) {
+        size_t pos = 1;
+        bool foundOpcodes = false;
+        while(pos < script.size) {
+            if(script[pos] >= 0x01 && script[pos] <= 0x4B) { 
+                pos += script[pos] + 1;
+            } else {
+                foundOpcodes = true;
+                break;
+            } 
+        }
+        result.type = (foundOpcodes ? SCRIPT_TYPE_UNKNOWN : SCRIPT_TYPE_NULLDATA);
+        return result;
     }
 
     if(isMultiSig(script)) {
-        return SCRIPT_TYPE_MULTISIG;
+        // Walk the public key pushes following the OP_m opcode
+        result.type = SCRIPT_TYPE_MULTISIG;
+        result.requiredSignatures = script[0];
+        size_t pos = 1;
+        while(pos + 2 < script.size) {
+            if(script[pos] == 0x21 && pos+34 <= script.size) {
+                pos += 34;
+            } else if(script[pos] == 0x41 && pos+66 <= script.size) {
+                pos += 66;
+            } else {
+                break;
+            }
+            result.keyCount++;
+        }
+        result.payloadBegin = 1;
+        result.payloadEnd = (uint32_t)(result.keyCount > 0 ? pos : 1);
+        return result;
     }
 
-    
-    if(
-        // OP_PUSHDATA(32) + data only (Found in litecoin chain - nonstandard script)
-        // Public block explorers show these as "unknown" (https://bchain.info/LTC/tx/265278e51d1b29cdce906a858251b7ce15e2dab09de7dede0acb4c629f780b91)  
-        (   33==scriptSize                  &&
-            0x20==script.at(0))
-        ||
-        // OP_PUSHDATA(36) + data only (Found in litecoin chain - nonstandard script)
-        // Public block explorers show these as "unknown" (http://explorer.litecoin.net/tx/936e8ed1cfca736320fdced61c2d03886b232497ea975e41d101f1d83bb74c44)
-        (   37==scriptSize                  &&
-            0x24==script.at(0))
-        ||
-        // OP_PUSHDATA(20) + data only. Unparseable (BTC)
-        // Public block explorers show these as "unknown" (https://blockchain.info/tx/b8fd633e7713a43d5ac87266adc78444669b987a56b3a65fb92d58c2c4b0e84d)
-        (   24==scriptSize                  &&
-            0x14==script.at(0))
-        ||
-        // Unknown (seems malformed) output script found on Litecoin in p2pool blocks
-        // For example https://bchain.info/LTC/tx/8f1220670b5d4ade8f9c6a82fde3d88a28d2e1c290f2edc6d7a7a13aa0352fc7 
-        (   6 == scriptSize                &&
-            0x73==script.at(0)             &&  // OP_IFDUP
-            0x63==script.at(1)             &&  // OP_IF
-            0x72==script.at(2)             &&  // OP_2SWAP
-            0x69==script.at(3)             &&  // OP_VERIFY
-            0x70==script.at(4)             &&  // OP_2OVER
-            0x74==script.at(5))              // OP_DEPTH)
-        ||
-        // A challenge: anyone who can find X such that 0==RIPEMD160(X) stands to earn a bunch of coins
-        (
-            scriptSize == 5 &&
-            0x76==script[0] &&                  // OP_DUP
-            0xA9==script[1] &&                  // OP_HASH160
-            0x00==script[2] &&                  // OP_0
-            0x88==script[3] &&                  // OP_EQUALVERIFY
-            0xAC==script[4])                    // OP_CHECKSIG
-    )
-    {
-        return SCRIPT_TYPE_KNOWN_NONSTANDARD;
-    }
+    classifyByPatterns(script, knownNonStandardPatterns, result);
+    return result;
+}
 
-    return SCRIPT_TYPE_UNKNOWN;
+uint8_t VtcBlockIndexer::ScriptSolver::getScriptType(ScriptSpan script) {
+    return classifyScript(script).type;
 }
 
-string VtcBlockIndexer::ScriptSolver::getScriptTypeName(vector<unsigned char> script) {
-    vector<string> scriptTypeNames = {"", "pay-to-pubkeyhash", "pay-to-pubkey", "pay-to-scripthash", "pay-to-witness-pubkeyhash", "pay-to-witnessscripthash","nulldata","multisig","pay-to-pubkey"};
-    uint8_t scriptType = getScriptType(script);
-    if(scriptType == SCRIPT_TYPE_UNKNOWN) return string("Unknown");
-    return scriptTypeNames.at(scriptType);
+string VtcBlockIndexer::ScriptSolver::getScriptTypeName(ScriptSpan script) {
+    ScriptClassification classification = classifyScript(script);
+    return getScriptTypeName(classification);
 }
 
-vector<string> VtcBlockIndexer::ScriptSolver::getAddressesFromScript(vector<unsigned char> script) {
-    vector<string> addresses;
+const char* VtcBlockIndexer::ScriptSolver::getScriptTypeName(const ScriptClassification& classification) {
+    if(classification.type >= sizeof(scriptTypeNames) / sizeof(scriptTypeNames[0])) return "Unknown";
+    return scriptTypeNames[classification.type];
+}
 
+string VtcBlockIndexer::ScriptSolver::getNodeScriptTypeName(ScriptSpan script) {
+    ScriptClassification classification = classifyScript(script);
+    return getNodeScriptTypeName(classification);
+}
 
-    uint8_t scriptType = getScriptType(script);
-    switch(scriptType) {
-        case SCRIPT_TYPE_P2PKH:
-        {
-            addresses.push_back(VtcBlockIndexer::Utility::ripeMD160ToP2PKAddress(vector<unsigned char>(&script[3], &script[23])));
-            break;
-        }
-        case SCRIPT_TYPE_P2PK:
-        {
-            addresses.push_back(VtcBlockIndexer::Utility::publicKeyToAddress(vector<unsigned char>(&script[1], &script[66])));
-            break;
+const char* VtcBlockIndexer::ScriptSolver::getNodeScriptTypeName(const ScriptClassification& classification) {
+    switch(classification.type) {
+        case SCRIPT_TYPE_P2PKH: return "pubkeyhash";
+        case SCRIPT_TYPE_P2PK: return "pubkey";
+        case SCRIPT_TYPE_P2CPK: return "pubkey";
+        case SCRIPT_TYPE_P2SH: return "scripthash";
+        // SCRIPT_TYPE_P2WSH is the 20 byte witness program, SCRIPT_TYPE_P2WPKH the 32 byte one
+        case SCRIPT_TYPE_P2WSH: return "witness_v0_keyhash";
+        case SCRIPT_TYPE_P2WPKH: return "witness_v0_scripthash";
+        case SCRIPT_TYPE_NULLDATA: return "nulldata";
+        case SCRIPT_TYPE_MULTISIG: return "multisig";
+        default: return "nonstandard";
+    }
+}
+
+namespace {
+    // Opcode names as used by the node's ScriptToAsmStr. Push opcodes are
+    // printed as their data, so they don't need a name.
+    string getOpName(unsigned char opcode) {
+        if(opcode >= 0x51 && opcode <= 0x60) return std::to_string(opcode - 0x50);
+        switch(opcode) {
+            case 0x00: return "0";
+            case 0x4f: return "-1";
+            case 0x50: return "OP_RESERVED";
+            case 0x61: return "OP_NOP";
+            case 0x62: return "OP_VER";
+            case 0x63: return "OP_IF";
+            case 0x64: return "OP_NOTIF";
+            case 0x65: return "OP_VERIF";
+            case 0x66: return "OP_VERNOTIF";
+            case 0x67: return "OP_ELSE";
+            case 0x68: return "OP_ENDIF";
+            case 0x69: return "OP_VERIFY";
+            case 0x6a: return "OP_RETURN";
+            case 0x6b: return "OP_TOALTSTACK";
+            case 0x6c: return "OP_FROMALTSTACK";
+            case 0x6d: return "OP_2DROP";
+            case 0x6e: return "OP_2DUP";
+            case 0x6f: return "OP_3DUP";
+            case 0x70: return "OP_2OVER";
+            case 0x71: return "OP_2ROT";
+            case 0x72: return "OP_2SWAP";
+            case 0x73: return "OP_IFDUP";
+            case 0x74: return "OP_DEPTH";
+            case 0x75: return "OP_DROP";
+            case 0x76: return "OP_DUP";
+            case 0x77: return "OP_NIP";
+            case 0x78: return "OP_OVER";
+            case 0x79: return "OP_PICK";
+            case 0x7a: return "OP_ROLL";
+            case 0x7b: return "OP_ROT";
+            case 0x7c: return "OP_SWAP";
+            case 0x7d: return "OP_TUCK";
+            case 0x7e: return "OP_CAT";
+            case 0x7f: return "OP_SUBSTR";
+            case 0x80: return "OP_LEFT";
+            case 0x81: return "OP_RIGHT";
+            case 0x82: return "OP_SIZE";
+            case 0x83: return "OP_INVERT";
+            case 0x84: return "OP_AND";
+            case 0x85: return "OP_OR";
+            case 0x86: return "OP_XOR";
+            case 0x87: return "OP_EQUAL";
+            case 0x88: return "OP_EQUALVERIFY";
+            case 0x89: return "OP_RESERVED1";
+            case 0x8a: return "OP_RESERVED2";
+            case 0x8b: return "OP_1ADD";
+            case 0x8c: return "OP_1SUB";
+            case 0x8d: return "OP_2MUL";
+            case 0x8e: return "OP_2DIV";
+            case 0x8f: return "OP_NEGATE";
+            case 0x90: return "OP_ABS";
+            case 0x91: return "OP_NOT";
+            case 0x92: return "OP_0NOTEQUAL";
+            case 0x93: return "OP_ADD";
+            case 0x94: return "OP_SUB";
+            case 0x95: return "OP_MUL";
+            case 0x96: return "OP_DIV";
+            case 0x97: return "OP_MOD";
+            case 0x98: return "OP_LSHIFT";
+            case 0x99: return "OP_RSHIFT";
+            case 0x9a: return "OP_BOOLAND";
+            case 0x9b: return "OP_BOOLOR";
+            case 0x9c: return "OP_NUMEQUAL";
+            case 0x9d: return "OP_NUMEQUALVERIFY";
+            case 0x9e: return "OP_NUMNOTEQUAL";
+            case 0x9f: return "OP_LESSTHAN";
+            case 0xa0: return "OP_GREATERTHAN";
+            case 0xa1: return "OP_LESSTHANOREQUAL";
+            case 0xa2: return "OP_GREATERTHANOREQUAL";
+            case 0xa3: return "OP_MIN";
+            case 0xa4: return "OP_MAX";
+            case 0xa5: return "OP_WITHIN";
+            case 0xa6: return "OP_RIPEMD160";
+            case 0xa7: return "OP_SHA1";
+            case 0xa8: return "OP_SHA256";
+            case 0xa9: return "OP_HASH160";
+            case 0xaa: return "OP_HASH256";
+            case 0xab: return "OP_CODESEPARATOR";
+            case 0xac: return "OP_CHECKSIG";
+            case 0xad: return "OP_CHECKSIGVERIFY";
+            case 0xae: return "OP_CHECKMULTISIG";
+            case 0xaf: return "OP_CHECKMULTISIGVERIFY";
+            case 0xb0: return "OP_NOP1";
+            case 0xb1: return "OP_CHECKLOCKTIMEVERIFY";
+            case 0xb2: return "OP_CHECKSEQUENCEVERIFY";
+            case 0xb3: return "OP_NOP4";
+            case 0xb4: return "OP_NOP5";
+            case 0xb5: return "OP_NOP6";
+            case 0xb6: return "OP_NOP7";
+            case 0xb7: return "OP_NOP8";
+            case 0xb8: return "OP_NOP9";
+            case 0xb9: return "OP_NOP10";
+            case 0xff: return "OP_INVALIDOPCODE";
+            default: return "OP_UNKNOWN";
         }
-        case SCRIPT_TYPE_P2CPK:
-        {
-            addresses.push_back(VtcBlockIndexer::Utility::publicKeyToAddress(vector<unsigned char>(&script[1], &script[34])));
-            break;
+    }
+
+    // Rough DER signature check on a push of <DER signature><sighash type>,
+    // enough to decide whether the last byte is a sighash type
+    bool looksLikeSignature(const vector<unsigned char>& data) {
+        return data.size() >= 9 && data.size() <= 73 && data[0] == 0x30 && data[1] == data.size() - 3;
+    }
+
+    string getSigHashName(unsigned char sigHash) {
+        switch(sigHash) {
+            case 0x01: return "[ALL]";
+            case 0x02: return "[NONE]";
+            case 0x03: return "[SINGLE]";
+            case 0x81: return "[ALL|ANYONECANPAY]";
+            case 0x82: return "[NONE|ANYONECANPAY]";
+            case 0x83: return "[SINGLE|ANYONECANPAY]";
+            default: return "";
         }
-        case SCRIPT_TYPE_P2WSH:
-        {
-            addresses.push_back(VtcBlockIndexer::Utility::bech32Address(vector<unsigned char>(&script[2], &script[22])));
-            break;
+    }
+}
+
+string VtcBlockIndexer::ScriptSolver::getScriptAsm(const vector<unsigned char>& script, bool decodeSignatures) {
+    stringstream ss;
+    size_t pos = 0;
+    while(pos < script.size()) {
+        if(pos > 0) ss << " ";
+        unsigned char opcode = script[pos++];
+
+        if(opcode > 0x4e) {
+            ss << getOpName(opcode);
+            continue;
         }
-        case SCRIPT_TYPE_P2WPKH:
-        {
-            addresses.push_back(VtcBlockIndexer::Utility::bech32Address(vector<unsigned char>(&script[2], &script[34])));
-            break;
+
+        // Push operation: determine the length of the data
+        size_t length = opcode;
+        size_t lengthBytes = (opcode == 0x4c ? 1 : (opcode == 0x4d ? 2 : (opcode == 0x4e ? 4 : 0)));
+        if(lengthBytes > 0) {
+            if(pos + lengthBytes > script.size()) {
+                ss << "[error]";
+                break;
+            }
+            length = 0;
+            for(size_t i = 0; i < lengthBytes; i++) {
+                length |= ((size_t)script[pos + i]) << (8 * i);
+            }
+            pos += lengthBytes;
         }
-        case SCRIPT_TYPE_P2SH:
-        {
-            addresses.push_back(VtcBlockIndexer::Utility::ripeMD160ToP2SHAddress(vector<unsigned char>(&script[2], &script[22])));
+        if(pos + length > script.size()) {
+            ss << "[error]";
             break;
         }
-        case SCRIPT_TYPE_MULTISIG:
-        {
-            uint32_t pos = 1;
-            while(pos < script.size()-2) {
-                if(script.at(pos) == 0x21) {
-                    addresses.push_back(VtcBlockIndexer::Utility::publicKeyToAddress(vector<unsigned char>(&script[pos+1], &script[pos+34]))); 
-                    pos += 34;
-                }
-                else if(script.at(pos) == 0x41) {
-                    addresses.push_back(VtcBlockIndexer::Utility::publicKeyToAddress(vector<unsigned char>(&script[pos+1], &script[pos+66])));
-                    pos += 66;
-                }
-                else pos = script.size();
+        vector<unsigned char> data(script.begin() + pos, script.begin() + pos + length);
+        pos += length;
+
+        if(data.size() <= 4) {
+            // Small pushes are shown as a (little endian, sign-magnitude) number
+            int64_t value = 0;
+            for(size_t i = 0; i < data.size(); i++) {
+                value |= ((int64_t)data[i]) << (8 * i);
             }
-            break;
+            if(data.size() > 0 && (data.back() & 0x80)) {
+                value &= ~(((int64_t)0x80) << (8 * (data.size() - 1)));
+                value = -value;
+            }
+            ss << value;
+        } else if(decodeSignatures && looksLikeSignature(data) && getSigHashName(data.back()) != "") {
+            ss << Utility::hashToHex(vector<unsigned char>(data.begin(), data.end() - 1)) << getSigHashName(data.back());
+        } else {
+            ss << Utility::hashToHex(data);
         }
-        case SCRIPT_TYPE_NULLDATA:
-        {
-            // Ignore nulldata entries.
-            break;
+    }
+    return ss.str();
+}
+
+vector<string> VtcBlockIndexer::ScriptSolver::getAddressesFromScript(ScriptSpan script) {
+    return getAddressesFromScript(script, classifyScript(script));
+}
+
+vector<string> VtcBlockIndexer::ScriptSolver::getAddressesFromScript(ScriptSpan script, const ScriptClassification& classification) {
+    vector<string> addresses;
+    for(const string& scriptId : getScriptIdsFromScript(script, classification)) {
+        addresses.push_back(VtcBlockIndexer::Utility::scriptIdToAddress(scriptId));
+    }
+    return addresses;
+}
+
+namespace {
+    // A public key that still needs to be hashed, and the script identifier
+    // (scriptIds[script][slot]) the hash belongs in
+    struct PendingKey {
+        size_t script;
+        size_t slot;
+        const unsigned char* begin;
+        const unsigned char* end;
+    };
+
+    string makeScriptId(unsigned char type, const unsigned char* begin, const unsigned char* end) {
+        string scriptId(1, (char)type);
+        scriptId.append(begin, end);
+        return scriptId;
+    }
+
+    void addPubKeyScriptId(size_t script, vector<string>& scriptIds, vector<PendingKey>& keys, const unsigned char* begin, const unsigned char* end) {
+        keys.push_back({script, scriptIds.size(), begin, end});
+        scriptIds.push_back(string());
+    }
+
+    // Hashes the pending public keys in one batch and stores their script
+    // identifiers in scriptIds[key.script][key.slot]
+    void hashPendingKeys(const vector<PendingKey>& keys, vector<string>* scriptIds) {
+        if(keys.empty()) return;
+        vector<pair<const unsigned char*, size_t>> inputs;
+        inputs.reserve(keys.size());
+        for(const PendingKey& key : keys) {
+            inputs.push_back(make_pair(key.begin, (size_t)(key.end - key.begin)));
         }
-        case SCRIPT_TYPE_KNOWN_NONSTANDARD:
-        {
-            // Known non-standard format that we can safely ignore
-            break;            
+        vector<unsigned char> hashes;
+        VtcBlockIndexer::Utility::hash160Batch(inputs, hashes);
+        for(size_t i = 0; i < keys.size(); i++) {
+            const unsigned char* hash = hashes.data() + i * 20;
+            scriptIds[keys[i].script][keys[i].slot] = makeScriptId(SCRIPT_ID_P2PKH, hash, hash + 20);
         }
-        case SCRIPT_TYPE_UNKNOWN:
-        default:
-        {
-            cout << "Before unrecognized script" << endl;
-            cout << "Unrecognized script : [" << Utility::hashToHex(script) << "]" << endl;
+    }
+
+    void collectScriptIds(const VtcBlockIndexer::ScriptSpan& script, const VtcBlockIndexer::ScriptClassification& classification, size_t scriptIndex, vector<string>& scriptIds, vector<PendingKey>& keys) {
+        const unsigned char* payloadBegin = script.data + classification.payloadBegin;
+        const unsigned char* payloadEnd = script.data + classification.payloadEnd;
+        switch(classification.type) {
+            case SCRIPT_TYPE_P2PKH:
+            {
+                scriptIds.push_back(makeScriptId(SCRIPT_ID_P2PKH, payloadBegin, payloadEnd));
+                break;
+            }
+            case SCRIPT_TYPE_P2PK:
+            case SCRIPT_TYPE_P2CPK:
+            {
+                addPubKeyScriptId(scriptIndex, scriptIds, keys, payloadBegin, payloadEnd);
+                break;
+            }
+            case SCRIPT_TYPE_P2WSH:
+            {
+                // 20 byte witness program
+                scriptIds.push_back(makeScriptId(SCRIPT_ID_P2WPKH, payloadBegin, payloadEnd));
+                break;
+            }
+            case SCRIPT_TYPE_P2WPKH:
+            {
+                // 32 byte witness program
+                scriptIds.push_back(makeScriptId(SCRIPT_ID_P2WSH, payloadBegin, payloadEnd));
+                break;
+            }
+            case SCRIPT_TYPE_P2SH:
+            {
+                scriptIds.push_back(makeScriptId(SCRIPT_ID_P2SH, payloadBegin, payloadEnd));
+                break;
+            }
+            case SCRIPT_TYPE_MULTISIG:
+            {
+                // The classification only covers complete 33 or 65 byte key pushes
+                scriptIds.reserve(classification.keyCount);
+                const unsigned char* push = payloadBegin;
+                while(push < payloadEnd) {
+                    addPubKeyScriptId(scriptIndex, scriptIds, keys, push+1, push+1+*push);
+                    push += 1 + *push;
+                }
+                break;
+            }
+            case SCRIPT_TYPE_NULLDATA:
+            {
+                // Ignore nulldata entries.
+                break;
+            }
+            case SCRIPT_TYPE_KNOWN_NONSTANDARD:
+            {
+                // Known non-standard format that we can safely ignore
+                break;            
+            }
+            case SCRIPT_TYPE_UNKNOWN:
+            default:
+            {
+                VTC_LOG_SAMPLED(LOG_LEVEL_DEBUG, 1000, "Unrecognized script : [" << VtcBlockIndexer::Utility::hashToHex(vector<unsigned char>(script.data, script.data + script.size)) << "]");
+            }
         }
     }
+}
 
-    return addresses;
+vector<string> VtcBlockIndexer::ScriptSolver::getScriptIdsFromScript(ScriptSpan script) {
+    return getScriptIdsFromScript(script, classifyScript(script));
 }
 
-bool VtcBlockIndexer::ScriptSolver::isMultiSig(vector<unsigned char> script) {
-    if(script.size() == 0) return false;
-    return (script.at(script.size()-1) == 0xAE);
+vector<string> VtcBlockIndexer::ScriptSolver::getScriptIdsFromScript(ScriptSpan script, const ScriptClassification& classification) {
+    vector<string> scriptIds;
+    vector<PendingKey> keys;
+    collectScriptIds(script, classification, 0, scriptIds, keys);
+    hashPendingKeys(keys, &scriptIds);
+    return scriptIds;
 }
 
-int VtcBlockIndexer::ScriptSolver::requiredSignatures(vector<unsigned char> script) {
+vector<vector<string>> VtcBlockIndexer::ScriptSolver::getScriptIdsFromScripts(const vector<const vector<unsigned char>*>& scripts, vector<ScriptClassification>* classifications) {
+    vector<vector<string>> scriptIds(scripts.size());
+    vector<PendingKey> keys;
+    if(classifications != NULL) {
+        classifications->resize(scripts.size());
+    }
+    for(size_t i = 0; i < scripts.size(); i++) {
+        ScriptClassification classification = classifyScript(*scripts[i]);
+        collectScriptIds(*scripts[i], classification, i, scriptIds[i], keys);
+        if(classifications != NULL) {
+            (*classifications)[i] = classification;
+        }
+    }
+    hashPendingKeys(keys, scriptIds.data());
+    return scriptIds;
+}
+
+bool VtcBlockIndexer::ScriptSolver::isMultiSig(ScriptSpan script) {
+    if(script.size == 0) return false;
+    return (script[script.size-1] == 0xAE);
+}
+
+int VtcBlockIndexer::ScriptSolver::requiredSignatures(ScriptSpan script) {
     if(!isMultiSig(script)) return -1;
 
-    return (int)script.at(0);
-}
\ No newline at end of file
+    return (int)script[0];
+}
@@ -39,10 +39,53 @@ using namespace std;
 #define SCRIPT_TYPE_KNOWN_NONSTANDARD   0x09
 #define SCRIPT_TYPE_UNKNOWN             0xFF
 
+// Script identifiers are used as index keys instead of addresses. They consist
+// of one of these type bytes followed by the 20 or 32 byte hash the script pays to.
+// Pay-to-pubkey and multisig keys are identified by the hash of the key.
+#define SCRIPT_ID_P2PKH                 0x01
+#define SCRIPT_ID_P2SH                  0x02
+#define SCRIPT_ID_P2WPKH                0x03
+#define SCRIPT_ID_P2WSH                 0x04
+
 
 
 namespace VtcBlockIndexer {
 
+/**
+ * A read-only view on the bytes of a script. Lets the script solver work on
+ * scripts without copying them.
+ */
+struct ScriptSpan {
+    const unsigned char* data;
+    size_t size;
+
+    ScriptSpan(const unsigned char* data, size_t size) : data(data), size(size) {}
+    ScriptSpan(const vector<unsigned char>& script) : data(script.data()), size(script.size()) {}
+
+    unsigned char operator[](size_t pos) const { return data[pos]; }
+};
+
+/**
+ * The result of classifying a script once, so every consumer can reuse it
+ * instead of parsing the script again.
+ */
+struct ScriptClassification {
+    // One of SCRIPT_TYPE_*
+    uint8_t type;
+
+    // Position of the hash or public key the script pays to. For multisig
+    // this is the range of public key pushes.
+    uint32_t payloadBegin;
+    uint32_t payloadEnd;
+
+    // Number of public keys in a multisig script, 1 for other payloads
+    uint32_t keyCount;
+
+    // For multisig, the first opcode of the script (OP_1 - OP_16) that
+    // holds the number of required signatures
+    uint8_t requiredSignatures;
+};
+
 /**
  * The ScriptSolver class provides methods to parse the bitcoin script language used in
  * transaction outputs and determine the public keys / addresses that can spend it.
@@ -54,27 +97,55 @@ public:
      */
     ScriptSolver();
 
+    /** Classifies the script. Doesn't allocate, and the result can be passed
+     * to the other methods to avoid classifying the same script again
+     */
+    ScriptClassification classifyScript(ScriptSpan script);
+
     /** Get the script type
      */
-    uint8_t getScriptType(vector<unsigned char> scriptString);
+    uint8_t getScriptType(ScriptSpan script);
 
     // Get a friendly name for the script type
-    string getScriptTypeName(vector<unsigned char> scriptString);
+    string getScriptTypeName(ScriptSpan script);
+    const char* getScriptTypeName(const ScriptClassification& classification);
 
+    // Get the script type name as the node reports it in decoded transactions
+    string getNodeScriptTypeName(ScriptSpan script);
+    const char* getNodeScriptTypeName(const ScriptClassification& classification);
+
+    /** Disassembles the script into the same ASM notation the node uses. When
+     * decodeSignatures is set, pushes that look like signatures get their
+     * sighash type appended (used for input scripts)
+     */
+    string getScriptAsm(const vector<unsigned char>& scriptString, bool decodeSignatures);
 
     /** Read addresses from script
      */
-    vector<string> getAddressesFromScript(vector<unsigned char> scriptString);
+    vector<string> getAddressesFromScript(ScriptSpan script);
+    vector<string> getAddressesFromScript(ScriptSpan script, const ScriptClassification& classification);
+
+    /** Read the script identifiers (see SCRIPT_ID_*) from script. These are
+     * used to key the index, addresses are only needed for display.
+     */
+    vector<string> getScriptIdsFromScript(ScriptSpan script);
+    vector<string> getScriptIdsFromScript(ScriptSpan script, const ScriptClassification& classification);
+
+    /** Reads the script identifiers of many scripts, such as all outputs in a block.
+     * The public keys found in P2PK and multisig scripts are hashed in one batch.
+     * When classifications is passed, it receives the classification of each script.
+     */
+    vector<vector<string>> getScriptIdsFromScripts(const vector<const vector<unsigned char>*>& scripts, vector<ScriptClassification>* classifications = NULL);
 
     /** Returns if the script is multisig
      */
-    bool isMultiSig(vector<unsigned char> scriptString);
+    bool isMultiSig(ScriptSpan script);
 
     /** Returns the number of required signatures
      */
-    int requiredSignatures(vector<unsigned char> scriptString);
+    int requiredSignatures(ScriptSpan script);
 };
 
 }
 
-#endif // SCRIPTSOLVER_H_INCLUDED
\ No newline at end of file
+#endif // SCRIPTSOLVER_H_INCLUDED
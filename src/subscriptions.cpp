@@ -0,0 +1,165 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "subscriptions.h"
+#include "utility.h"
+#include "json.hpp"
+
+using namespace std;
+using json = nlohmann::json;
+
+// Subscriptions a single client can hold, so one client can't exhaust memory
+const size_t maxSubscriptionsPerSubscriber = 1000;
+
+VtcBlockIndexer::SubscriptionManager::SubscriptionManager() {
+    this->nextSubscriberId = 1;
+    for(int topic = 0; topic < TOPIC_COUNT; topic++) {
+        topicCounts[topic] = 0;
+    }
+}
+
+uint64_t VtcBlockIndexer::SubscriptionManager::addSubscriber(SubscriberSend send) {
+    lock_guard<mutex> lock(subscriptionsMutex);
+    uint64_t id = nextSubscriberId++;
+    Subscriber& subscriber = subscribers[id];
+    subscriber.send = send;
+    subscriber.count = 0;
+    return id;
+}
+
+void VtcBlockIndexer::SubscriptionManager::removeSubscriber(uint64_t id) {
+    lock_guard<mutex> lock(subscriptionsMutex);
+    auto subscriber = subscribers.find(id);
+    if(subscriber == subscribers.end()) return;
+
+    for(int topic = 0; topic < TOPIC_COUNT; topic++) {
+        for(const string& key : subscriber->second.keys[topic]) {
+            auto ids = index[topic].find(key);
+            if(ids == index[topic].end()) continue;
+            ids->second.erase(id);
+            if(ids->second.empty()) {
+                index[topic].erase(ids);
+            }
+            topicCounts[topic]--;
+        }
+    }
+    subscribers.erase(subscriber);
+}
+
+bool VtcBlockIndexer::SubscriptionManager::subscribe(uint64_t id, SubscriptionTopic topic, const string& key) {
+    lock_guard<mutex> lock(subscriptionsMutex);
+    auto subscriber = subscribers.find(id);
+    if(subscriber == subscribers.end()) return false;
+    if(subscriber->second.keys[topic].count(key) > 0) return true;
+    if(subscriber->second.count >= maxSubscriptionsPerSubscriber) return false;
+
+    subscriber->second.keys[topic].insert(key);
+    subscriber->second.count++;
+    index[topic][key].insert(id);
+    topicCounts[topic]++;
+    return true;
+}
+
+void VtcBlockIndexer::SubscriptionManager::unsubscribe(uint64_t id, SubscriptionTopic topic, const string& key) {
+    lock_guard<mutex> lock(subscriptionsMutex);
+    auto subscriber = subscribers.find(id);
+    if(subscriber == subscribers.end()) return;
+    if(subscriber->second.keys[topic].erase(key) == 0) return;
+
+    subscriber->second.count--;
+    auto ids = index[topic].find(key);
+    if(ids != index[topic].end()) {
+        ids->second.erase(id);
+        if(ids->second.empty()) {
+            index[topic].erase(ids);
+        }
+    }
+    topicCounts[topic]--;
+}
+
+bool VtcBlockIndexer::SubscriptionManager::hasSubscriptions(SubscriptionTopic topic) {
+    return topicCounts[topic] > 0;
+}
+
+void VtcBlockIndexer::SubscriptionManager::publish(SubscriptionTopic topic, const string& key, const function<string()>& buildMessage) {
+    vector<SubscriberSend> receivers;
+    {
+        lock_guard<mutex> lock(subscriptionsMutex);
+        auto ids = index[topic].find(key);
+        if(ids == index[topic].end()) return;
+        for(uint64_t id : ids->second) {
+            receivers.push_back(subscribers[id].send);
+        }
+    }
+    string message = buildMessage();
+    for(const SubscriberSend& send : receivers) {
+        send(message);
+    }
+}
+
+void VtcBlockIndexer::SubscriptionManager::notifyBlockConnected(const string& blockHash, uint64_t height) {
+    if(!hasSubscriptions(TOPIC_BLOCKS)) return;
+    publish(TOPIC_BLOCKS, "", [&]() {
+        json j;
+        j["event"] = "block";
+        j["hash"] = blockHash;
+        j["height"] = height;
+        return j.dump();
+    });
+}
+
+void VtcBlockIndexer::SubscriptionManager::notifyBlockDisconnected(const string& blockHash, uint64_t height) {
+    if(!hasSubscriptions(TOPIC_BLOCKS)) return;
+    publish(TOPIC_BLOCKS, "", [&]() {
+        json j;
+        j["event"] = "reorg";
+        j["hash"] = blockHash;
+        j["height"] = height;
+        return j.dump();
+    });
+}
+
+void VtcBlockIndexer::SubscriptionManager::notifyTransaction(const string& txid, const unordered_set<string>& scriptIds, const vector<string>& spends, uint64_t height) {
+    if(hasSubscriptions(TOPIC_ADDRESS)) {
+        for(const string& scriptId : scriptIds) {
+            publish(TOPIC_ADDRESS, scriptId, [&]() {
+                json j;
+                j["event"] = "address";
+                j["address"] = Utility::scriptIdToAddress(scriptId);
+                j["txid"] = txid;
+                j["height"] = height;
+                return j.dump();
+            });
+        }
+    }
+    if(hasSubscriptions(TOPIC_OUTPOINT)) {
+        for(const string& outpoint : spends) {
+            publish(TOPIC_OUTPOINT, outpoint, [&]() {
+                json j;
+                j["event"] = "outpoint";
+                j["txid"] = outpoint.substr(0, 64);
+                j["vout"] = stoll(outpoint.substr(64));
+                j["spender"] = txid;
+                j["height"] = height;
+                return j.dump();
+            });
+        }
+    }
+}
@@ -0,0 +1,120 @@
+/*  VTC Blockindexer - A utility to build additional indexes to the 
+    Vertcoin blockchain by scanning and indexing the blockfiles
+    downloaded by Vertcoin Core.
+    
+    Copyright (C) 2017  Gert-Jaap Glasbergen
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SUBSCRIPTIONS_H_INCLUDED
+#define SUBSCRIPTIONS_H_INCLUDED
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+namespace VtcBlockIndexer {
+
+// What a subscription is for. The key identifies the address or outpoint.
+enum SubscriptionTopic {
+    // New and disconnected blocks, no key
+    TOPIC_BLOCKS = 0,
+    // Transactions paying to or spending from a script identifier
+    TOPIC_ADDRESS,
+    // The spend of an outpoint (txid + 8 digit vout)
+    TOPIC_OUTPOINT,
+    TOPIC_COUNT
+};
+
+// Delivers an event message to a subscriber. Called without locks held.
+typedef function<void(const string& message)> SubscriberSend;
+
+/**
+ * The SubscriptionManager class keeps the subscriptions of connected clients in
+ * memory and pushes events to them as blocks and mempool transactions come in.
+ * Events are JSON text messages.
+ */
+
+class SubscriptionManager {
+public:
+    SubscriptionManager();
+
+    /** Registers a client and returns the id to subscribe with
+     */
+    uint64_t addSubscriber(SubscriberSend send);
+
+    /** Removes a client and all of its subscriptions
+     */
+    void removeSubscriber(uint64_t id);
+
+    /** Subscribes a client to a topic. Returns false when the client reached the
+     * maximum number of subscriptions
+     */
+    bool subscribe(uint64_t id, SubscriptionTopic topic, const string& key);
+
+    void unsubscribe(uint64_t id, SubscriptionTopic topic, const string& key);
+
+    /** Returns true if anyone subscribed to the topic, so callers can skip
+     * building events nobody receives
+     */
+    bool hasSubscriptions(SubscriptionTopic topic);
+
+    /** A block was added to the chain at height
+     */
+    void notifyBlockConnected(const string& blockHash, uint64_t height);
+
+    /** A block was replaced by another block at height (reorg)
+     */
+    void notifyBlockDisconnected(const string& blockHash, uint64_t height);
+
+    /** A transaction was seen, either in a block at height or in the mempool
+     * (height 0). scriptIds are the addresses it pays to and spends from, spends
+     * the outpoints (txid + 8 digit vout) it spends
+     */
+    void notifyTransaction(const string& txid, const unordered_set<string>& scriptIds, const vector<string>& spends, uint64_t height);
+
+private:
+    /** Sends a message to the subscribers of a key. The message is only built
+     * when the key has subscribers
+     */
+    void publish(SubscriptionTopic topic, const string& key, const function<string()>& buildMessage);
+
+    mutex subscriptionsMutex;
+    uint64_t nextSubscriberId;
+
+    struct Subscriber {
+        SubscriberSend send;
+        // Subscribed keys per topic, to clean up when the client leaves
+        unordered_set<string> keys[TOPIC_COUNT];
+        size_t count;
+    };
+    unordered_map<uint64_t, Subscriber> subscribers;
+
+    // Subscriber ids by key, per topic
+    unordered_map<string, unordered_set<uint64_t>> index[TOPIC_COUNT];
+
+    // Number of subscriptions per topic, readable without the lock
+    atomic<size_t> topicCounts[TOPIC_COUNT];
+};
+
+}
+
+#endif // SUBSCRIPTIONS_H_INCLUDED
@@ -20,15 +20,22 @@
 */
 
 #include <openssl/sha.h>
+#include <openssl/hmac.h>
+#include <openssl/evp.h>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <iomanip>
 #include <vector>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
 #include <secp256k1.h>
 #include "crypto/ripemd160.h"
+#include "crypto/hash160.h"
 #include "crypto/bech32.h"
 #include "coinparams.h"
+#include "scriptsolver.h"
 #include <assert.h>     /* assert */
 
 using namespace std;
@@ -37,6 +44,7 @@ namespace
 {
     /* Global secp256k1_context object used for verification. */
     secp256k1_context* secp256k1_context_verify = NULL;
+    std::once_flag secp256k1_context_verify_created;
 
     typedef std::vector<uint8_t> data;
 
@@ -95,9 +103,10 @@ std::string VtcBlockIndexer::Utility::hashToReverseHex(vector<unsigned char> has
 }
 
 void VtcBlockIndexer::Utility::initECCContextIfNeeded() {
-    if(secp256k1_context_verify == NULL) {
+    // HTTP worker threads derive keys concurrently, so the context is created once
+    std::call_once(secp256k1_context_verify_created, []() {
         secp256k1_context_verify = secp256k1_context_create(SECP256K1_FLAGS_TYPE_CONTEXT | SECP256K1_FLAGS_BIT_CONTEXT_VERIFY);
-    }
+    });
 }
 
 VtcBlockIndexer::Utility::~Utility() {
@@ -125,10 +134,35 @@ vector<unsigned char> VtcBlockIndexer::Utility::decompressPubKey(vector<unsigned
 
 
 string VtcBlockIndexer::Utility::publicKeyToAddress(vector<unsigned char> publicKey) {
-    vector<unsigned char> hashedKey = sha256(publicKey);    
-    vector<unsigned char> ripeMD = ripeMD160(hashedKey);
+    return ripeMD160ToP2PKAddress(hash160(publicKey));
+}
+
+vector<unsigned char> VtcBlockIndexer::Utility::hash160(const vector<unsigned char>& input) {
+    unsigned char sha[SHA256_DIGEST_LENGTH];
+    SHA256(input.data(), input.size(), sha);
+    vector<unsigned char> hash(CRIPEMD160::OUTPUT_SIZE);
+    CRIPEMD160().Write(sha, SHA256_DIGEST_LENGTH).Finalize(hash.data());
+    return hash;
+}
+
+void VtcBlockIndexer::Utility::hash160Batch(const vector<pair<const unsigned char*, size_t>>& inputs, vector<unsigned char>& out) {
+    if(inputs.empty()) return;
+
+    // The SHA-256 results are stored back to back so the RIPEMD-160 step can
+    // hash them in parallel lanes. Every input starts from the same
+    // initialized SHA-256 state.
+    SHA256_CTX initialState;
+    SHA256_Init(&initialState);
+    vector<unsigned char> sha(inputs.size() * SHA256_DIGEST_LENGTH);
+    for(size_t i = 0; i < inputs.size(); i++) {
+        SHA256_CTX context = initialState;
+        SHA256_Update(&context, inputs[i].first, inputs[i].second);
+        SHA256_Final(sha.data() + i * SHA256_DIGEST_LENGTH, &context);
+    }
 
-    return ripeMD160ToP2PKAddress(ripeMD);
+    size_t offset = out.size();
+    out.resize(offset + inputs.size() * CRIPEMD160::OUTPUT_SIZE);
+    RIPEMD160x32Batch(sha.data(), inputs.size(), out.data() + offset);
 }
 
 string VtcBlockIndexer::Utility::ripeMD160ToP2PKAddress(vector<unsigned char> ripeMD) {
@@ -170,10 +204,136 @@ vector<unsigned char> VtcBlockIndexer::Utility::ripeMD160(vector<unsigned char>
 
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
-std::string VtcBlockIndexer::Utility::base58(vector<unsigned char> in)
+// Value of each character in the base58 alphabet, -1 for characters outside of it
+static const int8_t mapBase58[256] = {
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6,  7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15, 16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29, 30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39, 40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54, 55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+namespace
 {
-    unsigned char* pbegin = &in[0];
-    unsigned char* pend = &in[0] + in.size();
+    typedef unsigned __int128 uint128;
+
+    // Numbers up to 256 bits are kept in four 64-bit limbs, least significant first.
+    // That covers the 25 byte (version + hash + checksum) payload of every address.
+    const size_t base58Limbs = 4;
+    const size_t base58MaxLimbBytes = base58Limbs * 8;
+
+    // 58^10 is the largest power of 58 that fits in 64 bits, so every division
+    // by it yields ten base58 digits at once
+    const uint64_t base58ChunkDigits = 10;
+    const uint64_t base58Chunk = 430804206899405824ULL;
+
+    // Longest string whose value still fits the limbs (58^43 < 2^256)
+    const size_t base58MaxLimbChars = 43;
+
+    string base58EncodeLimbs(const unsigned char* begin, const unsigned char* end) {
+        size_t zeroes = 0;
+        while (begin != end && *begin == 0) {
+            begin++;
+            zeroes++;
+        }
+
+        uint64_t limbs[base58Limbs] = {0, 0, 0, 0};
+        size_t shift = 0;
+        for (const unsigned char* p = end; p != begin; shift += 8) {
+            p--;
+            limbs[shift / 64] |= (uint64_t)*p << (shift % 64);
+        }
+
+        // Divide by 58^10 until nothing is left, collecting the digits from
+        // least to most significant
+        char digits[(base58Limbs + 1) * base58ChunkDigits];
+        size_t digitCount = 0;
+        size_t topLimb = base58Limbs;
+        while (topLimb > 0 && limbs[topLimb - 1] == 0) topLimb--;
+        while (topLimb > 0) {
+            uint64_t remainder = 0;
+            for (size_t i = topLimb; i-- > 0;) {
+                uint128 current = ((uint128)remainder << 64) | limbs[i];
+                limbs[i] = (uint64_t)(current / base58Chunk);
+                remainder = (uint64_t)(current % base58Chunk);
+            }
+            while (topLimb > 0 && limbs[topLimb - 1] == 0) topLimb--;
+            for (size_t i = 0; i < base58ChunkDigits; i++) {
+                digits[digitCount++] = (char)(remainder % 58);
+                remainder /= 58;
+            }
+        }
+
+        // The most significant chunk is padded with zero digits
+        while (digitCount > 0 && digits[digitCount - 1] == 0) digitCount--;
+
+        string str;
+        str.reserve(zeroes + digitCount);
+        str.assign(zeroes, '1');
+        while (digitCount > 0) {
+            str += pszBase58[(int)digits[--digitCount]];
+        }
+        return str;
+    }
+
+    bool base58DecodeLimbs(const string& in, size_t zeroes, vector<unsigned char>& out) {
+        uint64_t limbs[base58Limbs] = {0, 0, 0, 0};
+        size_t pos = zeroes;
+        while (pos < in.size()) {
+            // Collect up to ten digits into a single chunk, then apply
+            // "limbs = limbs * 58^digits + chunk"
+            uint64_t chunk = 0;
+            uint64_t multiplier = 1;
+            for (size_t i = 0; i < base58ChunkDigits && pos < in.size(); i++, pos++) {
+                int8_t digit = mapBase58[(unsigned char)in[pos]];
+                if (digit < 0) {
+                    return false;
+                }
+                chunk = chunk * 58 + digit;
+                multiplier *= 58;
+            }
+            uint64_t carry = chunk;
+            for (size_t i = 0; i < base58Limbs; i++) {
+                uint128 current = (uint128)limbs[i] * multiplier + carry;
+                limbs[i] = (uint64_t)current;
+                carry = (uint64_t)(current >> 64);
+            }
+            assert(carry == 0);
+        }
+
+        unsigned char bytes[base58MaxLimbBytes];
+        for (size_t i = 0; i < base58MaxLimbBytes; i++) {
+            bytes[base58MaxLimbBytes - 1 - i] = (unsigned char)(limbs[i / 8] >> ((i % 8) * 8));
+        }
+        size_t skip = 0;
+        while (skip < base58MaxLimbBytes && bytes[skip] == 0) skip++;
+
+        out.assign(zeroes, 0x00);
+        out.insert(out.end(), bytes + skip, bytes + base58MaxLimbBytes);
+        return true;
+    }
+}
+
+std::string VtcBlockIndexer::Utility::base58(const vector<unsigned char>& in)
+{
+    const unsigned char* pbegin = in.data();
+    const unsigned char* pend = in.data() + in.size();
+
+    // Addresses and other short payloads fit in the fixed size limbs
+    if (in.size() <= base58MaxLimbBytes) {
+        return base58EncodeLimbs(pbegin, pend);
+    }
 
     // Skip & count leading zeroes.
     int zeroes = 0;
@@ -216,6 +376,181 @@ std::string VtcBlockIndexer::Utility::base58(vector<unsigned char> in)
     return str;
 }
 
+bool VtcBlockIndexer::Utility::base58Decode(const string& in, vector<unsigned char>& out)
+{
+    // Skip & count leading '1's, they represent leading zero bytes
+    size_t zeroes = 0;
+    while (zeroes < in.size() && in[zeroes] == '1') {
+        zeroes++;
+    }
+
+    // Addresses are short enough to be decoded in the fixed size limbs
+    if (in.size() - zeroes <= base58MaxLimbChars) {
+        return base58DecodeLimbs(in, zeroes, out);
+    }
+
+    // Allocate enough space in big-endian base256 representation.
+    size_t size = (in.size() - zeroes) * 733 / 1000 + 1; // log(58) / log(256), rounded up.
+    vector<unsigned char> b256(size);
+    size_t length = 0;
+    for (size_t pos = zeroes; pos < in.size(); pos++) {
+        // Apply "b256 = b256 * 58 + ch".
+        int carry = mapBase58[(unsigned char)in[pos]];
+        if (carry < 0) {
+            return false;
+        }
+        size_t i = 0;
+        for (vector<unsigned char>::reverse_iterator it = b256.rbegin(); (carry != 0 || i < length) && (it != b256.rend()); ++it, ++i) {
+            carry += 58 * (*it);
+            *it = carry % 256;
+            carry /= 256;
+        }
+        assert(carry == 0);
+        length = i;
+    }
+
+    vector<unsigned char>::iterator it = b256.begin() + (size - length);
+    out.assign(zeroes, 0x00);
+    out.insert(out.end(), it, b256.end());
+    return true;
+}
+
+string VtcBlockIndexer::Utility::scriptIdToAddress(const string& scriptId) {
+    if(scriptId.size() < 2) return "";
+    vector<unsigned char> hash(scriptId.begin() + 1, scriptId.end());
+    switch((unsigned char)scriptId[0]) {
+        case SCRIPT_ID_P2PKH:
+            return ripeMD160ToP2PKAddress(hash);
+        case SCRIPT_ID_P2SH:
+            return ripeMD160ToP2SHAddress(hash);
+        case SCRIPT_ID_P2WPKH:
+        case SCRIPT_ID_P2WSH:
+            return bech32Address(hash);
+        default:
+            return "";
+    }
+}
+
+string VtcBlockIndexer::Utility::addressToScriptId(const string& address) {
+    vector<unsigned char> decoded;
+    if(base58Decode(address, decoded) && decoded.size() == 25) {
+        vector<unsigned char> payload(decoded.begin(), decoded.begin() + 21);
+        vector<unsigned char> checksum = sha256(sha256(payload));
+        if(!equal(checksum.begin(), checksum.begin() + 4, decoded.begin() + 21)) {
+            return "";
+        }
+        if(decoded[0] == VtcBlockIndexer::CoinParams::p2pkhVersion) {
+            return string(1, (char)SCRIPT_ID_P2PKH) + string(decoded.begin() + 1, decoded.begin() + 21);
+        }
+        if(decoded[0] == VtcBlockIndexer::CoinParams::p2shVersion) {
+            return string(1, (char)SCRIPT_ID_P2SH) + string(decoded.begin() + 1, decoded.begin() + 21);
+        }
+        return "";
+    }
+
+    pair<string, vector<uint8_t>> bech32Decoded = bech32::Decode(address);
+    if(bech32Decoded.first != VtcBlockIndexer::CoinParams::bech32Prefix || bech32Decoded.second.size() < 1 || bech32Decoded.second[0] != 0) {
+        return "";
+    }
+    data program;
+    if(!convertbits<5, 8, false>(program, data(bech32Decoded.second.begin() + 1, bech32Decoded.second.end()))) {
+        return "";
+    }
+    if(program.size() == 20) {
+        return string(1, (char)SCRIPT_ID_P2WPKH) + string(program.begin(), program.end());
+    }
+    if(program.size() == 32) {
+        return string(1, (char)SCRIPT_ID_P2WSH) + string(program.begin(), program.end());
+    }
+    return "";
+}
+
+vector<string> VtcBlockIndexer::Utility::splitScriptIds(const string& scriptIds) {
+    vector<string> result;
+    size_t pos = 0;
+    while(pos < scriptIds.size()) {
+        size_t length = ((unsigned char)scriptIds[pos] == SCRIPT_ID_P2WSH ? 33 : 21);
+        if(pos + length > scriptIds.size()) break;
+        result.push_back(scriptIds.substr(pos, length));
+        pos += length;
+    }
+    return result;
+}
+
+bool VtcBlockIndexer::Utility::decodeExtendedPubKey(const string& encoded, ExtendedPubKey& key) {
+    // version (4) depth (1) parent fingerprint (4) child number (4) chain code (32) key (33) checksum (4)
+    vector<unsigned char> decoded;
+    if(!base58Decode(encoded, decoded) || decoded.size() != 82) {
+        return false;
+    }
+    vector<unsigned char> payload(decoded.begin(), decoded.begin() + 78);
+    vector<unsigned char> checksum = sha256(sha256(payload));
+    if(!equal(checksum.begin(), checksum.begin() + 4, decoded.begin() + 78)) {
+        return false;
+    }
+    if(decoded[45] != 0x02 && decoded[45] != 0x03) {
+        return false;
+    }
+
+    initECCContextIfNeeded();
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, &decoded[45], 33)) {
+        return false;
+    }
+
+    key.version = ((uint32_t)decoded[0] << 24) | ((uint32_t)decoded[1] << 16) | ((uint32_t)decoded[2] << 8) | decoded[3];
+    key.depth = decoded[4];
+    key.chainCode.assign(decoded.begin() + 13, decoded.begin() + 45);
+    key.publicKey.assign(decoded.begin() + 45, decoded.begin() + 78);
+    return true;
+}
+
+bool VtcBlockIndexer::Utility::deriveChildPubKey(const ExtendedPubKey& parent, uint32_t index, ExtendedPubKey& child) {
+    if(index >= 0x80000000) {
+        // Hardened children need the private key
+        return false;
+    }
+
+    // I = HMAC-SHA512(chain code, public key || index)
+    unsigned char data[37];
+    memcpy(data, parent.publicKey.data(), 33);
+    data[33] = (index >> 24) & 0xFF;
+    data[34] = (index >> 16) & 0xFF;
+    data[35] = (index >> 8) & 0xFF;
+    data[36] = index & 0xFF;
+    unsigned char hmac[64];
+    unsigned int hmacLength = 64;
+    HMAC(EVP_sha512(), parent.chainCode.data(), parent.chainCode.size(), data, sizeof(data), hmac, &hmacLength);
+
+    // The child key is the parent key plus the point of the left half
+    initECCContextIfNeeded();
+    secp256k1_pubkey pubkey;
+    if (!secp256k1_ec_pubkey_parse(secp256k1_context_verify, &pubkey, parent.publicKey.data(), 33)) {
+        return false;
+    }
+    if (!secp256k1_ec_pubkey_tweak_add(secp256k1_context_verify, &pubkey, hmac)) {
+        return false;
+    }
+    child.version = parent.version;
+    child.depth = parent.depth + 1;
+    child.publicKey.resize(33);
+    size_t publen = 33;
+    secp256k1_ec_pubkey_serialize(secp256k1_context_verify, child.publicKey.data(), &publen, &pubkey, SECP256K1_EC_COMPRESSED);
+    child.chainCode.assign(hmac + 32, hmac + 64);
+    return true;
+}
+
+string VtcBlockIndexer::Utility::publicKeyToScriptId(const vector<unsigned char>& publicKey, unsigned char scriptIdType) {
+    vector<unsigned char> keyHash = hash160(publicKey);
+    if(scriptIdType == SCRIPT_ID_P2SH) {
+        // The redeem script is the witness program: OP_0 <20 byte key hash>
+        vector<unsigned char> redeemScript = { 0x00, 0x14 };
+        redeemScript.insert(redeemScript.end(), keyHash.begin(), keyHash.end());
+        keyHash = hash160(redeemScript);
+    }
+    return string(1, (char)scriptIdType) + string(keyHash.begin(), keyHash.end());
+}
+
 string VtcBlockIndexer::Utility::bech32Address(vector<unsigned char> in) {
     vector<unsigned char> enc;
     enc.push_back(0); // witness version
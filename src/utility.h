@@ -18,12 +18,30 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef UTILITY_H_INCLUDED
+#define UTILITY_H_INCLUDED
+
 #include <vector>
 #include <string>
+#include <utility>
+#include <cstdint>
 
 using namespace std;
 
 namespace VtcBlockIndexer {
+
+    /**
+     * A BIP32 extended public key
+     */
+    struct ExtendedPubKey {
+        // The version bytes, which tell the script type wallets use the key for
+        uint32_t version;
+        unsigned char depth;
+
+        // Compressed public key (33 bytes)
+        vector<unsigned char> publicKey;
+        vector<unsigned char> chainCode;
+    };
     
     /**
      * The Utility class provides methods to perform various cryptographic operations
@@ -41,11 +59,58 @@ namespace VtcBlockIndexer {
             static vector<unsigned char> decompressPubKey(vector<unsigned char> compressedKey);
             static string publicKeyToAddress(vector<unsigned char> publicKey);
             static vector<unsigned char> ripeMD160(vector<unsigned char> in);
-            static string base58(vector<unsigned char> in);
+            /** Encodes bytes as base58. Payloads up to 32 bytes, which includes
+             * every address, are encoded using 64-bit limbs
+             */
+            static string base58(const vector<unsigned char>& in);
             static string ripeMD160ToP2PKAddress(vector<unsigned char> ripeMD);
             static string ripeMD160ToP2SHAddress(vector<unsigned char> ripeMD);
             static string bech32Address(vector<unsigned char> in);
             static vector<unsigned char> hexToBytes(string hex);
+
+            /** Calculates RIPEMD-160(SHA-256(input)), as used for public key hashes */
+            static vector<unsigned char> hash160(const vector<unsigned char>& input);
+
+            /** Calculates HASH160 over many inputs (such as all public keys in a block)
+             * at once. Appends 20 bytes per input to out, in the order of inputs.
+             */
+            static void hash160Batch(const vector<pair<const unsigned char*, size_t>>& inputs, vector<unsigned char>& out);
+
+            /** Decodes a base58 string into bytes. Returns false if the string
+             * contains characters outside of the base58 alphabet
+             */
+            static bool base58Decode(const string& in, vector<unsigned char>& out);
+
+            /** Converts a script identifier (one SCRIPT_ID_* type byte followed by
+             * the hash) into the address shown to users
+             */
+            static string scriptIdToAddress(const string& scriptId);
+
+            /** Converts a base58 or bech32 address into its script identifier.
+             * Returns an empty string if the address is not valid for this coin.
+             */
+            static string addressToScriptId(const string& address);
+
+            /** Splits concatenated script identifiers. The type byte determines
+             * the length of each identifier, so they need no separator.
+             */
+            static vector<string> splitScriptIds(const string& scriptIds);
+
+            /** Decodes a base58check extended public key (xpub). Returns false if the
+             * checksum or length is wrong or the key is not a valid public key
+             */
+            static bool decodeExtendedPubKey(const string& encoded, ExtendedPubKey& key);
+
+            /** Derives the non-hardened child key at index (BIP32 CKDpub). Returns false
+             * for the (astronomically unlikely) indexes that give no valid key
+             */
+            static bool deriveChildPubKey(const ExtendedPubKey& parent, uint32_t index, ExtendedPubKey& child);
+
+            /** Returns the script identifier for paying to a compressed public key. The
+             * type is SCRIPT_ID_P2PKH, SCRIPT_ID_P2WPKH or SCRIPT_ID_P2SH for P2WPKH
+             * nested in P2SH
+             */
+            static string publicKeyToScriptId(const vector<unsigned char>& publicKey, unsigned char scriptIdType);
             ~Utility();
             
         private:
@@ -54,3 +119,5 @@ namespace VtcBlockIndexer {
             Utility() {}
     };
 }
+
+#endif // UTILITY_H_INCLUDED